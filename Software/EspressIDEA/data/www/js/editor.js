@@ -18,6 +18,7 @@ const $  = (sel, root) => (root || document).querySelector(sel);
 const state = {
   docs: new Map(), // path -> { name, text, dirty }
   activePath: null,
+  jobId: null,     // trabajo de /api/exec/jobs en curso
 };
 
 const els = {
@@ -236,47 +237,75 @@ async function execActiveEditor(){
     await FS.ensureIdle();
     setWsStatus('idle'); // feedback intermedio
 
-    // 3) Ejecutar
-    const resp = await fetch('/api/exec', {
+    // 3) Ejecutar como trabajo en segundo plano y seguir su salida
+    const resp = await fetch('/api/exec/jobs', {
       method: 'POST',
       headers: { 'Content-Type': 'text/plain' },
       body: code
     });
-    const j = await parseJSON(resp);
-    if (!j.ok) {
-      console.log("fallo silencioso");
-      return;
-    }
+    const sub = await parseJSON(resp);
+    if (!sub.ok) throw new Error(sub.error || 'HTTP ' + resp.status);
+    state.jobId = sub.id;
+    setWsStatus('running');
 
+    let pre = null;
     if (els.terminal){
       const hdr = document.createElement('div');
       hdr.style.opacity = '0.8';
       hdr.style.margin = '6px 0';
       hdr.textContent = '⮕ Salida de ejecución';
-      const pre = document.createElement('pre');
-      pre.textContent = j.stdout || '';
+      pre = document.createElement('pre');
       els.terminal.appendChild(hdr);
       els.terminal.appendChild(pre);
-      els.terminal.scrollTop = els.terminal.scrollHeight;
-    } else {
-      alert(j.stdout || 'Ejecutado sin salida.');
     }
 
+    let all = '';
+    let since = 0;
+    let job = null;
+    for (;;){
+      const r = await fetch(`/api/exec/jobs/output?id=${sub.id}&since=${since}&wait=5000`);
+      if (r.status === 503) { await new Promise(res => setTimeout(res, 300)); continue; }
+      const j = await parseJSON(r);
+      if (!j.ok) throw new Error(j.error || 'HTTP ' + r.status);
+      job = j.job;
+      since = j.next;
+      const text = (j.dropped ? `\n[… ${j.dropped} bytes omitidos …]\n` : '') + (j.out || '');
+      if (text){
+        all += text;
+        if (pre){
+          pre.textContent += text;
+          els.terminal.scrollTop = els.terminal.scrollHeight;
+        }
+      }
+      if (!['queued', 'running'].includes(job.state) && !j.out && !j.dropped) break;
+    }
+    state.jobId = null;
+
+    if (job.state !== 'done') {
+      console.log('exec:', job.state, job.error);
+      setWsStatus(job.state === 'cancelled' ? 'idle' : 'error');
+      return;
+    }
+    if (!pre) alert(all || 'Ejecutado sin salida.');
+
     setWsStatus('ok');
   } catch(e){
     console.error(e);
     setWsStatus('error');
     alert('Error al ejecutar: ' + e.message);
   } finally {
+    state.jobId = null;
     if (els.btnRun) els.btnRun.disabled = false;
   }
 }
 
 async function ensureIdleRepl(){
   try{
-    const resp = await fetch('/api/repl/ensure_idle', { method:'POST' });
-    const j = await parseJSON(resp);
-    if (!j.ok) throw new Error('No se pudo asegurar REPL inactivo');
+    // Si hay un programa nuestro corriendo, alcanza con cancelarlo (^C)
+    if (state.jobId){
+      await fetch(`/api/exec/jobs/cancel?id=${state.jobId}`, { method:'POST' });
+    }
+    await FS.ensureIdle(true); // reintenta solo si el server responde 503
     setWsStatus('idle');
   } catch(e){
     console.error(e);
@@ -17,12 +17,11 @@ export function setExternalEditor(on){ externalEditor = !!on; }
 
 // --- NUEVO: writeFile arbitrario (sin depender del textarea interno) ---
 export function writeFile(path, text){
-  const b64 = base64Encode(text || "");
   return ensureIdle()
-    .then(() => fetchJSON("/api/fs/write?path=" + encodeURIComponent(path), {
+    .then(() => fetchJSON("/api/fs/write?delta=1&raw=1&path=" + encodeURIComponent(path), {
       method: "POST",
-      headers: { "Content-Type": "text/plain" },
-      body: b64
+      headers: { "Content-Type": "application/octet-stream" },
+      body: text || ""
     }))
     .then(res => {
       if (!res.ok) throw new Error(res.error || "write failed");
@@ -32,12 +31,11 @@ export function writeFile(path, text){
 
 // --- NUEVO: create (usa /api/fs/create) ---
 export function apiCreate(path, text = ""){
-  const b64 = base64Encode(text || "");
   return ensureIdle()
-    .then(() => fetchJSON("/api/fs/create?path=" + encodeURIComponent(path), {
+    .then(() => fetchJSON("/api/fs/create?raw=1&path=" + encodeURIComponent(path), {
       method: "POST",
-      headers: { "Content-Type": "text/plain" },
-      body: b64
+      headers: { "Content-Type": "application/octet-stream" },
+      body: text || ""
     }))
     .then(j => { if (!j.ok) throw new Error(j.error || "create failed"); });
 }
@@ -46,10 +44,38 @@ const $  = (sel, root) => (root || document).querySelector(sel);
 const $$ = (sel, root) => Array.prototype.slice.call((root || document).querySelectorAll(sel));
 
 function base64Encode(str){ return btoa(unescape(encodeURIComponent(str))); }
-function base64Decode(b64){ return decodeURIComponent(escape(atob(b64))); }
+
+// 503 "busy": el pool de workers o el cupo de la ruta están llenos (otra
+// pestaña, un trabajo corriendo). Se reintenta tras Retry-After segundos,
+// hasta BUSY_RETRIES veces, en vez de mostrar el error.
+const BUSY_RETRIES = 10;
+function fetchRetry(url, init, left = BUSY_RETRIES){
+  return fetch(url, init || {}).then(res => {
+    if (res.status !== 503 || left <= 0) return res;
+    const secs = parseFloat(res.headers.get("Retry-After"));
+    const wait = Number.isFinite(secs) ? Math.min(secs * 1000, 5000) : 1000;
+    return new Promise(ok => setTimeout(ok, wait)).then(() => fetchRetry(url, init, left - 1));
+  });
+}
+
+// Lectura con raw=1: el cuerpo es el archivo tal cual (UTF-8); los errores
+// llegan como JSON
+function fetchText(url){
+  return fetchRetry(url).then(res => {
+    const type = res.headers.get("Content-Type") || "";
+    if (!res.ok || type.indexOf("application/json") === 0) {
+      return res.text().then(txt => {
+        let data = null;
+        try { data = JSON.parse(txt); } catch(e) {}
+        throw new Error((data && data.error) ? data.error : ("HTTP " + res.status));
+      });
+    }
+    return res.arrayBuffer().then(buf => new TextDecoder().decode(buf));
+  });
+}
 
 function fetchJSON(url, init){
-  return fetch(url, init || {}).then(res =>
+  return fetchRetry(url, init).then(res =>
     res.text().then(txt => {
       let data = null;
       try { data = JSON.parse(txt); } catch(e) {}
@@ -77,6 +103,12 @@ const state = {
   selected: null // { path, name, dir(bool) }
 };
 
+// ===== Caché del árbol =====
+// /api/fs/tree trae la carpeta y sus subcarpetas en un solo recorrido; entrar
+// a una subcarpeta ya listada no vuelve a pedir nada a la placa.
+const TREE_DEPTH = 8;
+const dirCache = new Map(); // ruta -> [{name,size,dir}] (solo carpetas listadas enteras)
+
 // ===== Elementos (se resuelven en initFS) =====
 const els = {
   tree:        null,
@@ -95,12 +127,14 @@ const els = {
 };
 
 // ===== ensure_idle =====
+// Por defecto es un sondeo barato (no reinicia si el REPL ya está en >>>);
+// hard=true corta lo que corra y hace soft reboot (botón STOP)
 let lastEnsure = 0;
-export function ensureIdle(){
+export function ensureIdle(hard = false){
   const now = Date.now();
-  if (now - lastEnsure < 250) return Promise.resolve();
+  if (!hard && now - lastEnsure < 250) return Promise.resolve();
   lastEnsure = now;
-  return fetchJSON("/api/repl/ensure_idle", { method:"POST" }).then(j => {
+  return fetchJSON("/api/repl/ensure_idle" + (hard ? "?hard=1" : ""), { method:"POST" }).then(j => {
     if (j && j.ok === false) throw new Error(j.error || "ensure_idle failed");
   });
 }
@@ -145,12 +179,8 @@ function renderTree(files){
     liUp.className = "up-item";
     liUp.innerHTML = '<i class="bi bi-arrow-90deg-up"></i> ..';
     liUp.addEventListener("click", () => {
-      ensureIdle()
-        .then(() => {
-          const parent = state.cwd.replace(/\/+$/, "").split("/").slice(0, -1).join("/") || "/";
-          return listDir(parent);
-        })
-        .catch(e => alert(e.message));
+      const parent = state.cwd.replace(/\/+$/, "").split("/").slice(0, -1).join("/") || "/";
+      showDir(parent).catch(e => alert(e.message));
     });
     els.tree.appendChild(liUp);
   }
@@ -168,8 +198,7 @@ function renderTree(files){
     // click: carpeta => navegar; archivo => abrir
     li.addEventListener("click", () => {
       if (f.dir) {
-        ensureIdle().then(() => listDir(joinPath(state.cwd, f.name)))
-                    .catch(e => alert(e.message));
+        showDir(joinPath(state.cwd, f.name)).catch(e => alert(e.message));
         return;
       }
       openFile(joinPath(state.cwd, f.name));
@@ -194,21 +223,66 @@ function renderTree(files){
 }
 
 // ===== Operaciones de FS =====
-export function listDir(path){
-  return fetchJSON("/api/fs/list?path=" + encodeURIComponent(path)).then(j => {
-    if (!j.ok) throw new Error(j.error || "list failed");
-    state.cwd = j.path || path;
-    clearSelection();
-    renderTree(j.files || []);
+function dirLevel(rel){ return rel ? rel.split("/").length : 0; }
+
+// Respuesta TSV de /api/fs/tree ("d|f<TAB>tamaño<TAB>ruta relativa") ->
+// hijos de cada carpeta. Solo se guardan las de nivel < complete: las demás
+// pueden haber quedado a medias (límite de profundidad o de entradas).
+function cacheTree(root, text, complete){
+  const prefix = root === "/" ? "/" : root.replace(/\/+$/, "") + "/";
+  for (const k of Array.from(dirCache.keys())) {
+    if (k === root || k.startsWith(prefix)) dirCache.delete(k);
+  }
+  const dirs = new Map([["", []]]);
+  text.split("\n").forEach(line => {
+    const t1 = line.indexOf("\t"), t2 = line.indexOf("\t", t1 + 1);
+    if (t1 !== 1 || t2 < 0) return;
+    const rel = line.slice(t2 + 1);
+    const cut = rel.lastIndexOf("/");
+    const parent = cut < 0 ? "" : rel.slice(0, cut);
+    const isDir = line[0] === "d";
+    if (!dirs.has(parent)) dirs.set(parent, []);
+    dirs.get(parent).push({ name: rel.slice(cut + 1), size: Number(line.slice(t1 + 1, t2)), dir: isDir });
+    if (isDir && !dirs.has(rel)) dirs.set(rel, []);
+  });
+  dirs.forEach((files, rel) => {
+    if (dirLevel(rel) < complete) dirCache.set(rel ? joinPath(root, rel) : root, files);
   });
+  return dirs.get("");
+}
+
+function showFiles(path, files){
+  state.cwd = path;
+  clearSelection();
+  renderTree(files.slice());
+}
+
+// Lista 'path' desde la placa (y de paso todo su subárbol)
+export function listDir(path){
+  const url = "/api/fs/tree?path=" + encodeURIComponent(path) + "&depth=" + TREE_DEPTH;
+  return fetchRetry(url).then(res => res.text().then(txt => {
+    const type = res.headers.get("Content-Type") || "";
+    if (!res.ok || type.indexOf("json") >= 0) {
+      let j = null;
+      try { j = JSON.parse(txt); } catch(e) {}
+      throw new Error((j && j.error) || ("HTTP " + res.status));
+    }
+    const complete = Number(res.headers.get("X-Tree-Complete") || 0);
+    showFiles(path, cacheTree(path, txt, complete));
+  }));
+}
+
+// Navegación: desde la caché si la carpeta ya vino en un recorrido
+export function showDir(path){
+  const files = dirCache.get(path);
+  if (files) { showFiles(path, files); return Promise.resolve(); }
+  return ensureIdle().then(() => listDir(path));
 }
 
 export function openFile(path){
   return ensureIdle()
-    .then(() => fetchJSON("/api/fs/read?path=" + encodeURIComponent(path)))
-    .then(j => {
-      if (!j.ok) throw new Error(j.error || "read failed");
-      const text = base64Decode(j.base64 || "");
+    .then(() => fetchText("/api/fs/read?raw=1&path=" + encodeURIComponent(path)))
+    .then(text => {
       state.openFile = path;
 
       if (externalEditor) {
@@ -229,10 +303,9 @@ export function openFile(path){
 // --- Guardar (versión con UI actual) ---
 export function saveActiveFile(){
   if (!state.openFile) { alert("No hay archivo activo."); return Promise.resolve(); }
-  const b64 = base64Encode(els.editor.value);
   return ensureIdle()
-    .then(() => fetchJSON("/api/fs/write?path=" + encodeURIComponent(state.openFile), {
-      method: "POST", headers: { "Content-Type": "text/plain" }, body: b64
+    .then(() => fetchJSON("/api/fs/write?delta=1&raw=1&path=" + encodeURIComponent(state.openFile), {
+      method: "POST", headers: { "Content-Type": "application/octet-stream" }, body: els.editor.value
     }))
     .then(res => {
       if (!res.ok) throw new Error(res.error || "save failed");
@@ -244,10 +317,9 @@ export function saveActiveFile(){
 
 // --- NUEVO: guardar silencioso (sin alert / ideal para pipelines) ---
 function saveFileSilent(path, text){
-  const b64 = base64Encode(text || "");
   return ensureIdle()
-    .then(() => fetchJSON("/api/fs/write?path=" + encodeURIComponent(path), {
-      method: "POST", headers: { "Content-Type": "text/plain" }, body: b64
+    .then(() => fetchJSON("/api/fs/write?delta=1&raw=1&path=" + encodeURIComponent(path), {
+      method: "POST", headers: { "Content-Type": "application/octet-stream" }, body: text || ""
     }))
     .then(res => {
       if (!res.ok) throw new Error(res.error || "save failed");
@@ -289,7 +361,7 @@ export function uploadToCwd(){
         const buf  = await blob.arrayBuffer();
 
         const url = `/api/fs/upload?path=${encodeURIComponent(path)}&append=${append}`;
-        const res = await fetch(url, {
+        const res = await fetchRetry(url, {
           method: "POST",
           headers: { "Content-Type": "application/octet-stream" },
           body: buf
@@ -350,6 +422,41 @@ export function apiRmdir(path, recursive){
     .then(j => { if (!j.ok) throw new Error(j.error || "rmdir failed"); });
 }
 
+// Varias operaciones en un solo viaje al REPL (/api/batch).
+// ops: [{op:"stat|mkdir|delete|write|rename|exec", path, arg}]
+// (write: arg = texto; rename: arg = destino; exec: arg = código).
+// stop=true corta en la primera que falla. Devuelve los resultados por operación.
+export function apiBatch(ops, stop = true){
+  const body = ops.map(o => {
+    if (o.op === "exec")  return "exec\t\t" + base64Encode(o.arg || "");
+    if (o.op === "write") return "write\t" + o.path + "\t" + base64Encode(o.arg || "");
+    if (o.op === "rename") return "rename\t" + o.path + "\t" + o.arg;
+    return o.op + "\t" + o.path;
+  }).join("\n");
+  return ensureIdle()
+    .then(() => fetchJSON("/api/batch?stop=" + (stop ? 1 : 0), {
+      method: "POST",
+      headers: { "Content-Type": "text/tab-separated-values" },
+      body
+    }))
+    .then(j => { if (!j.ok) throw new Error(j.error || "batch failed"); return j.results; });
+}
+
+// Archivo nuevo en 'dir'; con "lib/util.py" crea también las carpetas que
+// falten, todo en un lote (un mkdir que ya existe no corta el lote)
+function createIn(dir, name){
+  const parts = name.split("/").filter(Boolean);
+  if (parts.length < 2) return apiCreate(joinPath(dir, name), "");
+  const ops = [];
+  let cur = dir;
+  parts.slice(0, -1).forEach(p => { cur = joinPath(cur, p); ops.push({ op:"mkdir", path:cur }); });
+  ops.push({ op:"write", path:joinPath(cur, parts[parts.length - 1]), arg:"" });
+  return apiBatch(ops, false).then(res => {
+    const last = res[res.length - 1];
+    if (!last.ok) throw new Error(last.error || "create failed");
+  });
+}
+
 // ===== EJECUCIÓN =====
 
 // Ejecuta un bloque de código en /api/exec
@@ -409,11 +516,10 @@ function openContextMenu(x, y, target){
   const items = [];
 
   if (isDir) {
-    items.push({ icon:"bi bi-folder2-open", label:"Abrir carpeta", onClick:() => listDir(target.path) });
+    items.push({ icon:"bi bi-folder2-open", label:"Abrir carpeta", onClick:() => showDir(target.path).catch(e => alert(e.message)) });
     items.push({ icon:"bi bi-file-earmark-plus", label:"Nuevo archivo aquí", onClick:() => {
       const fname = prompt("Nombre de archivo:"); if (!fname) return;
-      const full = joinPath(target.path, fname);
-      apiCreate(full, "")
+      createIn(target.path, fname)
         .then(() => listDir(state.cwd))
         .catch(e => alert(e.message));
     }});
@@ -467,8 +573,7 @@ function wireButtons(){
   if (els.btnRefresh)   els.btnRefresh.addEventListener("click", () => ensureIdle().then(() => listDir(state.cwd)));
   if (els.btnNewFile)   els.btnNewFile.addEventListener("click", () => {
     const fname = prompt("Nombre de archivo (en " + state.cwd + "):"); if (!fname) return;
-    const full = joinPath(state.cwd, fname);
-    apiCreate(full, "")
+    createIn(state.cwd, fname)
       .then(() => listDir(state.cwd))
       .catch(e => alert(e.message));
   });
@@ -523,8 +628,7 @@ function wireButtons(){
 export function newFileInCwd(){
   const fname = prompt("Nombre de archivo (en " + state.cwd + "):");
   if (!fname) return;
-  const full = joinPath(state.cwd, fname);
-  apiCreate(full, "")
+  createIn(state.cwd, fname)
     .then(() => listDir(state.cwd))
     .catch(e => alert(e.message));
 }
@@ -556,8 +660,8 @@ export function initFS(){
 
 // ===== API pública (para otros módulos) =====
 export const FS = {
-  listDir, openFile, saveActiveFile, downloadActiveFile, uploadToCwd,
-  apiInfo, apiMkdir, apiRename, apiDeleteFile, apiRmdir,
+  listDir, showDir, openFile, saveActiveFile, downloadActiveFile, uploadToCwd,
+  apiInfo, apiMkdir, apiRename, apiDeleteFile, apiRmdir, apiBatch,
   ensureIdle, writeFile,
   execCode, runActiveSafe,               // ← NUEVO: ejecución
   saveActiveFileSilent,                  // ← por si lo necesitas desde fuera
@@ -16,8 +16,8 @@ async function onStopClick() {
   if (busy) return;
   setBusy(true);
   try {
-    // 1) Dejar REPL inactivo
-    await ensureIdleFS();
+    // 1) Dejar REPL inactivo (STOP: corta y reinicia)
+    await ensureIdleFS(true);
     // 2) Refrescar FS en raíz
     await FS.listDir('/');
     // 3) Abrir / reconectar terminal WS
@@ -0,0 +1,60 @@
+#pragma once
+#include "esp_http_server.h"
+#include "PyBoardUART.hpp"
+#include <string>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+class ServerManager;
+
+namespace EspressIDEA {
+class ReplControl;
+
+// Perfil de la placa conectada. Al arrancar se lee su id (un exec corto) y
+// se busca el perfil en NVS; solo si no está, o cambió el firmware, se hace
+// el sondeo completo y se guarda. El perfil decide el motor (raw/paste),
+// raw-paste, el agente y el modo CircuitPython/MicroPython de ReplControl.
+class BoardService {
+public:
+  BoardService(PyBoard::PyBoardUART& board, ReplControl& repl, ServerManager& server);
+  ~BoardService();
+  void registerRoutes(); // GET /api/board + POST /api/board/probe
+
+  // Encola la detección en la tarea del REPL. force: ignora lo guardado.
+  void detect(bool force = false);
+
+  // Copia del perfil en uso (valid=false si aún no se detectó)
+  PyBoard::BoardProfile profile() const;
+
+  static BoardService* self();
+
+private:
+  static esp_err_t profileHandler(httpd_req_t* req);
+  static esp_err_t probeHandler(httpd_req_t* req);
+
+  PyBoard::ErrorCode detectNow(bool force); // en la tarea del REPL
+  void publish(const PyBoard::BoardProfile& p, bool cached);
+
+  // NVS: namespace "boards", clave "b" + crc32(uid) en hex
+  static bool loadProfile(const std::string& uid, PyBoard::BoardProfile& out);
+  static bool saveProfile(const PyBoard::BoardProfile& p);
+  static std::string nvsKey(const std::string& uid);
+
+  static void sendJSON(httpd_req_t* req, const std::string& json);
+  static std::string esc(const std::string& s);
+  static std::string profileJSON(const PyBoard::BoardProfile& p, bool cached);
+
+  PyBoard::PyBoardUART& board_;
+  ReplControl& repl_;
+  ServerManager& server_;
+
+  PyBoard::BoardProfile profile_; // copia para los handlers (mutex_)
+  bool cached_ = false;           // vino de NVS
+  SemaphoreHandle_t mutex_ = nullptr;
+
+  static constexpr uint32_t kIdleTimeoutMs = 3000;
+
+  static BoardService* s_self_;
+};
+
+} // namespace EspressIDEA
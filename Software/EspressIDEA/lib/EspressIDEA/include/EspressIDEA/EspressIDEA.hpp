@@ -3,8 +3,9 @@
 #include "EspressIDEA/TerminalWS.hpp"
 #include "EspressIDEA/FSService.hpp"
 #include "EspressIDEA/ExecService.hpp"
+#include "EspressIDEA/BoardService.hpp"
 #include "EspressIDEA/AIService.hpp"     // <-- NUEVO
-#include "PyBoardUART.hpp"               // Necesario para waitForReplPrompt en el waiter
+#include "PyBoardUART.hpp"
 
 namespace PyBoard { class PyBoardUART; }
 class ServerManager;
@@ -19,34 +20,38 @@ public:
     terminal(board_, repl, server),
     fs(board_, repl, server),
     exec(board_, repl, server),
+    boardInfo(board_, repl, server),
     ai(server) // <-- NUEVO
   {
     // Inicializa ReplControl con dependencias
     repl.init(&board_, &server);
 
-    // Forzamos modo CircuitPython (opcional; por defecto ya viene true)
+    // CircuitPython hasta que BoardService lea el perfil de la placa
     repl.setCircuitPython(true);
 
-    // Esperador de prompt real: usa UART para detectar ">>>"
-    repl.setPromptWaiter([this](uint32_t timeout_ms) {
-      return this->board_.waitForReplPrompt(timeout_ms) == PyBoard::ErrorCode::OK;
-    });
+    // Sin esperador externo: ensureIdleHard usa PyBoardUART::syncRepl(), que
+    // detecta el prompt, "Press any key" y el fin del soft reboot
   }
 
   void begin() {
     terminal.registerRoutes();
     fs.registerRoutes();
     exec.registerRoutes();
+    boardInfo.registerRoutes();
 
     // AIService: rutas HTTP para puente LLM y carga de URL desde SPIFFS (no ejecuta nada por sí solo).
     ai.loadLLMUrlFromCredentials("/spiffs/CREDENTIALS.txt"); // el módulo lee y parsea LLM_URL/AI_URL
     ai.registerRoutes();
+
+    // Perfil de la placa (NVS o sondeo): motor raw/paste y dialecto
+    boardInfo.detect();
   }
 
   ReplControl& replControl() { return repl; }
   TerminalWS&  terminalWS()  { return terminal; }
   FSService&   fsService()   { return fs; }
   ExecService& execService() { return exec; }
+  BoardService& boardService() { return boardInfo; }
   AIService&   aiService()   { return ai; } // <-- NUEVO
 
 private:
@@ -55,6 +60,7 @@ private:
   TerminalWS  terminal;
   FSService   fs;
   ExecService exec;
+  BoardService boardInfo;
   AIService   ai; // <-- NUEVO
 };
 
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+namespace PyBoard { class PyBoardUART; }
+
+namespace EspressIDEA {
+class ReplControl;
+
+// Estado de un trabajo de /api/exec/jobs
+enum class ExecJobState : uint8_t {
+  QUEUED,     // en la cola BULK de la tarea del REPL
+  RUNNING,    // el programa corre en la placa
+  DONE,       // volvió al prompt
+  FAILED,     // error de protocolo/UART (ver error)
+  CANCELLED,  // cancelado por el cliente o por STOP
+  TIMEOUT     // superó su límite de tiempo
+};
+
+struct ExecJobInfo {
+  uint32_t id = 0;
+  ExecJobState state = ExecJobState::QUEUED;
+  uint64_t queuedUs = 0;
+  uint64_t startUs = 0;     // 0 = aún no empezó
+  uint64_t endUs = 0;       // 0 = aún no terminó
+  size_t outTotal = 0;      // bytes de salida producidos (incluye descartados)
+  std::string error;
+};
+
+// Tabla acotada de ejecuciones en segundo plano. submit() encola el programa
+// en la tarea del REPL y vuelve con un id; la salida se guarda en un buffer
+// por trabajo (se conservan los últimos kMaxOutput bytes) que el cliente lee
+// por offset. Los resultados viejos se reciclan cuando se llena la tabla.
+class ExecJobs {
+public:
+  static constexpr size_t kMaxJobs = 6;
+  static constexpr size_t kMaxOutput = 4096;
+
+  ExecJobs(PyBoard::PyBoardUART& board, ReplControl& repl);
+  ~ExecJobs();
+
+  // Devuelve 0 si no hay lugar (todos los trabajos vivos) o la cola está llena.
+  // timeoutMs = 0: sin límite (hasta cancelar).
+  uint32_t submit(std::string code, uint32_t timeoutMs);
+
+  // Un trabajo en cola se descarta; uno corriendo recibe ^C y se resincroniza
+  // el prompt. false si el id no existe o ya terminó.
+  bool cancel(uint32_t id);
+
+  bool info(uint32_t id, ExecJobInfo& out) const;
+  std::vector<ExecJobInfo> list() const;
+
+  // Salida desde el offset absoluto 'since'. 'dropped' indica cuántos bytes
+  // ya no están (se pasaron de kMaxOutput); 'next' es el offset a pedir luego.
+  bool output(uint32_t id, size_t since, std::string& out, size_t& next, size_t& dropped) const;
+
+  static bool finished(ExecJobState s) { return s != ExecJobState::QUEUED && s != ExecJobState::RUNNING; }
+  static const char* stateName(ExecJobState s);
+
+private:
+  struct Slot {
+    bool used = false;
+    volatile bool cancel = false;
+    ExecJobInfo info;
+    std::string out;       // últimos kMaxOutput bytes
+    size_t outBase = 0;    // offset absoluto de out[0]
+  };
+
+  void runJob(uint32_t id, const std::string& code, uint32_t timeoutMs);
+  Slot* find(uint32_t id);
+  const Slot* find(uint32_t id) const;
+  Slot* allocSlot();
+
+  PyBoard::PyBoardUART& board_;
+  ReplControl& repl_;
+  Slot slots_[kMaxJobs];
+  uint32_t nextId_ = 1;
+  SemaphoreHandle_t mutex_ = nullptr;
+};
+
+} // namespace EspressIDEA
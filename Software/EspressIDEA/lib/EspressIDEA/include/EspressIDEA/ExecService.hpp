@@ -1,5 +1,7 @@
 #pragma once
 #include "esp_http_server.h"
+#include "EspressIDEA/ExecJobs.hpp"
+#include <cstdint>
 #include <string>
 
 namespace PyBoard { class PyBoardUART; }
@@ -11,7 +13,9 @@ class ReplControl;
 class ExecService {
 public:
   ExecService(PyBoard::PyBoardUART& board, ReplControl& repl, ServerManager& server);
-  void registerRoutes(); // /api/exec  + /api/repl/ensure_idle
+  void registerRoutes(); // /api/exec (+ /jobs)  + /api/repl/ensure_idle + /api/repl/stats
+
+  ExecJobs& jobs() { return jobs_; }
 
   // singleton de callbacks
   static ExecService* self();
@@ -20,15 +24,36 @@ private:
   // Handlers
   static esp_err_t execHandler(httpd_req_t* req);
   static esp_err_t ensureIdleHandler(httpd_req_t* req);
+  static esp_err_t statsHandler(httpd_req_t* req);
+  static esp_err_t streamExec(httpd_req_t* req, const std::string& code, uint32_t timeoutMs);
+  static esp_err_t jobSubmitHandler(httpd_req_t* req);
+  static esp_err_t jobListHandler(httpd_req_t* req);
+  static esp_err_t jobStatusHandler(httpd_req_t* req);
+  static esp_err_t jobOutputHandler(httpd_req_t* req);
+  static esp_err_t jobCancelHandler(httpd_req_t* req);
+
+  static constexpr uint32_t kStreamTimeoutMs = 30000;
+  static constexpr size_t   kStreamBufSize   = 2048;
+  static constexpr size_t   kStreamChunk     = 512;
+  static constexpr uint32_t kExecTimeoutMs   = 8000;   // /api/exec sin stream
+  // Tope de ?timeout= en /api/exec (con o sin stream): ocupa un worker y la
+  // tarea del REPL; lo más largo va por /api/exec/jobs
+  static constexpr uint32_t kExecTimeoutMaxMs = 300000;
+  static constexpr uint32_t kJobWaitMaxMs    = 10000;  // long-poll de /jobs/output
+  static constexpr int      kRecvTimeouts    = 3;      // HTTPD_SOCK_ERR_TIMEOUT seguidos en recvBody
 
   // utilidades
   static void sendJSON(httpd_req_t* req, const std::string& json);
   static std::string esc(const std::string& s);
+  static bool queryParamInt(httpd_req_t* req, const char* key, int& out);
+  static bool recvBody(httpd_req_t* req, std::string& body);
+  static std::string jobJSON(const ExecJobInfo& info);
 
   // dependencias
   PyBoard::PyBoardUART& board_;
   ReplControl& repl_;
   ServerManager& server_;
+  ExecJobs jobs_;
 
   static ExecService* s_self_;
 };
@@ -12,7 +12,7 @@ class ReplControl;
 class FSService {
 public:
   FSService(PyBoard::PyBoardUART& board, ReplControl& repl, ServerManager& server);
-  void registerRoutes(); // /api/fs/*
+  void registerRoutes(); // /api/fs/* y /api/batch
 
 private:
   // ---- Handlers existentes ----
@@ -30,6 +30,8 @@ private:
   static esp_err_t downloadHandler (httpd_req_t* req);
   static esp_err_t uploadHandler   (httpd_req_t* req);
   static esp_err_t createHandler   (httpd_req_t* req);  // << NUEVO
+  static esp_err_t treeHandler     (httpd_req_t* req);  // árbol completo en un recorrido
+  static esp_err_t batchHandler    (httpd_req_t* req);  // varias operaciones, un viaje al REPL
 
   // ---- Utilidades comunes ----
   static FSService* self();
@@ -37,9 +39,9 @@ private:
   static std::string esc(const std::string& s);
   static bool queryParam  (httpd_req_t* req, const char* key, std::string& out);
   static bool queryParamInt(httpd_req_t* req, const char* key, int& out);
+  static bool recvBody    (httpd_req_t* req, std::string& body);
 
   // Helpers para lógicas compuestas
-  static bool rmdirRecursive(FSService* inst, const std::string& path, std::string& err);
   static bool renameFile   (FSService* inst, const std::string& from, const std::string& to, std::string& err);
 
   // Dependencias
@@ -52,6 +54,14 @@ private:
 
   // Límites/constantes
   static constexpr size_t MAX_UPLOAD = 2 * 1024 * 1024; // 2 MB por defecto
+  static constexpr int TREE_DEPTH = 8;        // niveles por defecto de /api/fs/tree
+  static constexpr int TREE_DEPTH_MAX = 16;
+  static constexpr int TREE_LIMIT = 512;      // entradas por defecto
+  static constexpr int TREE_LIMIT_MAX = 2000;
+  static constexpr size_t BATCH_MAX_BODY = 16 * 1024; // /api/batch: cuerpo TSV
+  static constexpr size_t BATCH_MAX_OPS = 64;
+  static constexpr uint32_t BATCH_TIMEOUT_MS = 30000; // incluye los snippets exec
+  static constexpr int RECV_TIMEOUTS = 3;     // HTTPD_SOCK_ERR_TIMEOUT seguidos: el cliente se colgó
 };
 
 } // namespace EspressIDEA
@@ -1,10 +1,14 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <string>
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/semphr.h"
+#include "freertos/task.h"
 
-namespace PyBoard { class PyBoardUART; }
+namespace PyBoard { class PyBoardUART; enum class ErrorCode; enum class IdleLevel : uint8_t; }
 class ServerManager;
 
 namespace EspressIDEA {
@@ -12,74 +16,131 @@ namespace EspressIDEA {
 // Modo del REPL visto por los servicios
 enum class ReplMode {
   TERMINAL,    // flujo libre hacia/desde el WS (TerminalWS)
-  CONTROLADO   // en uso por FS/Exec; TerminalWS debe abstenerse
+  CONTROLADO   // la tarea del REPL está corriendo una operación FS/Exec
 };
 
+// Clases de prioridad de la cola del REPL (menor valor = se atiende antes)
+enum class ReplPriority : uint8_t {
+  INTERACTIVE = 0, // teclas del terminal, STOP
+  META        = 1, // FS cortas: list/info/exists/delete/mkdir/rename
+  BULK        = 2  // transferencias y exec
+};
+static constexpr size_t kReplPriorities = 3;
+
+// Demora en cola por clase (desde encolar hasta empezar a correr)
+struct ReplQueueStats {
+  uint32_t jobs = 0;
+  uint64_t waitUsTotal = 0;
+  uint32_t waitUsMax = 0;
+  uint32_t runUsMax = 0;
+};
+
+// Trabajo sobre la placa: corre en la tarea del REPL, único dueño del UART
+using ReplJob  = std::function<PyBoard::ErrorCode()>;
+// Aviso de fin para post(); err = getLastError() si rc != OK
+using ReplDone = std::function<void(PyBoard::ErrorCode rc, const std::string& err)>;
+// Destino de lo que la placa envía mientras no hay trabajos (terminal WS)
+using TerminalSink = std::function<void(const uint8_t* data, size_t len)>;
+
 class ReplControl {
 public:
   ReplControl();
   ~ReplControl();
 
-  // Debe llamarse una vez tras construir Device
+  // Debe llamarse una vez tras construir Device; arranca la tarea del REPL
   void init(PyBoard::PyBoardUART* board, ServerManager* server);
 
   // ---- Config / detección de entorno ----
-  // Marca si el dispositivo objetivo es CircuitPython.
-  // Si es true, se evita raw REPL y se usa la secuencia ^C,^D,(opcional enter) + waitPrompt.
+  // Marca si el dispositivo objetivo es CircuitPython. Decide el STOP (hard):
+  // CircuitPython hace ^C,^D + waitPrompt; MicroPython reinicia dentro del raw
+  // REPL para no arrancar main.py. El motor de ejecución (raw / paste) lo elige
+  // PyBoardUART según lo que acepte la placa.
   void setCircuitPython(bool on) { circuitpython_ = on; }
   bool isCircuitPython() const { return circuitpython_; }
 
-  // Permite inyectar un "esperador de prompt" externo (opcional).
-  // Debe devolver true si encontró ">>>" antes de timeout.
-  // Ejemplo de uso: desde TerminalWS (que ya lee UART) o un helper que pueda leer.
+  // Permite inyectar un "esperador de prompt" externo (opcional); sin él se
+  // usa PyBoardUART::syncRepl(). Debe devolver true si encontró ">>>" antes de timeout.
+  // Corre dentro de la tarea del REPL (puede leer la placa directamente).
   void setPromptWaiter(std::function<bool(uint32_t timeout_ms)> waiter) {
     waitPromptFn_ = std::move(waiter);
   }
 
-  // ---- Modo / arbitraje ----
-  void setModeTerminal();
   ReplMode mode() const { return mode_; }
 
-  // Llamado por TerminalWS antes de leer del UART; si consigue el lock rápido, puede continuar.
-  bool tryLockFromTerminal();
-  void unlockFromTerminal();
+  // ---- Cola de trabajos ----
+  // run(): encola y bloquea hasta que el trabajo termine (si se llama desde
+  // la propia tarea del REPL corre en línea). 'err' recibe getLastError().
+  PyBoard::ErrorCode run(ReplPriority prio, const char* tag, ReplJob job, std::string* err = nullptr);
+  // post(): encola y vuelve; 'done' se llama desde la tarea del REPL.
+  // Devuelve false si la cola de esa clase está llena.
+  bool post(ReplPriority prio, const char* tag, ReplJob job, ReplDone done = nullptr);
+
+  // Cancelación cooperativa: los trabajos largos consultan cancelRequested()
+  // entre trozos. Se limpia al empezar cada operación (trabajo con tag).
+  void requestCancel() { cancel_ = true; }
+  bool cancelRequested() const { return cancel_; }
+
+  // ---- Terminal ----
+  // Mientras no hay trabajos, la tarea del REPL entrega la salida de la placa
+  // al sink. nullptr la descarta (WS cerrado).
+  void setTerminalSink(TerminalSink sink);
+  // Teclas del terminal: prioridad INTERACTIVE. Un ^C durante una operación
+  // CONTROLADA además pide cancelarla.
+  bool terminalInput(const uint8_t* data, size_t len);
+
+  ReplQueueStats stats(ReplPriority prio) const;
+  size_t pending(ReplPriority prio) const;
 
   // ---- Utilidades de sincronización REPL ----
-  // Asegura que el REPL esté "listo para órdenes":
-  // - En CircuitPython: ^C,^D y, si es posible, esperar hasta ver ">>>"
-  // - En otros (MicroPython): puedes continuar usando tu flujo habitual (p.ej., raw REPL)
-  // Devuelve true si se consideró "listo" (aunque sea por fallback sin esperar prompt real).
-  bool ensureIdle(uint32_t timeout_ms = 3000);
-
-  // Versión explícita de CircuitPython (por si quieres llamarla directamente)
-  bool ensureIdleCircuitPython(uint32_t timeout_ms = 3000);
-
-  // ---- RAII: Bloqueo CONTROLADO (FS/Exec) ----
-  class ScopedReplLock {
-  public:
-    ScopedReplLock(ReplControl& rc, const char* tag = nullptr);
-    ~ScopedReplLock();
-    ScopedReplLock(const ScopedReplLock&) = delete;
-    ScopedReplLock& operator=(const ScopedReplLock&) = delete;
-  private:
-    ReplControl& rc_;
-    bool locked_ = false;
-    const char* tag_;
-  };
+  // Asegura que el REPL esté "listo para órdenes" (se encola como INTERACTIVE):
+  // - tibio (hard=false): si ya está en ">>>" no se toca nada; si no, ^C y
+  //   solo como último recurso ^D. Conserva variables y módulos importados.
+  // - hard=true (botón STOP): corta la operación en curso y reinicia (^C,^D).
+  // Devuelve true si se vio el prompt antes de timeout_ms; 'level' dice
+  // hasta dónde se escaló.
+  bool ensureIdle(uint32_t timeout_ms = 3000, bool hard = false,
+                  PyBoard::IdleLevel* level = nullptr);
+
+  // Siempre ^C,^D (= ensureIdle hard), en CircuitPython y en MicroPython
+  bool ensureIdleHard(uint32_t timeout_ms = 3000);
 
 private:
-  // Internos
-  void forceControlled();
-  void releaseControlled();
+  struct Job {
+    ReplPriority prio;
+    const char* tag;
+    ReplJob fn;
+    ReplDone done;
+    uint64_t enqueuedUs;
+    SemaphoreHandle_t finished; // solo run()
+    PyBoard::ErrorCode rc;
+    std::string err;
+  };
+
+  static constexpr UBaseType_t kQueueDepth   = 8;
+  static constexpr size_t      kIdleReadSize = 512;
+  static constexpr uint32_t    kIdleReadMs   = 10; // latencia máx. para tomar un trabajo
+
+  static void actorTask(void* arg);
+  bool enqueue(Job* job, TickType_t wait);
+  Job* nextJob();
+  void execute(Job* job);
+  bool ensureIdleCircuitPythonNow(uint32_t timeout_ms);
+  bool ensureIdleMicroPythonNow(uint32_t timeout_ms);
+  void leaveRawRepl(); // antes de entregar la placa al terminal
 
   // Dependencias
   PyBoard::PyBoardUART* board_ = nullptr;
   ServerManager* server_ = nullptr;
 
   // Estado
-  ReplMode mode_ = ReplMode::TERMINAL;
-  SemaphoreHandle_t mutex_ = nullptr;       // Serializa CONTROLADO vs TERMINAL
-  volatile bool heldByTerminal_ = false;    // Fast-path para lector UART
+  volatile ReplMode mode_ = ReplMode::TERMINAL;
+  std::atomic<bool> cancel_{false};
+  TaskHandle_t task_ = nullptr;
+  QueueHandle_t queues_[kReplPriorities] = {};
+  SemaphoreHandle_t pending_ = nullptr;      // cuenta trabajos en todas las colas
+  TerminalSink sink_;                        // solo se toca desde la tarea del REPL
+  ReplQueueStats stats_[kReplPriorities];
+  mutable portMUX_TYPE statsMux_ = portMUX_INITIALIZER_UNLOCKED;
 
   // Config
   bool circuitpython_ = true;               // por defecto true (tu target actual)
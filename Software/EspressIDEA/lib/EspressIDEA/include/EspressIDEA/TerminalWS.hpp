@@ -13,10 +13,11 @@ namespace EspressIDEA {
 
 /**
  * TerminalWS
- *  - Lector UART -> StreamBuffer (backpressure, coalescing)
+ *  - Salida de la placa -> StreamBuffer (la entrega la tarea de ReplControl
+ *    mientras no hay operaciones; backpressure, coalescing)
  *  - Emisor WS (pacing con async)
  *  - Handler WS con user_ctx=this (contexto correcto)
- *  - Respeta ReplControl (solo TERMINAL)
+ *  - Entrada del WS -> cola INTERACTIVE de ReplControl
  */
 class TerminalWS {
 public:
@@ -27,8 +28,6 @@ private:
   // Config
   static constexpr uart_port_t kUartNum   = UART_NUM_2;
   static constexpr size_t      kUartBuf   = 4096;
-  static constexpr int         kReadChunk = 512;
-  static constexpr TickType_t  kReadWait  = pdMS_TO_TICKS(20);
 
   // Backpressure & pacing
   static constexpr size_t      kStreamBufSize = 16 * 1024; // 16 KB
@@ -47,12 +46,10 @@ private:
 
   // Buffer y tareas
   StreamBufferHandle_t sbuf_ = nullptr;
-  TaskHandle_t         tReader_ = nullptr;
   TaskHandle_t         tSender_ = nullptr;
 
   // ---- Handlers/Tasks ----
   static esp_err_t wsHandler(httpd_req_t* req);
-  static void uartReaderTask(void* arg);
   static void wsSenderTask(void* arg);
 
   // helpers
@@ -63,7 +63,7 @@ void AIService::registerRoutes() {
   };
 
   server_.registerHttpHandler(ping);
-  server_.registerHttpHandler(gen);
+  server_.registerAsyncHandler(gen, 1); // hasta 8 s esperando al LLM
 }
 
 AIService* AIService::self() { return s_self_; }
@@ -0,0 +1,205 @@
+#include "EspressIDEA/BoardService.hpp"
+#include "EspressIDEA/ReplControl.hpp"
+#include "Platform.hpp"
+#include "ServerManager.hpp"
+#include "esp_log.h"
+#include "nvs.h"
+
+#include <cstdio>
+
+using namespace EspressIDEA;
+static const char* TAG = "BoardService";
+static const char* kNvsNamespace = "boards";
+
+namespace {
+struct Lock {
+  explicit Lock(SemaphoreHandle_t m) : m_(m) { xSemaphoreTake(m_, portMAX_DELAY); }
+  ~Lock() { xSemaphoreGive(m_); }
+  SemaphoreHandle_t m_;
+};
+} // namespace
+
+BoardService* BoardService::s_self_ = nullptr;
+
+BoardService::BoardService(PyBoard::PyBoardUART& board, ReplControl& repl, ServerManager& server)
+: board_(board), repl_(repl), server_(server) {
+  mutex_ = xSemaphoreCreateMutex();
+  s_self_ = this;
+}
+
+BoardService::~BoardService() {
+  if (mutex_) vSemaphoreDelete(mutex_);
+}
+
+BoardService* BoardService::self() { return s_self_; }
+
+void BoardService::sendJSON(httpd_req_t* req, const std::string& json) {
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_send(req, json.c_str(), json.size());
+}
+
+std::string BoardService::esc(const std::string& s) {
+  std::string o; o.reserve(s.size()+8);
+  for (char c: s) {
+    switch(c){
+      case '\\': o+="\\\\"; break; case '"': o+="\\\""; break;
+      case '\n': o+="\\n"; break; case '\r': o+="\\r"; break; case '\t': o+="\\t"; break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          char u[8]; snprintf(u, sizeof(u), "\\u%04x", (unsigned)(unsigned char)c); o += u;
+        } else {
+          o+=c;
+        }
+    }
+  }
+  return o;
+}
+
+// ---------------- Detección -----------------
+
+void BoardService::detect(bool force) {
+  bool queued = repl_.post(ReplPriority::META, "board.probe",
+    [this, force]() { return detectNow(force); },
+    [](PyBoard::ErrorCode rc, const std::string& err) {
+      if (rc != PyBoard::ErrorCode::OK) ESP_LOGW(TAG, "sin perfil de la placa: %s", err.c_str());
+    });
+  if (!queued) ESP_LOGW(TAG, "no se pudo encolar la detección");
+}
+
+PyBoard::ErrorCode BoardService::detectNow(bool force) {
+  // Al arrancar la placa puede estar corriendo code.py/main.py: ^C si hace
+  // falta, pero sin reiniciar
+  auto rc = board_.ensureIdle(kIdleTimeoutMs, /*allowReset*/ false);
+  if (rc != PyBoard::ErrorCode::OK) return rc;
+
+  PyBoard::BoardProfile p;
+  if (!force) {
+    PyBoard::BoardProfile id;
+    rc = board_.probeBoard(id, /*full*/ false);
+    if (rc != PyBoard::ErrorCode::OK) return rc;
+    // Otro firmware en la misma placa invalida lo guardado
+    if (!id.uid.empty() && loadProfile(id.uid, p) &&
+        p.dialect == id.dialect && p.version == id.version) {
+      board_.applyProfile(p);
+      publish(p, true);
+      ESP_LOGI(TAG, "perfil de %s desde NVS (%s %s)", p.uid.c_str(), p.dialect.c_str(), p.version.c_str());
+      return PyBoard::ErrorCode::OK;
+    }
+  }
+
+  rc = board_.probeBoard(p, /*full*/ true);
+  if (rc != PyBoard::ErrorCode::OK) return rc;
+  if (p.uid.empty()) {
+    ESP_LOGW(TAG, "la placa no expone un id único: el perfil no se guarda");
+  } else if (!saveProfile(p)) {
+    ESP_LOGW(TAG, "no se pudo guardar el perfil en NVS");
+  }
+  publish(p, false);
+  return PyBoard::ErrorCode::OK;
+}
+
+void BoardService::publish(const PyBoard::BoardProfile& p, bool cached) {
+  repl_.setCircuitPython(p.isCircuitPython());
+  if (!mutex_) return;
+  Lock l(mutex_);
+  profile_ = p;
+  cached_ = cached;
+}
+
+PyBoard::BoardProfile BoardService::profile() const {
+  if (!mutex_) return PyBoard::BoardProfile();
+  Lock l(mutex_);
+  return profile_;
+}
+
+// ---------------- NVS -----------------
+
+std::string BoardService::nvsKey(const std::string& uid) {
+  // Las claves de NVS tienen hasta 15 caracteres: el uid va como crc32
+  const uint32_t h = PyBoard::crc32(0, reinterpret_cast<const uint8_t*>(uid.data()), uid.size());
+  char key[12];
+  snprintf(key, sizeof(key), "b%08x", (unsigned)h);
+  return key;
+}
+
+bool BoardService::loadProfile(const std::string& uid, PyBoard::BoardProfile& out) {
+  nvs_handle_t h;
+  if (nvs_open(kNvsNamespace, NVS_READONLY, &h) != ESP_OK) return false;
+  const std::string key = nvsKey(uid);
+  std::string s;
+  size_t len = 0;
+  esp_err_t err = nvs_get_str(h, key.c_str(), nullptr, &len);
+  if (err == ESP_OK && len > 0) {
+    s.resize(len);
+    err = nvs_get_str(h, key.c_str(), &s[0], &len);
+    s.resize(len > 0 ? len - 1 : 0); // sin el '\0'
+  }
+  nvs_close(h);
+  return err == ESP_OK && out.parse(s) && out.valid && out.uid == uid;
+}
+
+bool BoardService::saveProfile(const PyBoard::BoardProfile& p) {
+  nvs_handle_t h;
+  if (nvs_open(kNvsNamespace, NVS_READWRITE, &h) != ESP_OK) return false;
+  esp_err_t err = nvs_set_str(h, nvsKey(p.uid).c_str(), p.serialize().c_str());
+  if (err == ESP_OK) err = nvs_commit(h);
+  nvs_close(h);
+  return err == ESP_OK;
+}
+
+// ---------------- HTTP -----------------
+
+std::string BoardService::profileJSON(const PyBoard::BoardProfile& p, bool cached) {
+  auto b = [](bool v) { return v ? "true" : "false"; };
+  return std::string("{\"ok\":true,\"probed\":") + b(p.valid) +
+         ",\"cached\":" + b(cached) +
+         ",\"dialect\":\"" + esc(p.dialect) + "\",\"version\":\"" + esc(p.version) +
+         "\",\"machine\":\"" + esc(p.machine) + "\",\"uid\":\"" + esc(p.uid) +
+         "\",\"raw_repl\":" + b(p.rawRepl) + ",\"raw_paste\":" + b(p.rawPaste) +
+         ",\"modules\":{\"binascii\":\"" + esc(p.binascii) + "\",\"crc32\":" + b(p.crc32) +
+         ",\"deflate\":" + b(p.deflate) + ",\"zlib\":\"" + esc(p.zlib) +
+         "\",\"hashlib\":\"" + esc(p.hashlib) + "\"},\"ilistdir\":" + b(p.ilistdir) +
+         ",\"mem_free\":" + std::to_string(p.memFree) + "}";
+}
+
+// GET /api/board: perfil en uso (no toca la placa)
+esp_err_t BoardService::profileHandler(httpd_req_t* req) {
+  auto* inst = BoardService::self(); if (!inst || !inst->mutex_) return ESP_FAIL;
+  PyBoard::BoardProfile p;
+  bool cached;
+  {
+    Lock l(inst->mutex_);
+    p = inst->profile_;
+    cached = inst->cached_;
+  }
+  sendJSON(req, profileJSON(p, cached));
+  return ESP_OK;
+}
+
+// POST /api/board/probe: sondeo completo (otra placa, firmware actualizado)
+esp_err_t BoardService::probeHandler(httpd_req_t* req) {
+  auto* inst = BoardService::self(); if (!inst) return ESP_FAIL;
+  std::string err;
+  auto rc = inst->repl_.run(ReplPriority::META, "board.probe",
+                            [inst]() { return inst->detectNow(/*force*/ true); }, &err);
+  if (rc != PyBoard::ErrorCode::OK) {
+    sendJSON(req, "{\"ok\":false,\"error\":\"" + esc(err) + "\"}");
+    return ESP_OK;
+  }
+  sendJSON(req, profileJSON(inst->profile(), false));
+  return ESP_OK;
+}
+
+void BoardService::registerRoutes() {
+  httpd_uri_t get = {
+    .uri="/api/board", .method=HTTP_GET, .handler=BoardService::profileHandler, .user_ctx=nullptr,
+    .is_websocket=false, .handle_ws_control_frames=false, .supported_subprotocol=nullptr
+  };
+  httpd_uri_t probe = {
+    .uri="/api/board/probe", .method=HTTP_POST, .handler=BoardService::probeHandler, .user_ctx=nullptr,
+    .is_websocket=false, .handle_ws_control_frames=false, .supported_subprotocol=nullptr
+  };
+  server_.registerHttpHandler(get);
+  // El sondeo espera a la tarea del REPL: fuera de la tarea del httpd
+  server_.registerAsyncHandler(probe, 1);
+}
@@ -0,0 +1,179 @@
+#include "EspressIDEA/ExecJobs.hpp"
+#include "EspressIDEA/ReplControl.hpp"
+#include "PyBoardUART.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include <utility>
+
+using namespace EspressIDEA;
+static const char* TAG = "ExecJobs";
+
+namespace {
+struct Lock {
+  explicit Lock(SemaphoreHandle_t m) : m_(m) { xSemaphoreTake(m_, portMAX_DELAY); }
+  ~Lock() { xSemaphoreGive(m_); }
+  SemaphoreHandle_t m_;
+};
+
+uint64_t nowUs() { return (uint64_t)esp_timer_get_time(); }
+} // namespace
+
+ExecJobs::ExecJobs(PyBoard::PyBoardUART& board, ReplControl& repl)
+: board_(board), repl_(repl) {
+  mutex_ = xSemaphoreCreateMutex();
+}
+
+ExecJobs::~ExecJobs() {
+  if (mutex_) vSemaphoreDelete(mutex_);
+}
+
+const char* ExecJobs::stateName(ExecJobState s) {
+  switch (s) {
+    case ExecJobState::QUEUED:    return "queued";
+    case ExecJobState::RUNNING:   return "running";
+    case ExecJobState::DONE:      return "done";
+    case ExecJobState::FAILED:    return "failed";
+    case ExecJobState::CANCELLED: return "cancelled";
+    case ExecJobState::TIMEOUT:   return "timeout";
+  }
+  return "?";
+}
+
+ExecJobs::Slot* ExecJobs::find(uint32_t id) {
+  for (auto& s : slots_) if (s.used && s.info.id == id) return &s;
+  return nullptr;
+}
+
+const ExecJobs::Slot* ExecJobs::find(uint32_t id) const {
+  for (auto& s : slots_) if (s.used && s.info.id == id) return &s;
+  return nullptr;
+}
+
+// Un lugar libre o, si no hay, el resultado terminado más viejo
+ExecJobs::Slot* ExecJobs::allocSlot() {
+  Slot* oldest = nullptr;
+  for (auto& s : slots_) {
+    if (!s.used) return &s;
+    if (!finished(s.info.state)) continue;
+    if (!oldest || s.info.endUs < oldest->info.endUs) oldest = &s;
+  }
+  return oldest;
+}
+
+uint32_t ExecJobs::submit(std::string code, uint32_t timeoutMs) {
+  if (!mutex_) return 0;
+  uint32_t id;
+  {
+    Lock l(mutex_);
+    Slot* s = allocSlot();
+    if (!s) return 0;
+    id = nextId_++;
+    if (nextId_ == 0) nextId_ = 1;
+    *s = Slot();
+    s->used = true;
+    s->info.id = id;
+    s->info.queuedUs = nowUs();
+  }
+
+  bool queued = repl_.post(ReplPriority::BULK, "exec.job",
+    [this, id, code = std::move(code), timeoutMs]() {
+      runJob(id, code, timeoutMs);
+      return PyBoard::ErrorCode::OK; // el resultado queda en la tabla
+    });
+  if (!queued) {
+    Lock l(mutex_);
+    if (Slot* s = find(id)) s->used = false;
+    return 0;
+  }
+  ESP_LOGI(TAG, "job %u encolado", (unsigned)id);
+  return id;
+}
+
+void ExecJobs::runJob(uint32_t id, const std::string& code, uint32_t timeoutMs) {
+  {
+    Lock l(mutex_);
+    Slot* s = find(id);
+    if (!s || s->info.state != ExecJobState::QUEUED) return; // cancelado en cola
+    s->info.state = ExecJobState::RUNNING;
+    s->info.startUs = nowUs();
+  }
+
+  auto rc = board_.execStream(code, [this, id](const uint8_t* data, size_t len) {
+    Lock l(mutex_);
+    Slot* s = find(id);
+    if (!s) return false;
+    if (len) {
+      s->out.append(reinterpret_cast<const char*>(data), len);
+      s->info.outTotal += len;
+      if (s->out.size() > kMaxOutput) {
+        const size_t cut = s->out.size() - kMaxOutput;
+        s->out.erase(0, cut);
+        s->outBase += cut;
+      }
+    }
+    return !s->cancel && !repl_.cancelRequested();
+  }, timeoutMs ? timeoutMs : UINT32_MAX);
+
+  Lock l(mutex_);
+  Slot* s = find(id);
+  if (!s) return;
+  s->info.endUs = nowUs();
+  if (rc == PyBoard::ErrorCode::OK) {
+    s->info.state = ExecJobState::DONE;
+  } else if (s->cancel || repl_.cancelRequested()) {
+    s->info.state = ExecJobState::CANCELLED;
+  } else if (rc == PyBoard::ErrorCode::TIMEOUT) {
+    s->info.state = ExecJobState::TIMEOUT;
+  } else {
+    s->info.state = ExecJobState::FAILED;
+    s->info.error = board_.getLastError();
+  }
+  ESP_LOGI(TAG, "job %u: %s en %u ms", (unsigned)id, stateName(s->info.state),
+           (unsigned)((s->info.endUs - s->info.startUs) / 1000));
+}
+
+bool ExecJobs::cancel(uint32_t id) {
+  if (!mutex_) return false;
+  Lock l(mutex_);
+  Slot* s = find(id);
+  if (!s || finished(s->info.state)) return false;
+  s->cancel = true;
+  if (s->info.state == ExecJobState::QUEUED) {
+    // Aún no tocó la placa: runJob() lo saltea al salir de la cola
+    s->info.state = ExecJobState::CANCELLED;
+    s->info.endUs = nowUs();
+  }
+  return true;
+}
+
+bool ExecJobs::info(uint32_t id, ExecJobInfo& out) const {
+  if (!mutex_) return false;
+  Lock l(mutex_);
+  const Slot* s = find(id);
+  if (!s) return false;
+  out = s->info;
+  return true;
+}
+
+std::vector<ExecJobInfo> ExecJobs::list() const {
+  std::vector<ExecJobInfo> v;
+  if (!mutex_) return v;
+  Lock l(mutex_);
+  for (auto& s : slots_) if (s.used) v.push_back(s.info);
+  return v;
+}
+
+bool ExecJobs::output(uint32_t id, size_t since, std::string& out, size_t& next, size_t& dropped) const {
+  if (!mutex_) return false;
+  Lock l(mutex_);
+  const Slot* s = find(id);
+  if (!s) return false;
+  const size_t end = s->outBase + s->out.size();
+  if (since > end) since = end;
+  dropped = since < s->outBase ? s->outBase - since : 0;
+  const size_t from = since + dropped - s->outBase;
+  out.assign(s->out, from, std::string::npos);
+  next = end;
+  return true;
+}
@@ -3,15 +3,25 @@
 #include "PyBoardUART.hpp"
 #include "ServerManager.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/stream_buffer.h"
+#include "esp_timer.h"
 
 using namespace EspressIDEA;
 
 ExecService* ExecService::s_self_ = nullptr;
 
 ExecService::ExecService(PyBoard::PyBoardUART& board, ReplControl& repl, ServerManager& server)
-: board_(board), repl_(repl), server_(server) {
+: board_(board), repl_(repl), server_(server), jobs_(board, repl) {
   s_self_ = this;
 }
 
@@ -28,50 +38,344 @@ std::string ExecService::esc(const std::string& s) {
     switch(c){
       case '\\': o+="\\\\"; break; case '"': o+="\\\""; break;
       case '\n': o+="\\n"; break; case '\r': o+="\\r"; break; case '\t': o+="\\t"; break;
-      default: o+=c;
+      default:
+        if ((unsigned char)c < 0x20) { // ANSI/control del REPL: JSON no los admite crudos
+          char u[8]; snprintf(u, sizeof(u), "\\u%04x", (unsigned)(unsigned char)c); o += u;
+        } else {
+          o+=c;
+        }
     }
   }
   return o;
 }
 
+bool ExecService::queryParamInt(httpd_req_t* req, const char* key, int& out) {
+  size_t qlen = httpd_req_get_url_query_len(req) + 1;
+  if (qlen <= 1) return false;
+  std::string q(qlen, '\0');
+  if (httpd_req_get_url_query_str(req, &q[0], q.size()) != ESP_OK) return false;
+  char val[16];
+  if (httpd_query_key_value(q.c_str(), key, val, sizeof(val)) != ESP_OK) return false;
+  char* end = nullptr;
+  long v = strtol(val, &end, 10);
+  if (end == val) return false;
+  out = (int)v;
+  return true;
+}
+
+// Cuerpo completo (código a ejecutar, máx. 64 KB); responde el error si falla
+bool ExecService::recvBody(httpd_req_t* req, std::string& body) {
+  int len = req->content_len;
+  if (len <= 0 || len > 64*1024) { httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid body"); return false; }
+  body.resize(len);
+  int got = 0, timeouts = 0;
+  while (got < len) {
+    int r = httpd_req_recv(req, body.data() + got, len - got);
+    // Unos timeouts sueltos se reintentan; seguidos, el cliente se colgó
+    if (r == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < kRecvTimeouts) continue;
+    if (r <= 0) { httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "recv error"); return false; }
+    timeouts = 0;
+    got += r;
+  }
+  return true;
+}
+
 // ==================== /api/exec ====================
 esp_err_t ExecService::execHandler(httpd_req_t* req) {
   auto* inst = ExecService::self(); if (!inst) return ESP_FAIL;
 
-  int len = req->content_len;
-  if (len <= 0 || len > 64*1024) { httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid body"); return ESP_OK; }
-  std::string body; body.resize(len);
-  int r = httpd_req_recv(req, body.data(), len);
-  if (r <= 0) { httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "recv error"); return ESP_OK; }
+  std::string body;
+  if (!recvBody(req, body)) return ESP_OK;
 
-  ReplControl::ScopedReplLock lock(inst->repl_, "exec");
+  int stream = 0;
+  (void) queryParamInt(req, "stream", stream);
+  if (stream) {
+    int timeoutMs = kStreamTimeoutMs;
+    (void) queryParamInt(req, "timeout", timeoutMs);
+    return streamExec(req, body, timeoutMs > 0 ? std::min((uint32_t)timeoutMs, kExecTimeoutMaxMs)
+                                               : kStreamTimeoutMs);
+  }
 
   // Nota: no forzamos ensureIdle aquí para no resetear el contexto del usuario.
   // Si el usuario necesita parar code.py primero, el frontend llama a /api/repl/ensure_idle.
 
-  std::string out;
-  auto rc = inst->board_.exec(body, out, /*timeoutMs*/ 8000);
+  int timeoutMs = kExecTimeoutMs;
+  (void) queryParamInt(req, "timeout", timeoutMs);
+
+  std::string out, err;
+  auto rc = inst->repl_.run(ReplPriority::BULK, "exec", [&]() {
+    return inst->board_.exec(body, out, timeoutMs > 0 ? std::min((uint32_t)timeoutMs, kExecTimeoutMaxMs)
+                                                      : kExecTimeoutMs);
+  }, &err);
   bool ok = (rc == PyBoard::ErrorCode::OK);
   std::string j = std::string("{\"ok\":") + (ok?"true":"false") +
                   ",\"stdout\":\"" + esc(out) + "\",\"stderr\":\"" +
-                  (ok ? "" : esc(inst->board_.getLastError())) + "\"}";
+                  (ok ? "" : esc(err)) + "\"}";
   sendJSON(req, j);
   return ESP_OK;
 }
 
+// ==================== /api/exec?stream=1 ====================
+// Respuesta chunked en NDJSON: {"out":"..."} por cada trozo de salida y al
+// final {"done":true,"ok":...,"error":"..."}. La tarea del REPL escribe la
+// salida en un StreamBuffer acotado y este worker la reenvía: la placa no
+// espera al WiFi salvo que el buffer se llene, y nada crece sin límite.
+namespace {
+struct ExecStreamCtx {
+  StreamBufferHandle_t sb = nullptr;
+  SemaphoreHandle_t done = nullptr;
+  volatile bool clientGone = false;
+  PyBoard::ErrorCode rc = PyBoard::ErrorCode::OK;
+  std::string err;
+};
+
+// Largo del prefijo que termina en un carácter UTF-8 completo
+size_t utf8Complete(const uint8_t* p, size_t n) {
+  size_t i = n, back = 0;
+  while (i > 0 && back < 4 && (p[i-1] & 0xC0) == 0x80) { --i; ++back; }
+  if (i == 0) return n;
+  const uint8_t lead = p[i-1];
+  size_t need = (lead & 0xE0) == 0xC0 ? 2 : (lead & 0xF0) == 0xE0 ? 3 : (lead & 0xF8) == 0xF0 ? 4 : 1;
+  return (back + 1 < need) ? i - 1 : n;
+}
+} // namespace
+
+esp_err_t ExecService::streamExec(httpd_req_t* req, const std::string& code, uint32_t timeoutMs) {
+  auto* inst = ExecService::self(); if (!inst) return ESP_FAIL;
+
+  std::shared_ptr<ExecStreamCtx> ctx(new (std::nothrow) ExecStreamCtx(), [](ExecStreamCtx* c) {
+    if (c->sb) vStreamBufferDelete(c->sb);
+    if (c->done) vSemaphoreDelete(c->done);
+    delete c;
+  });
+  if (ctx) {
+    ctx->sb = xStreamBufferCreate(kStreamBufSize, 1);
+    ctx->done = xSemaphoreCreateBinary();
+  }
+  if (!ctx || !ctx->sb || !ctx->done) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory");
+    return ESP_OK;
+  }
+
+  bool queued = inst->repl_.post(ReplPriority::BULK, "exec.stream", [inst, ctx, code, timeoutMs]() {
+    // Se corta si el cliente se fue o con STOP / ^C del terminal (como runJob)
+    return inst->board_.execStream(code, [inst, ctx](const uint8_t* d, size_t n) {
+      while (n > 0) {
+        if (ctx->clientGone || inst->repl_.cancelRequested()) return false;
+        size_t k = xStreamBufferSend(ctx->sb, d, n, pdMS_TO_TICKS(100));
+        d += k; n -= k;
+      }
+      return !ctx->clientGone && !inst->repl_.cancelRequested();
+    }, timeoutMs);
+  }, [ctx](PyBoard::ErrorCode rc, const std::string& err) {
+    ctx->rc = rc;
+    ctx->err = err;
+    xSemaphoreGive(ctx->done);
+  });
+  if (!queued) {
+    sendJSON(req, "{\"ok\":false,\"stdout\":\"\",\"stderr\":\"repl queue full\"}");
+    return ESP_OK;
+  }
+
+  httpd_resp_set_type(req, "application/x-ndjson");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+  uint8_t buf[kStreamChunk];
+  size_t have = 0;
+  bool finished = false;
+  while (!finished) {
+    // Primero ver si terminó; luego drenar lo que quede
+    finished = xSemaphoreTake(ctx->done, 0) == pdTRUE;
+    size_t n = xStreamBufferReceive(ctx->sb, buf + have, sizeof(buf) - have,
+                                    finished ? 0 : pdMS_TO_TICKS(30));
+    have += n;
+    if (finished && xStreamBufferBytesAvailable(ctx->sb) > 0) {
+      xSemaphoreGive(ctx->done);   // queda más: otra vuelta
+      finished = false;
+    }
+    if (have == 0) continue;
+
+    // No cortar un carácter multibyte entre dos líneas JSON
+    size_t send = finished ? have : utf8Complete(buf, have);
+    if (send == 0 && have < sizeof(buf)) continue;
+    if (send == 0) send = have;
+
+    if (!ctx->clientGone) {
+      std::string line = "{\"out\":\"" + esc(std::string(reinterpret_cast<char*>(buf), send)) + "\"}\n";
+      if (httpd_resp_send_chunk(req, line.data(), line.size()) != ESP_OK) ctx->clientGone = true;
+    }
+    memmove(buf, buf + send, have - send);
+    have -= send;
+  }
+
+  if (ctx->clientGone) return ESP_FAIL;
+
+  const bool ok = ctx->rc == PyBoard::ErrorCode::OK;
+  std::string tail = std::string("{\"done\":true,\"ok\":") + (ok ? "true" : "false") +
+                     ",\"error\":\"" + (ok ? "" : esc(ctx->err)) + "\"}\n";
+  httpd_resp_send_chunk(req, tail.data(), tail.size());
+  httpd_resp_send_chunk(req, nullptr, 0);
+  return ESP_OK;
+}
+
+// ==================== /api/exec/jobs ====================
+// Ejecución en segundo plano: POST devuelve un id al instante y el programa
+// corre en la tarea del REPL sin ocupar un socket. El cliente consulta estado
+// y salida por id, o lo cancela (^C + resincronizar prompt).
+std::string ExecService::jobJSON(const ExecJobInfo& info) {
+  const uint64_t now = (uint64_t)esp_timer_get_time();
+  const uint64_t start = info.startUs ? info.startUs : (info.endUs ? info.endUs : now);
+  const uint64_t end = info.endUs ? info.endUs : now;
+  return std::string("{\"id\":") + std::to_string(info.id) +
+         ",\"state\":\"" + ExecJobs::stateName(info.state) + "\"" +
+         ",\"queued_ms\":" + std::to_string((uint32_t)((start - info.queuedUs) / 1000)) +
+         ",\"runtime_ms\":" + std::to_string(info.startUs ? (uint32_t)((end - start) / 1000) : 0) +
+         ",\"out_total\":" + std::to_string(info.outTotal) +
+         ",\"error\":\"" + esc(info.error) + "\"}";
+}
+
+esp_err_t ExecService::jobSubmitHandler(httpd_req_t* req) {
+  auto* inst = ExecService::self(); if (!inst) return ESP_FAIL;
+
+  std::string body;
+  if (!recvBody(req, body)) return ESP_OK;
+
+  int timeoutMs = 0; // sin límite: se corta con /cancel o STOP
+  (void) queryParamInt(req, "timeout", timeoutMs);
+
+  uint32_t id = inst->jobs_.submit(std::move(body), timeoutMs > 0 ? (uint32_t)timeoutMs : 0);
+  if (!id) {
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    sendJSON(req, "{\"ok\":false,\"error\":\"busy\"}");
+    return ESP_OK;
+  }
+  sendJSON(req, "{\"ok\":true,\"id\":" + std::to_string(id) + "}");
+  return ESP_OK;
+}
+
+esp_err_t ExecService::jobListHandler(httpd_req_t* req) {
+  auto* inst = ExecService::self(); if (!inst) return ESP_FAIL;
+
+  std::string j = "{\"ok\":true,\"jobs\":[";
+  bool first = true;
+  for (const auto& info : inst->jobs_.list()) {
+    if (!first) j += ",";
+    first = false;
+    j += jobJSON(info);
+  }
+  j += "]}";
+  sendJSON(req, j);
+  return ESP_OK;
+}
+
+esp_err_t ExecService::jobStatusHandler(httpd_req_t* req) {
+  auto* inst = ExecService::self(); if (!inst) return ESP_FAIL;
+
+  int id = 0;
+  ExecJobInfo info;
+  if (!queryParamInt(req, "id", id) || id <= 0 || !inst->jobs_.info((uint32_t)id, info)) {
+    sendJSON(req, "{\"ok\":false,\"error\":\"unknown job\"}");
+    return ESP_OK;
+  }
+  sendJSON(req, "{\"ok\":true,\"job\":" + jobJSON(info) + "}");
+  return ESP_OK;
+}
+
+// ?id=N&since=OFF[&wait=MS]: con wait, espera hasta que haya salida nueva o
+// el trabajo termine (long-poll), así el cliente no martilla al servidor
+esp_err_t ExecService::jobOutputHandler(httpd_req_t* req) {
+  auto* inst = ExecService::self(); if (!inst) return ESP_FAIL;
+
+  int id = 0, since = 0, waitMs = 0;
+  if (!queryParamInt(req, "id", id) || id <= 0) {
+    sendJSON(req, "{\"ok\":false,\"error\":\"unknown job\"}");
+    return ESP_OK;
+  }
+  (void) queryParamInt(req, "since", since);
+  (void) queryParamInt(req, "wait", waitMs);
+  if (since < 0) since = 0;
+  if (waitMs < 0) waitMs = 0;
+  if ((uint32_t)waitMs > kJobWaitMaxMs) waitMs = kJobWaitMaxMs;
+
+  std::string out;
+  size_t next = 0, dropped = 0;
+  ExecJobInfo info;
+  const TickType_t step = pdMS_TO_TICKS(50);
+  TickType_t waited = 0;
+  for (;;) {
+    if (!inst->jobs_.output((uint32_t)id, (size_t)since, out, next, dropped) ||
+        !inst->jobs_.info((uint32_t)id, info)) {
+      sendJSON(req, "{\"ok\":false,\"error\":\"unknown job\"}");
+      return ESP_OK;
+    }
+    if (!out.empty() || dropped || ExecJobs::finished(info.state) ||
+        waited >= pdMS_TO_TICKS(waitMs)) break;
+    vTaskDelay(step);
+    waited += step;
+  }
+
+  sendJSON(req, "{\"ok\":true,\"job\":" + jobJSON(info) +
+                ",\"since\":" + std::to_string(since) +
+                ",\"next\":" + std::to_string(next) +
+                ",\"dropped\":" + std::to_string(dropped) +
+                ",\"out\":\"" + esc(out) + "\"}");
+  return ESP_OK;
+}
+
+esp_err_t ExecService::jobCancelHandler(httpd_req_t* req) {
+  auto* inst = ExecService::self(); if (!inst) return ESP_FAIL;
+
+  int id = 0;
+  if (!queryParamInt(req, "id", id) || id <= 0 || !inst->jobs_.cancel((uint32_t)id)) {
+    sendJSON(req, "{\"ok\":false,\"error\":\"unknown or finished job\"}");
+    return ESP_OK;
+  }
+  sendJSON(req, "{\"ok\":true,\"id\":" + std::to_string(id) + "}");
+  return ESP_OK;
+}
+
 // ==================== /api/repl/ensure_idle ====================
-// Delega en ReplControl para hacer ^C,^D y ESPERAR ">>>"
+// Sin parámetros: sondeo tibio (no reinicia si ya está en ">>>").
+// ?hard=1 (botón STOP): corta lo que esté corriendo y hace ^C,^D.
 esp_err_t ExecService::ensureIdleHandler(httpd_req_t* req) {
   auto* inst = ExecService::self(); if (!inst) return ESP_FAIL;
 
-  // ¡OJO! No uses ScopedReplLock aquí: ensureIdleCircuitPython ya toma/soltará el mutex internamente.
-  bool ok = inst->repl_.ensureIdleCircuitPython(/*timeout_ms*/ 3000);
+  int hard = 0;
+  (void) queryParamInt(req, "hard", hard);
+
+  static const char* const levels[] = {"none", "interrupt", "reset"};
+  PyBoard::IdleLevel level = PyBoard::IdleLevel::NONE;
+  bool ok = inst->repl_.ensureIdle(/*timeout_ms*/ 3000, hard != 0, &level);
   if (!ok) {
     sendJSON(req, "{\"ok\":false,\"error\":\"timeout esperando prompt >>>\"}");
     return ESP_OK;
   }
 
-  sendJSON(req, "{\"ok\":true,\"mode\":\"friendly\"}");
+  sendJSON(req, std::string("{\"ok\":true,\"mode\":\"friendly\",\"level\":\"") +
+                levels[static_cast<size_t>(level)] + "\"}");
+  return ESP_OK;
+}
+
+// ==================== /api/repl/stats ====================
+// Demora en cola y corrida máxima por clase de prioridad de la tarea del REPL
+esp_err_t ExecService::statsHandler(httpd_req_t* req) {
+  auto* inst = ExecService::self(); if (!inst) return ESP_FAIL;
+
+  static const char* const names[kReplPriorities] = {"interactive", "meta", "bulk"};
+  std::string j = "{\"ok\":true";
+  for (size_t i = 0; i < kReplPriorities; ++i) {
+    const auto prio = static_cast<ReplPriority>(i);
+    const ReplQueueStats st = inst->repl_.stats(prio);
+    const uint32_t avg = st.jobs ? (uint32_t)(st.waitUsTotal / st.jobs) : 0;
+    j += std::string(",\"") + names[i] + "\":{\"jobs\":" + std::to_string(st.jobs) +
+         ",\"pending\":" + std::to_string(inst->repl_.pending(prio)) +
+         ",\"wait_avg_us\":" + std::to_string(avg) +
+         ",\"wait_max_us\":" + std::to_string(st.waitUsMax) +
+         ",\"run_max_us\":" + std::to_string(st.runUsMax) + "}";
+  }
+  j += "}";
+  sendJSON(req, j);
   return ESP_OK;
 }
 
@@ -85,6 +389,43 @@ void ExecService::registerRoutes() {
     .is_websocket=false, .handle_ws_control_frames=false, .supported_subprotocol=nullptr
   };
 
-  server_.registerHttpHandler(exec);
-  server_.registerHttpHandler(ensure);
+  httpd_uri_t stats = {
+    .uri="/api/repl/stats", .method=HTTP_GET, .handler=ExecService::statsHandler, .user_ctx=nullptr,
+    .is_websocket=false, .handle_ws_control_frames=false, .supported_subprotocol=nullptr
+  };
+
+  httpd_uri_t jobSubmit = {
+    .uri="/api/exec/jobs", .method=HTTP_POST, .handler=ExecService::jobSubmitHandler, .user_ctx=nullptr,
+    .is_websocket=false, .handle_ws_control_frames=false, .supported_subprotocol=nullptr
+  };
+  httpd_uri_t jobList = {
+    .uri="/api/exec/jobs", .method=HTTP_GET, .handler=ExecService::jobListHandler, .user_ctx=nullptr,
+    .is_websocket=false, .handle_ws_control_frames=false, .supported_subprotocol=nullptr
+  };
+  httpd_uri_t jobStatus = {
+    .uri="/api/exec/jobs/status", .method=HTTP_GET, .handler=ExecService::jobStatusHandler, .user_ctx=nullptr,
+    .is_websocket=false, .handle_ws_control_frames=false, .supported_subprotocol=nullptr
+  };
+  httpd_uri_t jobOutput = {
+    .uri="/api/exec/jobs/output", .method=HTTP_GET, .handler=ExecService::jobOutputHandler, .user_ctx=nullptr,
+    .is_websocket=false, .handle_ws_control_frames=false, .supported_subprotocol=nullptr
+  };
+  httpd_uri_t jobCancel = {
+    .uri="/api/exec/jobs/cancel", .method=HTTP_POST, .handler=ExecService::jobCancelHandler, .user_ctx=nullptr,
+    .is_websocket=false, .handle_ws_control_frames=false, .supported_subprotocol=nullptr
+  };
+
+  // exec y STOP esperan a la tarea del REPL: fuera de la tarea del httpd.
+  // ensure_idle tiene worker propio: STOP anda aunque el pool esté ocupado
+  server_.registerAsyncHandler(exec, 1);
+  server_.registerAsyncHandler(ensure, 1, true);
+  server_.registerHttpHandler(stats);
+
+  // Los trabajos solo tocan la tabla (no bloquean); output puede esperar
+  // (long-poll) y submit recibe hasta 64 KB de código: ambos en el pool
+  server_.registerAsyncHandler(jobSubmit, 1);
+  server_.registerHttpHandler(jobList);
+  server_.registerHttpHandler(jobStatus);
+  server_.registerAsyncHandler(jobOutput, 2);
+  server_.registerHttpHandler(jobCancel);
 }
@@ -4,9 +4,16 @@
 #include "ServerManager.hpp"
 
 #include <vector>
+#include <memory>
+#include <new>
 #include <cstring>
 #include <algorithm>  // std::min
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
 using namespace EspressIDEA;
 
 FSService* FSService::s_self_ = nullptr;
@@ -59,24 +66,6 @@ static std::string urlDecode(const std::string& s){
   }
   return o;
 }
-// Literal de Python entre comillas simples, escapando \ y '
-static std::string pyQuote(const std::string& s){
-  std::string o; o.reserve(s.size()+2);
-  o.push_back('\'');
-  for (char c: s){
-    switch(c){
-      case '\\': o+="\\\\"; break;
-      case '\'': o+="\\\'"; break;
-      case '\n': o+="\\n"; break;
-      case '\r': o+="\\n"; break;
-      case '\t': o+="\\t"; break;
-      default:   o.push_back(c); break;
-    }
-  }
-  o.push_back('\'');
-  return o;
-}
-
 bool FSService::queryParam(httpd_req_t* req, const char* key, std::string& out) {
   size_t qlen = httpd_req_get_url_query_len(req) + 1;
   if (qlen <= 1) return false;
@@ -100,7 +89,22 @@ bool FSService::queryParamInt(httpd_req_t* req, const char* key, int& out) {
   return true;
 }
 
-// ---------------- list/read/write (base64) ----------------
+// Cuerpo completo (content_len ya validado por el handler); responde el
+// error si falla. Unos timeouts sueltos se reintentan, RECV_TIMEOUTS seguidos no
+bool FSService::recvBody(httpd_req_t* req, std::string& body) {
+  const int len = req->content_len;
+  body.resize(len);
+  for (int got = 0, timeouts = 0; got < len;) {
+    int r = httpd_req_recv(req, body.data() + got, len - got);
+    if (r == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < RECV_TIMEOUTS) continue;
+    if (r <= 0) { httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "recv error"); return false; }
+    timeouts = 0;
+    got += r;
+  }
+  return true;
+}
+
+// ---------------- list/read/write (base64, o binario con raw=1) ----------------
 
 esp_err_t FSService::listHandler(httpd_req_t* req) {
   auto* inst = FSService::self(); if (!inst) return ESP_FAIL;
@@ -110,12 +114,13 @@ esp_err_t FSService::listHandler(httpd_req_t* req) {
   if (path.empty()) path = "/";
 
   // Importante: NO llamar ensureIdle aquí. El frontend ya lo invocó antes (botón STOP).
-  ReplControl::ScopedReplLock lock(inst->repl_, "fs.list");
-
   std::vector<PyBoard::FileInfo> files;
-  auto rc = inst->board_.listDir(path, files);
+  std::string err;
+  auto rc = inst->repl_.run(ReplPriority::META, "fs.list", [&]() {
+    return inst->board_.listDir(path, files);
+  }, &err);
   if (rc != PyBoard::ErrorCode::OK) {
-    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"") + esc(inst->board_.getLastError()) + "\"}");
+    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"") + esc(err) + "\"}");
     return ESP_OK;
   }
 
@@ -140,15 +145,26 @@ esp_err_t FSService::readHandler(httpd_req_t* req) {
     return ESP_OK;
   }
 
-  ReplControl::ScopedReplLock lock(inst->repl_, "fs.read");
+  // raw=1: el contenido tal cual (application/octet-stream); los errores
+  // siguen llegando como JSON
+  int raw = 0; (void) inst->queryParamInt(req, "raw", raw);
 
-  std::string content_b64;
-  auto rc = inst->board_.readFile(path, content_b64); // Base64
+  std::vector<uint8_t> content;
+  std::string err;
+  auto rc = inst->repl_.run(ReplPriority::BULK, "fs.read", [&]() {
+    return inst->board_.readFileRaw(path, content);
+  }, &err);
   if (rc != PyBoard::ErrorCode::OK) {
-    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"") + esc(inst->board_.getLastError()) + "\"}");
+    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"") + esc(err) + "\"}");
+    return ESP_OK;
+  }
+  if (raw) {
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_send(req, reinterpret_cast<const char*>(content.data()), content.size());
     return ESP_OK;
   }
-  inst->sendJSON(req, std::string("{\"ok\":true,\"path\":\"") + esc(path) + "\",\"base64\":\"" + esc(content_b64) + "\"}");
+  inst->sendJSON(req, std::string("{\"ok\":true,\"path\":\"") + esc(path) + "\",\"base64\":\"" +
+                      PyBoard::PyBoardUART::base64Encode(content) + "\"}");
   return ESP_OK;
 }
 
@@ -166,18 +182,28 @@ esp_err_t FSService::writeHandler(httpd_req_t* req) {
     httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid body size");
     return ESP_OK;
   }
-  std::string body; body.resize(len);
-  int r = httpd_req_recv(req, body.data(), len);
-  if (r <= 0) { httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "recv error"); return ESP_OK; }
+  std::string body;
+  if (!recvBody(req, body)) return ESP_OK;
 
-  ReplControl::ScopedReplLock lock(inst->repl_, "fs.write");
+  // delta=1: si el archivo ya existe solo viajan los bloques que cambiaron
+  // raw=1: el body es el contenido tal cual (si no, base64)
+  int delta = 0; (void) inst->queryParamInt(req, "delta", delta);
+  int raw = 0; (void) inst->queryParamInt(req, "raw", raw);
 
-  auto rc = inst->board_.writeFile(path, body); // body (base64)
+  std::string err;
+  size_t sent = 0;
+  auto rc = inst->repl_.run(ReplPriority::BULK, "fs.write", [&]() {
+    std::vector<uint8_t> data = raw ? std::vector<uint8_t>(body.begin(), body.end())
+                                    : PyBoard::PyBoardUART::base64Decode(body);
+    if (!delta) return inst->board_.writeFileRaw(path, data);
+    return inst->board_.writeFileDelta(path, data.data(), data.size(), &sent);
+  }, &err);
   if (rc != PyBoard::ErrorCode::OK) {
-    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"") + esc(inst->board_.getLastError()) + "\"}");
+    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"") + esc(err) + "\"}");
     return ESP_OK;
   }
-  inst->sendJSON(req, std::string("{\"ok\":true,\"path\":\"") + esc(path) + "\"}");
+  inst->sendJSON(req, std::string("{\"ok\":true,\"path\":\"") + esc(path) + "\"" +
+                      (delta ? ",\"sent\":" + std::to_string(sent) : std::string()) + "}");
   return ESP_OK;
 }
 
@@ -191,12 +217,13 @@ esp_err_t FSService::existsHandler(httpd_req_t* req) {
     return ESP_OK;
   }
 
-  ReplControl::ScopedReplLock lock(inst->repl_, "fs.exists");
-
   bool ex = false;
-  auto rc = inst->board_.exists(path, ex);
+  std::string err;
+  auto rc = inst->repl_.run(ReplPriority::META, "fs.exists", [&]() {
+    return inst->board_.exists(path, ex);
+  }, &err);
   if (rc != PyBoard::ErrorCode::OK) {
-    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(inst->board_.getLastError())+"\"}");
+    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(err)+"\"}");
     return ESP_OK;
   }
   inst->sendJSON(req, std::string("{\"ok\":true,\"exists\":") + (ex?"true":"false") + "}");
@@ -211,12 +238,13 @@ esp_err_t FSService::infoHandler(httpd_req_t* req) {
     return ESP_OK;
   }
 
-  ReplControl::ScopedReplLock lock(inst->repl_, "fs.info");
-
   PyBoard::FileInfo info;
-  auto rc = inst->board_.getFileInfo(path, info);
+  std::string err;
+  auto rc = inst->repl_.run(ReplPriority::META, "fs.info", [&]() {
+    return inst->board_.getFileInfo(path, info);
+  }, &err);
   if (rc != PyBoard::ErrorCode::OK) {
-    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(inst->board_.getLastError())+"\"}");
+    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(err)+"\"}");
     return ESP_OK;
   }
   std::string j = std::string("{\"ok\":true,\"info\":{")
@@ -236,11 +264,12 @@ esp_err_t FSService::deleteHandler(httpd_req_t* req) {
     return ESP_OK;
   }
 
-  ReplControl::ScopedReplLock lock(inst->repl_, "fs.delete");
-
-  auto rc = inst->board_.deleteFile(path);
+  std::string err;
+  auto rc = inst->repl_.run(ReplPriority::META, "fs.delete", [&]() {
+    return inst->board_.deleteFile(path);
+  }, &err);
   if (rc != PyBoard::ErrorCode::OK) {
-    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(inst->board_.getLastError())+"\"}");
+    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(err)+"\"}");
     return ESP_OK;
   }
   inst->sendJSON(req, "{\"ok\":true}");
@@ -255,39 +284,18 @@ esp_err_t FSService::mkdirHandler(httpd_req_t* req) {
     return ESP_OK;
   }
 
-  ReplControl::ScopedReplLock lock(inst->repl_, "fs.mkdir");
-
-  auto rc = inst->board_.createDir(path);
+  std::string err;
+  auto rc = inst->repl_.run(ReplPriority::META, "fs.mkdir", [&]() {
+    return inst->board_.createDir(path);
+  }, &err);
   if (rc != PyBoard::ErrorCode::OK) {
-    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(inst->board_.getLastError())+"\"}");
+    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(err)+"\"}");
     return ESP_OK;
   }
   inst->sendJSON(req, "{\"ok\":true}");
   return ESP_OK;
 }
 
-// eliminación recursiva (si recursive=1), si no, rmdir simple
-bool FSService::rmdirRecursive(FSService* inst, const std::string& path, std::string& err) {
-  std::vector<PyBoard::FileInfo> files;
-  auto rc = inst->board_.listDir(path, files);
-  if (rc != PyBoard::ErrorCode::OK) { err = inst->board_.getLastError(); return false; }
-
-  for (const auto& f : files) {
-    std::string p = path;
-    if (!p.empty() && p.back() != '/') p += "/";
-    p += f.name;
-    if (f.isDirectory) {
-      if (!rmdirRecursive(inst, p, err)) return false;
-    } else {
-      rc = inst->board_.deleteFile(p);
-      if (rc != PyBoard::ErrorCode::OK) { err = inst->board_.getLastError(); return false; }
-    }
-  }
-  rc = inst->board_.deleteDir(path);
-  if (rc != PyBoard::ErrorCode::OK) { err = inst->board_.getLastError(); return false; }
-  return true;
-}
-
 esp_err_t FSService::rmdirHandler(httpd_req_t* req) {
   auto* inst = FSService::self(); if (!inst) return ESP_FAIL;
   std::string path;
@@ -303,21 +311,14 @@ esp_err_t FSService::rmdirHandler(httpd_req_t* req) {
 
   int recursive = 0; (void) inst->queryParamInt(req, "recursive", recursive);
 
-  ReplControl::ScopedReplLock lock(inst->repl_, "fs.rmdir");
-
-  if (recursive) {
-    std::string err;
-    bool ok = rmdirRecursive(inst, path, err);
-    if (!ok) {
-      inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(err)+"\"}");
-      return ESP_OK;
-    }
-  } else {
-    auto rc = inst->board_.deleteDir(path);
-    if (rc != PyBoard::ErrorCode::OK) {
-      inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(inst->board_.getLastError())+"\"}");
-      return ESP_OK;
-    }
+  // recursive=1: la placa recorre y borra todo en una sola llamada
+  std::string err;
+  auto rc = inst->repl_.run(ReplPriority::META, "fs.rmdir", [&]() {
+    return recursive ? inst->board_.deleteTree(path) : inst->board_.deleteDir(path);
+  }, &err);
+  if (rc != PyBoard::ErrorCode::OK) {
+    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(err)+"\"}");
+    return ESP_OK;
   }
   inst->sendJSON(req, "{\"ok\":true}");
   return ESP_OK;
@@ -347,40 +348,24 @@ esp_err_t FSService::renameHandler(httpd_req_t* req) {
     return ESP_OK;
   }
 
-  ReplControl::ScopedReplLock lock(inst->repl_, "fs.rename");
+  std::string err;
+  auto rc = inst->repl_.run(ReplPriority::META, "fs.rename", [&]() {
+    // asegurar que 'from' sea archivo (no dir)
+    PyBoard::FileInfo info;
+    auto r = inst->board_.getFileInfo(fromPath, info);
+    if (r != PyBoard::ErrorCode::OK) { err = inst->board_.getLastError(); return r; }
+    if (info.isDirectory) {
+      err = "rename de directorios no soportado";
+      return PyBoard::ErrorCode::INVALID_PARAM;
+    }
 
-  // asegurar que 'from' sea archivo (no dir)
-  PyBoard::FileInfo info;
-  auto rcFI = inst->board_.getFileInfo(fromPath, info);
-  if (rcFI != PyBoard::ErrorCode::OK) {
-    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(inst->board_.getLastError())+"\"}");
-    return ESP_OK;
-  }
-  if (info.isDirectory) {
-    inst->sendJSON(req, "{\"ok\":false,\"error\":\"rename de directorios no soportado\"}");
-    return ESP_OK;
-  }
+    // Fast path: os.rename vía agente (si el FS lo soporta)
+    if (inst->board_.renamePath(fromPath, toPath) == PyBoard::ErrorCode::OK) return PyBoard::ErrorCode::OK;
 
-  // Fast path: intenta os.rename (si el FS lo soporta)
-  {
-    std::string py = "import os\n"
-                     "try:\n"
-                     "  os.rename(" + pyQuote(fromPath) + "," + pyQuote(toPath) + ")\n"
-                     "  print('OK')\n"
-                     "except Exception as e:\n"
-                     "  print('FAIL')\n";
-    std::string out;
-    auto rc = inst->board_.exec(py, out);
-    if (rc == PyBoard::ErrorCode::OK && out.find("OK") != std::string::npos) {
-      inst->sendJSON(req, "{\"ok\":true}");
-      return ESP_OK;
-    }
     // Si falló, cae al método por copia
-  }
-
-  std::string err;
-  bool ok = renameFile(inst, fromPath, toPath, err);
-  if (!ok) {
+    return renameFile(inst, fromPath, toPath, err) ? PyBoard::ErrorCode::OK : PyBoard::ErrorCode::FILE_ERROR;
+  });
+  if (rc != PyBoard::ErrorCode::OK) {
     inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(err)+"\"}");
     return ESP_OK;
   }
@@ -390,6 +375,62 @@ esp_err_t FSService::renameHandler(httpd_req_t* req) {
 
 // ---------------- download/upload (raw) ----------------
 
+// Doble buffer para /api/fs/download: un trabajo BULK en la tarea del REPL
+// lee de la placa (readFileStream) mientras el handler envía el slot
+// anterior por WiFi.
+// Memoria constante (2 slots) sin importar el tamaño del archivo.
+namespace {
+constexpr size_t kDlSlotSize = 4096;   // ~3 segmentos TCP por envío
+
+struct DlSlot {
+  uint8_t data[kDlSlotSize];
+  size_t len = 0;
+  bool last = false;
+  PyBoard::ErrorCode rc = PyBoard::ErrorCode::OK;
+};
+struct DlCtx {
+  PyBoard::PyBoardUART* board = nullptr;
+  ReplControl* repl = nullptr;
+  std::string path;
+  DlSlot slots[2];
+  QueueHandle_t freeQ = nullptr;   // índices de slots libres
+  QueueHandle_t fullQ = nullptr;   // índices de slots listos para enviar
+  SemaphoreHandle_t done = nullptr;
+  volatile bool abort = false;     // el cliente se fue: cortar la lectura
+  std::string err;
+};
+
+PyBoard::ErrorCode dlProduce(DlCtx* ctx) {
+  int cur = 0;
+  xQueueReceive(ctx->freeQ, &cur, portMAX_DELAY);
+
+  auto rc = ctx->board->readFileStream(ctx->path, [&](const uint8_t* p, size_t n) {
+    while (n > 0) {
+      DlSlot& s = ctx->slots[cur];
+      size_t k = std::min(n, sizeof(s.data) - s.len);
+      memcpy(s.data + s.len, p, k);
+      s.len += k; p += k; n -= k;
+      if (s.len == sizeof(s.data)) {
+        xQueueSend(ctx->fullQ, &cur, portMAX_DELAY);
+        xQueueReceive(ctx->freeQ, &cur, portMAX_DELAY);
+        ctx->slots[cur].len = 0;
+      }
+    }
+    // STOP / ^C del terminal también cortan la descarga
+    return !ctx->abort && !ctx->repl->cancelRequested();
+  });
+
+  DlSlot& s = ctx->slots[cur];
+  s.last = true;
+  s.rc = rc;
+  if (rc != PyBoard::ErrorCode::OK) ctx->err = ctx->board->getLastError();
+  xQueueSend(ctx->fullQ, &cur, portMAX_DELAY);
+
+  xSemaphoreGive(ctx->done);
+  return rc;
+}
+} // namespace
+
 esp_err_t FSService::downloadHandler(httpd_req_t* req) {
   auto* inst = FSService::self(); if (!inst) return ESP_FAIL;
   std::string path;
@@ -398,35 +439,141 @@ esp_err_t FSService::downloadHandler(httpd_req_t* req) {
     return ESP_OK;
   }
 
-  ReplControl::ScopedReplLock lock(inst->repl_, "fs.download");
+  std::unique_ptr<DlCtx> ctx(new (std::nothrow) DlCtx());
+  if (!ctx) { httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory"); return ESP_OK; }
+  ctx->board = &inst->board_;
+  ctx->repl = &inst->repl_;
+  ctx->path = path;
+  ctx->freeQ = xQueueCreate(2, sizeof(int));
+  ctx->fullQ = xQueueCreate(2, sizeof(int));
+  ctx->done  = xSemaphoreCreateBinary();
+  auto cleanup = [&]() {
+    if (ctx->freeQ) vQueueDelete(ctx->freeQ);
+    if (ctx->fullQ) vQueueDelete(ctx->fullQ);
+    if (ctx->done)  vSemaphoreDelete(ctx->done);
+  };
+  if (!ctx->freeQ || !ctx->fullQ || !ctx->done) {
+    cleanup();
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory");
+    return ESP_OK;
+  }
+  for (int i = 0; i < 2; ++i) xQueueSend(ctx->freeQ, &i, 0);
 
-  std::vector<uint8_t> data;
-  auto rc = inst->board_.readFileRaw(path, data);
-  if (rc != PyBoard::ErrorCode::OK) {
-    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, inst->board_.getLastError().c_str());
+  DlCtx* raw = ctx.get();
+  if (!inst->repl_.post(ReplPriority::BULK, "fs.download", [raw]() { return dlProduce(raw); })) {
+    cleanup();
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "repl queue full");
     return ESP_OK;
   }
 
-  // Tipo y Content-Disposition (filename)
-  httpd_resp_set_type(req, "application/octet-stream");
-  std::string fname = path;
-  auto slash = fname.find_last_of('/');
-  if (slash != std::string::npos) fname = fname.substr(slash+1);
-  std::string cd = "attachment; filename=\"" + fname + "\"";
-  httpd_resp_set_hdr(req, "Content-Disposition", cd.c_str());
+  bool headersSent = false;
+  bool failed = false;
+  for (;;) {
+    int idx = 0;
+    xQueueReceive(ctx->fullQ, &idx, portMAX_DELAY);
+    DlSlot& s = ctx->slots[idx];
+    const bool last = s.last;
+
+    if (!headersSent) {
+      // Error antes del primer byte (p.ej. no existe): todavía se puede responder 404
+      if (last && s.rc != PyBoard::ErrorCode::OK && s.len == 0) {
+        xSemaphoreTake(ctx->done, portMAX_DELAY);
+        std::string err = ctx->err;
+        cleanup();
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, err.c_str());
+        return ESP_OK;
+      }
+      // Tipo y Content-Disposition (filename)
+      httpd_resp_set_type(req, "application/octet-stream");
+      std::string fname = path;
+      auto slash = fname.find_last_of('/');
+      if (slash != std::string::npos) fname = fname.substr(slash+1);
+      std::string cd = "attachment; filename=\"" + fname + "\"";
+      httpd_resp_set_hdr(req, "Content-Disposition", cd.c_str());
+      headersSent = true;
+    }
 
-  const size_t CH = 1400;
-  size_t off = 0;
-  while (off < data.size()) {
-    size_t n = std::min(CH, data.size() - off);
-    esp_err_t er = httpd_resp_send_chunk(req, reinterpret_cast<const char*>(data.data() + off), n);
-    if (er != ESP_OK) { httpd_resp_send_chunk(req, nullptr, 0); return ESP_OK; }
-    off += n;
+    if (s.len && !ctx->abort &&
+        httpd_resp_send_chunk(req, reinterpret_cast<const char*>(s.data), s.len) != ESP_OK) {
+      ctx->abort = true;   // el productor corta en el próximo trozo
+    }
+    if (last) { failed = (s.rc != PyBoard::ErrorCode::OK); break; }
+    s.len = 0;
+    xQueueSend(ctx->freeQ, &idx, portMAX_DELAY);
   }
+
+  xSemaphoreTake(ctx->done, portMAX_DELAY);
+  cleanup();
+
+  // Error a mitad de camino: cerrar la conexión para que el navegador no
+  // dé por buena una descarga truncada
+  if (failed || ctx->abort) return ESP_FAIL;
   httpd_resp_send_chunk(req, nullptr, 0);
   return ESP_OK;
 }
 
+// Subida con el mismo doble buffer, al revés: el handler recibe del socket
+// en este hilo y un trabajo BULK en la tarea del REPL pasa cada slot lleno a
+// la sesión abierta (uploadWrite). La tarea del REPL nunca espera a la red:
+// entre slots solo mira la cola y cancelRequested() (STOP / ^C).
+namespace {
+constexpr uint32_t kUlPollMs = 100;    // cada cuánto se miran abort/cancel
+
+struct UlCtx {
+  PyBoard::PyBoardUART* board = nullptr;
+  ReplControl* repl = nullptr;
+  std::string path;
+  bool append = false;
+  DlSlot slots[2];
+  QueueHandle_t freeQ = nullptr;   // slots que el handler puede llenar
+  QueueHandle_t fullQ = nullptr;   // slots listos para la placa
+  SemaphoreHandle_t done = nullptr;
+  volatile bool abort = false;     // el cliente se fue o dejó de mandar
+  volatile bool finished = false;  // el consumidor terminó (ok o error)
+  PyBoard::ErrorCode rc = PyBoard::ErrorCode::OK;
+  std::string err;
+  PyBoard::TransferStats stats;
+};
+
+PyBoard::ErrorCode ulConsume(UlCtx* ctx) {
+  auto& board = *ctx->board;
+  auto rc = board.uploadBegin(ctx->path, ctx->append);
+  if (rc != PyBoard::ErrorCode::OK) ctx->err = board.getLastError();
+
+  while (rc == PyBoard::ErrorCode::OK) {
+    if (ctx->abort || ctx->repl->cancelRequested()) {
+      board.uploadAbort();
+      ctx->err = ctx->abort ? "recv error" : "upload cancelado";
+      rc = PyBoard::ErrorCode::EXEC_ERROR;
+      break;
+    }
+    int idx = 0;
+    if (xQueueReceive(ctx->fullQ, &idx, pdMS_TO_TICKS(kUlPollMs)) != pdTRUE) continue;
+
+    DlSlot& s = ctx->slots[idx];
+    const bool last = s.last;
+    if (s.len) rc = board.uploadWrite(s.data, s.len);
+    xQueueSend(ctx->freeQ, &idx, portMAX_DELAY);
+    if (rc != PyBoard::ErrorCode::OK) {
+      ctx->err = board.getLastError();
+      board.uploadAbort();
+      break;
+    }
+    if (last) {
+      rc = board.uploadEnd();
+      if (rc != PyBoard::ErrorCode::OK) ctx->err = board.getLastError();
+      ctx->stats = board.getLastTransfer();
+      break;
+    }
+  }
+
+  ctx->rc = rc;
+  ctx->finished = true;
+  xSemaphoreGive(ctx->done);
+  return rc;
+}
+} // namespace
+
 esp_err_t FSService::uploadHandler(httpd_req_t* req) {
   auto* inst = FSService::self(); if (!inst) return ESP_FAIL;
 
@@ -438,7 +585,6 @@ esp_err_t FSService::uploadHandler(httpd_req_t* req) {
 
   int appendInt = 0;
   (void) inst->queryParamInt(req, "append", appendInt);
-  bool append = appendInt != 0;
 
   int remaining = req->content_len;
   if (remaining <= 0) {
@@ -446,29 +592,77 @@ esp_err_t FSService::uploadHandler(httpd_req_t* req) {
     return ESP_OK;
   }
 
-  ReplControl::ScopedReplLock lock(inst->repl_, "fs.upload");
+  // Una sola sesión en la placa para todo el body: el archivo se abre una
+  // vez, cada slot se reenvía como tramas y al cerrar se verifica tamaño y
+  // CRC contra lo que escribió la placa.
+  std::unique_ptr<UlCtx> ctx(new (std::nothrow) UlCtx());
+  if (!ctx) { httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory"); return ESP_OK; }
+  ctx->board = &inst->board_;
+  ctx->repl = &inst->repl_;
+  ctx->path = path;
+  ctx->append = appendInt != 0;
+  ctx->freeQ = xQueueCreate(2, sizeof(int));
+  ctx->fullQ = xQueueCreate(2, sizeof(int));
+  ctx->done  = xSemaphoreCreateBinary();
+  auto cleanup = [&]() {
+    if (ctx->freeQ) vQueueDelete(ctx->freeQ);
+    if (ctx->fullQ) vQueueDelete(ctx->fullQ);
+    if (ctx->done)  vSemaphoreDelete(ctx->done);
+  };
+  if (!ctx->freeQ || !ctx->fullQ || !ctx->done) {
+    cleanup();
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory");
+    return ESP_OK;
+  }
+  for (int i = 0; i < 2; ++i) xQueueSend(ctx->freeQ, &i, 0);
 
-  const size_t CH = 8 * 1024; // trozo de lectura del HTTP
-  std::vector<uint8_t> buf(CH);
+  UlCtx* raw = ctx.get();
+  if (!inst->repl_.post(ReplPriority::BULK, "fs.upload", [raw]() { return ulConsume(raw); })) {
+    cleanup();
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "repl queue full");
+    return ESP_OK;
+  }
 
-  while (remaining > 0) {
-    int toRead = std::min<int>(remaining, (int)CH);
-    int r = httpd_req_recv(req, reinterpret_cast<char*>(buf.data()), toRead);
-    if (r <= 0) {
-      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "recv error");
-      return ESP_OK;
+  const int total = remaining;
+  bool recvFailed = false;
+  int timeouts = 0;
+  while (!ctx->finished) {
+    int idx = 0;
+    if (xQueueReceive(ctx->freeQ, &idx, pdMS_TO_TICKS(kUlPollMs)) != pdTRUE) continue;
+
+    DlSlot& s = ctx->slots[idx];
+    s.len = 0;
+    while (s.len < sizeof(s.data) && remaining > 0) {
+      int toRead = std::min<int>(remaining, (int)(sizeof(s.data) - s.len));
+      int n = httpd_req_recv(req, reinterpret_cast<char*>(s.data + s.len), toRead);
+      if (n == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < RECV_TIMEOUTS) continue;
+      if (n <= 0) { recvFailed = true; break; }
+      timeouts = 0;
+      s.len += (size_t)n;
+      remaining -= n;
     }
+    if (recvFailed) { ctx->abort = true; break; }   // el consumidor aborta la sesión
+    s.last = remaining == 0;
+    xQueueSend(ctx->fullQ, &idx, portMAX_DELAY);
+    if (s.last) break;
+  }
 
-    auto rc = inst->board_.writeFileChunk(path, buf.data(), (size_t)r, append);
-    if (rc != PyBoard::ErrorCode::OK) {
-      inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(inst->board_.getLastError())+"\"}");
-      return ESP_OK;
-    }
-    remaining -= r;
-    append = true; // el resto siempre en append
+  xSemaphoreTake(ctx->done, portMAX_DELAY);
+  cleanup();
+
+  if (recvFailed) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "recv error");
+    return ESP_OK;
+  }
+  // El consumidor terminó antes (no se pudo abrir, error de la placa, STOP)
+  if (ctx->rc != PyBoard::ErrorCode::OK || remaining > 0) {
+    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"")+esc(ctx->err)+"\"}");
+    return ESP_OK;
   }
 
-  inst->sendJSON(req, std::string("{\"ok\":true,\"path\":\"")+esc(path)+"\"}");
+  // chunk/bps: trozo que eligió el control adaptativo y lo que rindió
+  inst->sendJSON(req, std::string("{\"ok\":true,\"path\":\"")+esc(path)+"\",\"size\":"+std::to_string(total)+
+                      ",\"chunk\":"+std::to_string(ctx->stats.chunk)+",\"bps\":"+std::to_string(ctx->stats.bytesPerSec())+"}");
   return ESP_OK;
 }
 
@@ -483,39 +677,197 @@ esp_err_t FSService::createHandler(httpd_req_t* req) {
     return ESP_OK;
   }
 
-  ReplControl::ScopedReplLock lock(inst->repl_, "fs.create");
-
   int len = req->content_len;
 
+  // Si viene cuerpo, es el contenido inicial: BASE64, o tal cual con raw=1 (igual que /write)
+  std::string body;
   if (len > 0) {
-    // Si viene cuerpo, se interpreta como BASE64 para contenido inicial (igual que /write)
     if ((size_t)len > MAX_UPLOAD) {
       httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid body size");
       return ESP_OK;
     }
-    std::string body; body.resize(len);
-    int r = httpd_req_recv(req, body.data(), len);
-    if (r <= 0) {
-      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "recv error");
-      return ESP_OK;
-    }
+    if (!recvBody(req, body)) return ESP_OK;
+  }
+  int raw = 0; (void) inst->queryParamInt(req, "raw", raw);
 
-    auto rc = inst->board_.writeFile(path, body);
-    if (rc != PyBoard::ErrorCode::OK) {
-      inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"") + esc(inst->board_.getLastError()) + "\"}");
+  std::string err;
+  // Con contenido es una transferencia (como /write y /upload): BULK, para
+  // no adelantarse a las que ya esperan ni demorar las META cortas
+  const ReplPriority prio = body.empty() ? ReplPriority::META : ReplPriority::BULK;
+  auto rc = inst->repl_.run(prio, "fs.create", [&]() {
+    // Sin cuerpo: archivo vacío
+    std::vector<uint8_t> data = raw ? std::vector<uint8_t>(body.begin(), body.end())
+                                    : PyBoard::PyBoardUART::base64Decode(body);
+    return inst->board_.writeFileRaw(path, data);
+  }, &err);
+  if (rc != PyBoard::ErrorCode::OK) {
+    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"") + esc(err) + "\"}");
+    return ESP_OK;
+  }
+
+  inst->sendJSON(req, std::string("{\"ok\":true,\"path\":\"") + esc(path) + "\"}");
+  return ESP_OK;
+}
+
+// ---------------- tree (recorrido completo) ----------------
+
+// GET /api/fs/tree?path=/&depth=8&glob=*.py&limit=512
+// Un solo recorrido en la placa. Cuerpo TSV, una línea por entrada:
+//   d|f <TAB> tamaño <TAB> ruta relativa a 'path'
+// X-Tree-Count: entradas; X-Tree-Complete: los directorios de nivel menor
+// (path = 0) están listados enteros (< depth si se llegó a limit).
+esp_err_t FSService::treeHandler(httpd_req_t* req) {
+  auto* inst = FSService::self(); if (!inst) return ESP_FAIL;
+
+  std::string path, glob;
+  (void) inst->queryParam(req, "path", path);
+  if (path.empty()) path = "/";
+  (void) inst->queryParam(req, "glob", glob);
+  int depth = TREE_DEPTH, limit = TREE_LIMIT;
+  (void) inst->queryParamInt(req, "depth", depth);
+  (void) inst->queryParamInt(req, "limit", limit);
+  depth = std::max(1, std::min(depth, TREE_DEPTH_MAX));
+  limit = std::max(1, std::min(limit, TREE_LIMIT_MAX));
+
+  // Las entradas se agregan al cuerpo a medida que llegan de la UART
+  std::string body, err;
+  size_t count = 0;
+  int complete = 0;
+  auto rc = inst->repl_.run(ReplPriority::META, "fs.tree", [&]() {
+    return inst->board_.walkTree(path, depth, glob, (size_t)limit, [&](const PyBoard::FileInfo& e) {
+      body += e.isDirectory ? "d\t" : "f\t";
+      body += std::to_string(e.size);
+      body += '\t';
+      body += e.name;
+      body += '\n';
+      ++count;
+      return !inst->repl_.cancelRequested();
+    }, &complete);
+  }, &err);
+  if (rc != PyBoard::ErrorCode::OK) {
+    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"") + esc(err) + "\"}");
+    return ESP_OK;
+  }
+
+  const std::string countStr = std::to_string(count), completeStr = std::to_string(complete);
+  httpd_resp_set_type(req, "text/tab-separated-values; charset=utf-8");
+  httpd_resp_set_hdr(req, "X-Tree-Count", countStr.c_str());
+  httpd_resp_set_hdr(req, "X-Tree-Complete", completeStr.c_str());
+  httpd_resp_send(req, body.data(), body.size());
+  return ESP_OK;
+}
+
+// ---------------- batch (varias operaciones en un viaje) ----------------
+
+// POST /api/batch?stop=1   cuerpo TSV, una operación por línea:
+//   stat|mkdir|delete <TAB> ruta
+//   rename <TAB> origen <TAB> destino
+//   write <TAB> ruta <TAB> contenido en base64
+//   exec <TAB> <TAB> código en base64
+// stop=1 (por defecto) corta en la primera que falla; stop=0 sigue. Respuesta:
+// {"ok":true,"complete":bool,"failed":N,"results":[{"op":..,"ok":..},...]}
+// (las que no llegaron a correr van con "skipped":true).
+esp_err_t FSService::batchHandler(httpd_req_t* req) {
+  auto* inst = FSService::self(); if (!inst) return ESP_FAIL;
+
+  int stop = 1; (void) inst->queryParamInt(req, "stop", stop);
+
+  int len = req->content_len;
+  if (len <= 0 || (size_t)len > BATCH_MAX_BODY) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid body size");
+    return ESP_OK;
+  }
+  std::string body;
+  if (!recvBody(req, body)) return ESP_OK;
+
+  using Kind = PyBoard::BatchOp::Kind;
+  static const struct { const char* name; Kind kind; int fields; } OPS[] = {
+    {"stat", Kind::STAT, 2}, {"mkdir", Kind::MKDIR, 2}, {"delete", Kind::DELETE, 2},
+    {"rename", Kind::RENAME, 3}, {"write", Kind::WRITE, 3}, {"exec", Kind::EXEC, 3},
+  };
+  std::vector<PyBoard::BatchOp> ops;
+  std::vector<const char*> names;
+  for (size_t pos = 0; pos < body.size();) {
+    size_t nl = body.find('\n', pos);
+    if (nl == std::string::npos) nl = body.size();
+    std::string line = body.substr(pos, nl - pos);
+    pos = nl + 1;
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty()) continue;
+
+    // op <TAB> ruta [<TAB> argumento (resto de la línea)]
+    std::string f[3];
+    int n = 1;
+    const size_t t1 = line.find('\t');
+    f[0] = line.substr(0, t1);
+    if (t1 != std::string::npos) {
+      const size_t t2 = line.find('\t', t1 + 1);
+      f[1] = line.substr(t1 + 1, t2 == std::string::npos ? std::string::npos : t2 - t1 - 1);
+      n = 2;
+      if (t2 != std::string::npos) { f[2] = line.substr(t2 + 1); n = 3; }
+    }
+    size_t k = 0;
+    while (k < sizeof(OPS)/sizeof(OPS[0]) && f[0] != OPS[k].name) ++k;
+    if (k == sizeof(OPS)/sizeof(OPS[0]) || n != OPS[k].fields ||
+        (OPS[k].kind != Kind::EXEC && f[1].empty())) {
+      inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"bad op: ") + esc(line.substr(0, 64)) + "\"}");
       return ESP_OK;
     }
-  } else {
-    // Sin cuerpo: crear archivo vacío
-    std::vector<uint8_t> empty;
-    auto rc = inst->board_.writeFileRaw(path, empty);
-    if (rc != PyBoard::ErrorCode::OK) {
-      inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"") + esc(inst->board_.getLastError()) + "\"}");
+    if (ops.size() == BATCH_MAX_OPS) {
+      inst->sendJSON(req, "{\"ok\":false,\"error\":\"too many ops\"}");
       return ESP_OK;
     }
+    PyBoard::BatchOp op;
+    op.kind = OPS[k].kind;
+    op.path = f[1];
+    if (op.kind == Kind::EXEC) {
+      std::vector<uint8_t> code = PyBoard::PyBoardUART::base64Decode(f[2]);
+      op.arg.assign(code.begin(), code.end());
+    } else {
+      op.arg = f[2]; // destino de rename, o base64 de write (la placa lo decodifica)
+    }
+    ops.push_back(std::move(op));
+    names.push_back(OPS[k].name);
+  }
+  if (ops.empty()) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "empty batch");
+    return ESP_OK;
   }
 
-  inst->sendJSON(req, std::string("{\"ok\":true,\"path\":\"") + esc(path) + "\"}");
+  std::vector<PyBoard::BatchResult> results;
+  std::string err;
+  auto rc = inst->repl_.run(ReplPriority::META, "batch", [&]() {
+    return inst->board_.runBatch(ops, stop != 0, results, BATCH_TIMEOUT_MS);
+  }, &err);
+  if (rc != PyBoard::ErrorCode::OK) {
+    inst->sendJSON(req, std::string("{\"ok\":false,\"error\":\"") + esc(err) + "\"}");
+    return ESP_OK;
+  }
+
+  std::string json = "{\"ok\":true,\"results\":[";
+  size_t failed = 0;
+  bool complete = true;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& r = results[i];
+    if (i) json += ',';
+    json += std::string("{\"op\":\"") + names[i] + "\"";
+    if (!r.ran) {
+      json += ",\"skipped\":true}";
+      complete = false;
+      continue;
+    }
+    json += r.ok ? ",\"ok\":true" : ",\"ok\":false";
+    if (!r.ok) { json += ",\"error\":\"" + esc(r.error) + "\""; ++failed; }
+    if (r.ok && ops[i].kind == Kind::STAT) {
+      json += std::string(",\"dir\":") + (r.info.isDirectory ? "true" : "false") +
+              ",\"size\":" + std::to_string(r.info.size);
+    }
+    if (!r.output.empty()) json += ",\"out\":\"" + esc(r.output) + "\"";
+    json += '}';
+  }
+  json += std::string("],\"complete\":") + (complete ? "true" : "false") +
+          ",\"failed\":" + std::to_string(failed) + "}";
+  inst->sendJSON(req, json);
   return ESP_OK;
 }
 
@@ -569,22 +921,34 @@ void FSService::registerRoutes() {
     .uri="/api/fs/upload", .method=HTTP_POST, .handler=FSService::uploadHandler, .user_ctx=nullptr,
     .is_websocket=false, .handle_ws_control_frames=false, .supported_subprotocol=nullptr
   };
+  httpd_uri_t tree = {
+    .uri="/api/fs/tree", .method=HTTP_GET, .handler=FSService::treeHandler, .user_ctx=nullptr,
+    .is_websocket=false, .handle_ws_control_frames=false, .supported_subprotocol=nullptr
+  };
+  httpd_uri_t batch = {
+    .uri="/api/batch", .method=HTTP_POST, .handler=FSService::batchHandler, .user_ctx=nullptr,
+    .is_websocket=false, .handle_ws_control_frames=false, .supported_subprotocol=nullptr
+  };
   httpd_uri_t create = {
     .uri="/api/fs/create", .method=HTTP_POST, .handler=FSService::createHandler, .user_ctx=nullptr,
     .is_websocket=false, .handle_ws_control_frames=false, .supported_subprotocol=nullptr
   };
 
-  server_.registerHttpHandler(list);
-  server_.registerHttpHandler(read);
-  server_.registerHttpHandler(write);
-
-  server_.registerHttpHandler(exists);
-  server_.registerHttpHandler(info);
-  server_.registerHttpHandler(del);
-  server_.registerHttpHandler(mkdir);
-  server_.registerHttpHandler(rmdir);
-  server_.registerHttpHandler(rename);
-  server_.registerHttpHandler(download);
-  server_.registerHttpHandler(upload);
-  server_.registerHttpHandler(create);
+  // Todas esperan a la tarea del REPL: van al pool async para que la página
+  // y los estáticos sigan respondiendo durante una transferencia
+  server_.registerAsyncHandler(list, 2);
+  server_.registerAsyncHandler(read, 1);
+  server_.registerAsyncHandler(write, 1);
+
+  server_.registerAsyncHandler(exists, 2);
+  server_.registerAsyncHandler(info, 2);
+  server_.registerAsyncHandler(del, 1);
+  server_.registerAsyncHandler(mkdir, 1);
+  server_.registerAsyncHandler(rmdir, 1);
+  server_.registerAsyncHandler(rename, 1);
+  server_.registerAsyncHandler(download, 1);
+  server_.registerAsyncHandler(upload, 1);
+  server_.registerAsyncHandler(create, 1);
+  server_.registerAsyncHandler(tree, 2);
+  server_.registerAsyncHandler(batch, 1);
 }
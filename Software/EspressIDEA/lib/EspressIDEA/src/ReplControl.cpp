@@ -2,127 +2,264 @@
 #include "PyBoardUART.hpp"
 #include "ServerManager.hpp"
 #include "esp_log.h"
+#include "esp_timer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
 
 using namespace EspressIDEA;
 static const char* TAG = "ReplControl";
 
 ReplControl::ReplControl() {
-  mutex_ = xSemaphoreCreateMutex();
+  for (auto& q : queues_) q = xQueueCreate(kQueueDepth, sizeof(Job*));
+  pending_ = xSemaphoreCreateCounting(kQueueDepth * kReplPriorities, 0);
 }
 
 ReplControl::~ReplControl() {
-  if (mutex_) vSemaphoreDelete(mutex_);
+  if (task_) vTaskDelete(task_);
+  for (auto& q : queues_) if (q) vQueueDelete(q);
+  if (pending_) vSemaphoreDelete(pending_);
 }
 
 void ReplControl::init(PyBoard::PyBoardUART* board, ServerManager* server) {
   board_ = board;
   server_ = server;
   mode_ = ReplMode::TERMINAL;
-  heldByTerminal_ = false;
   // Por defecto asumimos CircuitPython; puedes desactivarlo con setCircuitPython(false)
   // si detectas MicroPython en tu banner inicial.
-}
 
-void ReplControl::setModeTerminal() {
-  // Cambio explícito a TERMINAL (usado al abrir WS, etc.)
-  mode_ = ReplMode::TERMINAL;
+  // Única tarea que toca la placa: los handlers HTTP y el WS solo encolan
+  if (!task_ && xTaskCreate(actorTask, "repl_actor", 8192, this, 6, &task_) != pdPASS) {
+    task_ = nullptr;
+    ESP_LOGE(TAG, "no se pudo crear la tarea del REPL");
+  }
 }
 
-// ---------------- Arbitraje con TerminalWS -----------------
+// ---------------- Cola de trabajos -----------------
 
-bool ReplControl::tryLockFromTerminal() {
-  // TerminalWS llama esto antes de leer del UART; si el REPL está CONTROLADO,
-  // no debe leer (devuelve false). Si está libre, marca que lo tiene.
-  if (mode_ != ReplMode::TERMINAL) return false;
-  if (heldByTerminal_) return true; // ya "lo tenía" en este hilo de lectura
-  // No usamos un mutex "largo" aquí para no bloquear la ISR/lector;
-  // bastan flags coherentes con el modo.
-  heldByTerminal_ = true;
+bool ReplControl::enqueue(Job* job, TickType_t wait) {
+  QueueHandle_t q = queues_[static_cast<size_t>(job->prio)];
+  if (!q || !pending_ || !task_) return false;
+  job->enqueuedUs = (uint64_t)esp_timer_get_time();
+  if (xQueueSend(q, &job, wait) != pdTRUE) return false;
+  xSemaphoreGive(pending_);
   return true;
 }
 
-void ReplControl::unlockFromTerminal() {
-  heldByTerminal_ = false;
+PyBoard::ErrorCode ReplControl::run(ReplPriority prio, const char* tag, ReplJob job, std::string* err) {
+  // Desde un trabajo (p.ej. ensureIdle dentro de otro): correr en línea
+  if (xTaskGetCurrentTaskHandle() == task_) {
+    auto rc = job();
+    if (err && rc != PyBoard::ErrorCode::OK) *err = board_->getLastError();
+    return rc;
+  }
+
+  Job j{prio, tag, std::move(job), nullptr, 0, xSemaphoreCreateBinary(), PyBoard::ErrorCode::OK, {}};
+  if (!j.finished) {
+    if (err) *err = "no memory";
+    return PyBoard::ErrorCode::MEMORY_ERROR;
+  }
+  if (!enqueue(&j, portMAX_DELAY)) {
+    vSemaphoreDelete(j.finished);
+    if (err) *err = "repl queue unavailable";
+    return PyBoard::ErrorCode::UART_ERROR;
+  }
+  xSemaphoreTake(j.finished, portMAX_DELAY);
+  vSemaphoreDelete(j.finished);
+  if (err) *err = j.err;
+  return j.rc;
 }
 
-void ReplControl::forceControlled() {
-  // Adquiere mutex y cambia a CONTROLADO (los lectores TerminalWS verán el flag)
-  if (mutex_) xSemaphoreTake(mutex_, portMAX_DELAY);
-  mode_ = ReplMode::CONTROLADO;
+bool ReplControl::post(ReplPriority prio, const char* tag, ReplJob job, ReplDone done) {
+  Job* j = new (std::nothrow) Job{prio, tag, std::move(job), std::move(done), 0, nullptr,
+                                  PyBoard::ErrorCode::OK, {}};
+  if (!j) return false;
+  if (!enqueue(j, 0)) {
+    ESP_LOGW(TAG, "cola %u llena, descartado %s", (unsigned)prio, tag ? tag : "?");
+    delete j;
+    return false;
+  }
+  return true;
 }
 
-void ReplControl::releaseControlled() {
-  mode_ = ReplMode::TERMINAL;
-  if (mutex_) xSemaphoreGive(mutex_);
+// Siguiente trabajo por prioridad estricta
+ReplControl::Job* ReplControl::nextJob() {
+  Job* j = nullptr;
+  for (auto q : queues_) {
+    if (xQueueReceive(q, &j, 0) == pdTRUE) return j;
+  }
+  return nullptr;
 }
 
-// ---------------- Sincronización de REPL -----------------
+void ReplControl::execute(Job* job) {
+  const uint64_t t0 = (uint64_t)esp_timer_get_time();
+  const uint32_t waitUs = (uint32_t)(t0 - job->enqueuedUs);
+
+  // Los trabajos sin tag son del propio terminal (teclas, sink): no cuentan
+  // como operación CONTROLADA
+  const bool controlled = job->tag != nullptr;
+  if (controlled) { cancel_ = false; mode_ = ReplMode::CONTROLADO; }
+  job->rc = job->fn();
+  if (controlled) mode_ = ReplMode::TERMINAL;
+  if (job->rc != PyBoard::ErrorCode::OK) job->err = board_->getLastError();
+
+  const uint32_t runUs = (uint32_t)((uint64_t)esp_timer_get_time() - t0);
+  {
+    auto& s = stats_[static_cast<size_t>(job->prio)];
+    portENTER_CRITICAL(&statsMux_);
+    s.jobs++;
+    s.waitUsTotal += waitUs;
+    s.waitUsMax = std::max(s.waitUsMax, waitUs);
+    s.runUsMax = std::max(s.runUsMax, runUs);
+    portEXIT_CRITICAL(&statsMux_);
+  }
+  if (controlled) {
+    ESP_LOGI(TAG, "%s: cola %u ms, corrida %u ms", job->tag,
+             (unsigned)(waitUs / 1000), (unsigned)(runUs / 1000));
+  }
 
-bool ReplControl::ensureIdle(uint32_t timeout_ms) {
-  if (circuitpython_) {
-    return ensureIdleCircuitPython(timeout_ms);
+  if (job->finished) {
+    xSemaphoreGive(job->finished); // run(): el Job vive en la pila del que espera
+  } else {
+    if (job->done) job->done(job->rc, job->err);
+    delete job;
   }
-  // Si en el futuro usas MicroPython (raw REPL), aquí podrías:
-  //  - enviar ^C, entrar raw, etc.
-  // Por ahora: comportamiento similar a CP sin raw.
-  return ensureIdleCircuitPython(timeout_ms);
 }
 
-bool ReplControl::ensureIdleCircuitPython(uint32_t timeout_ms) {
-  if (!board_) return false;
+void ReplControl::actorTask(void* arg) {
+  auto* self = static_cast<ReplControl*>(arg);
+  uint8_t buf[kIdleReadSize];
 
-  // Entramos en CONTROLADO para no interferir con TerminalWS.
-  forceControlled();
+  ESP_LOGI(TAG, "tarea del REPL iniciada");
+  for (;;) {
+    // Sin terminal conectado no hay nada que bombear: dormir hasta un trabajo
+    TickType_t wait = self->sink_ ? 0 : portMAX_DELAY;
+    if (xSemaphoreTake(self->pending_, wait) == pdTRUE) {
+      if (Job* j = self->nextJob()) self->execute(j);
+      continue;
+    }
 
-  // Secuencia "tipo Thonny":
-  // 1) ^C para interrumpir code.py si está corriendo
-  board_->interrupt();
-  vTaskDelay(pdMS_TO_TICKS(200));
+    // Ocioso: la salida de la placa va al terminal
+    size_t n = self->board_ ? self->board_->read(buf, sizeof(buf), kIdleReadMs) : 0;
+    if (n > 0 && self->sink_) self->sink_(buf, n);
+  }
+}
 
-  // 2) ^D para soft reset (CircuitPython reinicia y mostrará banner)
-  //    Nota: aquí NO queremos raw REPL. Esto solo reinicia CP.
-  board_->softReset();
-  vTaskDelay(pdMS_TO_TICKS(200));
+ReplQueueStats ReplControl::stats(ReplPriority prio) const {
+  portENTER_CRITICAL(&statsMux_);
+  ReplQueueStats s = stats_[static_cast<size_t>(prio)];
+  portEXIT_CRITICAL(&statsMux_);
+  return s;
+}
 
-  // 3) Si tenemos callback de espera del prompt, lo usamos:
-  bool ok = true;
-  if (waitPromptFn_) {
-    ok = waitPromptFn_(timeout_ms);
-  } else {
-    // Fallback: esperamos un poco y mandamos ENTER para "activar" el prompt
-    // (No podemos leer UART desde aquí porque PyBoardUART no expone read en público)
-    const TickType_t total = pdMS_TO_TICKS(timeout_ms);
-    const TickType_t step  = pdMS_TO_TICKS(50);
-    TickType_t acc = 0;
-    while (acc < total) { vTaskDelay(step); acc += step; }
-    // "Tocar" el REPL para que pinte el prompt
-    const char crlf[] = "\r\n";
-    (void) board_->write(crlf, sizeof(crlf)-1);
+size_t ReplControl::pending(ReplPriority prio) const {
+  QueueHandle_t q = queues_[static_cast<size_t>(prio)];
+  return q ? (size_t)uxQueueMessagesWaiting(q) : 0;
+}
+
+// ---------------- Terminal -----------------
+
+void ReplControl::setTerminalSink(TerminalSink sink) {
+  // El sink se asigna dentro de la tarea para no competir con actorTask
+  (void) post(ReplPriority::INTERACTIVE, nullptr, [this, sink]() {
+    sink_ = sink;
+    if (sink_) leaveRawRepl();
+    return PyBoard::ErrorCode::OK;
+  });
+}
+
+bool ReplControl::terminalInput(const uint8_t* data, size_t len) {
+  if (!data || len == 0) return false;
+  if (mode_ == ReplMode::CONTROLADO && std::memchr(data, 0x03, len)) {
+    ESP_LOGW(TAG, "^C del terminal: cancelando operación en curso");
+    requestCancel();
   }
+  std::string bytes(reinterpret_cast<const char*>(data), len);
+  return post(ReplPriority::INTERACTIVE, nullptr, [this, bytes]() {
+    leaveRawRepl();
+    return board_->write(bytes.data(), bytes.size());
+  });
+}
+
+// El motor raw deja la placa en el raw REPL entre operaciones (sin eco ni
+// prompt): el usuario del terminal espera '>>>'
+void ReplControl::leaveRawRepl() {
+  if (board_ && board_->isInRawRepl()) (void) board_->exitRawRepl();
+}
 
-  // 4) Cortesía: otro ^C suave por si el usuario tenía auto-reload o mensajes residuales
-  vTaskDelay(pdMS_TO_TICKS(120));
-  board_->interrupt();
+// ---------------- Sincronización de REPL -----------------
 
-  // Salimos a TERMINAL
-  releaseControlled();
+bool ReplControl::ensureIdle(uint32_t timeout_ms, bool hard, PyBoard::IdleLevel* level) {
+  if (hard) {
+    const bool ok = ensureIdleHard(timeout_ms);
+    if (ok && level) *level = PyBoard::IdleLevel::RESET;
+    return ok;
+  }
+  if (!board_) return false;
 
-  ESP_LOGI(TAG, "ensureIdleCircuitPython: %s", ok ? "OK" : "timeout (fallback usado)");
+  // Tibio: no cancela la operación en curso; corre cuando termine. El sondeo
+  // es igual en CircuitPython y MicroPython (CR, ^C, ^D).
+  bool ok = false;
+  PyBoard::IdleLevel lv = PyBoard::IdleLevel::NONE;
+  (void) run(ReplPriority::INTERACTIVE, "ensure_idle", [&]() {
+    const uint64_t t0 = (uint64_t)esp_timer_get_time();
+    ok = board_->ensureIdle(timeout_ms, /*allowReset*/ true, &lv) == PyBoard::ErrorCode::OK;
+    ESP_LOGI(TAG, "ensureIdle: %s, nivel %u en %u ms", ok ? "OK" : "timeout", (unsigned)lv,
+             (unsigned)(((uint64_t)esp_timer_get_time() - t0) / 1000));
+    return PyBoard::ErrorCode::OK;
+  });
+  if (level) *level = lv;
   return ok;
 }
 
-// ---------------- RAII: ScopedReplLock -----------------
+bool ReplControl::ensureIdleHard(uint32_t timeout_ms) {
+  if (!board_) return false;
+  // STOP: corta la transferencia en curso y pasa delante de la cola
+  requestCancel();
+  bool ok = false;
+  (void) run(ReplPriority::INTERACTIVE, "ensure_idle", [&]() {
+    ok = circuitpython_ ? ensureIdleCircuitPythonNow(timeout_ms)
+                        : ensureIdleMicroPythonNow(timeout_ms);
+    return PyBoard::ErrorCode::OK;
+  });
+  return ok;
+}
 
-ReplControl::ScopedReplLock::ScopedReplLock(ReplControl& rc, const char* tag)
-: rc_(rc), tag_(tag) {
-  rc_.forceControlled();
-  if (tag_) ESP_LOGI("ReplLock", "CONTROLADO on (%s)", tag_);
-  locked_ = true;
+bool ReplControl::ensureIdleCircuitPythonNow(uint32_t timeout_ms) {
+  const uint64_t t0 = (uint64_t)esp_timer_get_time();
+  bool ok;
+  if (waitPromptFn_) {
+    // Esperador externo: ^C + ^D y que él decida cuándo hay prompt
+    board_->interrupt();
+    board_->softReset();
+    ok = waitPromptFn_(timeout_ms);
+  } else {
+    // ^C,^D y se sigue lo que la placa contesta (reinicio, "Press any key",
+    // raw/paste a medias) hasta ver '>>>': tarda lo que tarda el arranque
+    ok = board_->syncRepl(timeout_ms, /*softReset*/ true) == PyBoard::ErrorCode::OK;
+  }
+
+  ESP_LOGI(TAG, "ensureIdleCircuitPython: %s en %u ms", ok ? "OK" : "timeout",
+           (unsigned)(((uint64_t)esp_timer_get_time() - t0) / 1000));
+  return ok;
 }
 
-ReplControl::ScopedReplLock::~ScopedReplLock() {
-  if (locked_) {
-    rc_.releaseControlled();
-    if (tag_) ESP_LOGI("ReplLock", "CONTROLADO off (%s)", tag_);
+bool ReplControl::ensureIdleMicroPythonNow(uint32_t timeout_ms) {
+  const uint64_t t0 = (uint64_t)esp_timer_get_time();
+  // ^C y ^D dentro del raw REPL: MicroPython reinicia sin correr boot.py ni
+  // main.py, así que un main.py que no termina no vuelve a tomar la placa.
+  // Si el raw REPL no responde se cae a la secuencia de CircuitPython.
+  bool ok = board_->enterRawRepl(/*softReset*/ true) == PyBoard::ErrorCode::OK &&
+            board_->exitRawRepl() == PyBoard::ErrorCode::OK &&
+            board_->getReplState() == PyBoard::ReplState::PROMPT;
+  if (!ok) {
+    const uint64_t spent = ((uint64_t)esp_timer_get_time() - t0) / 1000;
+    ok = board_->syncRepl(spent < timeout_ms ? timeout_ms - (uint32_t)spent : 0,
+                          /*softReset*/ true) == PyBoard::ErrorCode::OK;
   }
+
+  ESP_LOGI(TAG, "ensureIdleMicroPython: %s en %u ms", ok ? "OK" : "timeout",
+           (unsigned)(((uint64_t)esp_timer_get_time() - t0) / 1000));
+  return ok;
 }
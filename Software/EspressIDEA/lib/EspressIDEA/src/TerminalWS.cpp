@@ -32,7 +32,6 @@ void TerminalWS::registerRoutes() {
 }
 
 void TerminalWS::startTasksIfNeeded() {
-  if (!tReader_) xTaskCreate(uartReaderTask, "tty_uart_reader", 4096, this, 10, &tReader_);
   if (!tSender_) xTaskCreate(wsSenderTask,   "tty_ws_sender",  4096, this, 10, &tSender_);
 }
 
@@ -46,33 +45,6 @@ bool TerminalWS::queueSendText(const char* s) {
   return s ? queueSend(reinterpret_cast<const uint8_t*>(s), strlen(s)) : false;
 }
 
-// --------- Tarea: UART -> StreamBuffer -----------
-void TerminalWS::uartReaderTask(void* arg) {
-  auto* self = static_cast<TerminalWS*>(arg);
-  std::vector<uint8_t> buf(kReadChunk);
-
-  ESP_LOGI(TAG, "UART reader iniciado");
-  for (;;) {
-    if (!self->active_) { vTaskDelay(pdMS_TO_TICKS(20)); continue; }
-
-    // Solo en modo TERMINAL y sin bloquear si hay CONTROLADO
-    if (self->repl_.mode() != ReplMode::TERMINAL ||
-        !self->repl_.tryLockFromTerminal()) {
-      vTaskDelay(pdMS_TO_TICKS(5));
-      continue;
-    }
-
-    int n = uart_read_bytes(kUartNum, buf.data(), buf.size(), self->kReadWait);
-    self->repl_.unlockFromTerminal();
-
-    if (n > 0) {
-      (void) self->queueSend(buf.data(), (size_t)n);
-    } else {
-      vTaskDelay(pdMS_TO_TICKS(5));
-    }
-  }
-}
-
 // --------- Tarea: StreamBuffer -> WS (async + pacing) ----------
 void TerminalWS::wsSenderTask(void* arg) {
   auto* self = static_cast<TerminalWS*>(arg);
@@ -130,8 +102,9 @@ esp_err_t TerminalWS::wsHandler(httpd_req_t* req) {
     self->sockfd_ = sockfd;
     self->active_ = true;
 
-    self->repl_.setModeTerminal();
     self->startTasksIfNeeded();
+    // La tarea del REPL entrega la salida de la placa mientras está ociosa
+    self->repl_.setTerminalSink([self](const uint8_t* d, size_t n) { (void) self->queueSend(d, n); });
 
     // Saludo por el pipeline (se enviará por la tarea de envío)
     self->queueSendText(">> REPL listo (WS conectado)\r\n");
@@ -156,27 +129,25 @@ esp_err_t TerminalWS::wsHandler(httpd_req_t* req) {
   if (frame.type == HTTPD_WS_TYPE_CLOSE) {
     self->active_ = false;
     self->sockfd_ = -1;
+    self->repl_.setTerminalSink(nullptr);
     return ESP_OK;
   }
 
-  // Solo aceptamos entradas en TERMINAL
+  if (payload.empty()) return ESP_OK;
+
+  // Durante una operación CONTROLADA la entrada espera en la cola (un ^C la corta)
   if (self->repl_.mode() != ReplMode::TERMINAL) {
-    // Aquí estamos en hilo del server: podemos responder síncrono
-    const char* busy = "[UART ocupado por operación CONTROLADA]\r\n";
+    const char* busy = "[UART ocupado por operación CONTROLADA; ^C la cancela]\r\n";
     httpd_ws_frame_t f = {};
     f.type = HTTPD_WS_TYPE_TEXT;
     f.payload = (uint8_t*)busy;
     f.len = strlen(busy);
     (void) httpd_ws_send_frame(req, &f);
-    return ESP_OK;
   }
 
-  // Eco hacia UART
-  if (!payload.empty()) {
-    auto err = self->board_.write(payload.data(), payload.size());
-    if (err != PyBoard::ErrorCode::OK) {
-      ESP_LOGW(TAG, "board.write falló: %s", self->board_.getLastError().c_str());
-    }
+  // Eco hacia UART (lo escribe la tarea del REPL)
+  if (!self->repl_.terminalInput(payload.data(), payload.size())) {
+    ESP_LOGW(TAG, "entrada del terminal descartada (cola llena)");
   }
   return ESP_OK;
 }
@@ -0,0 +1,120 @@
+#include "Deflate.hpp"
+#include <algorithm>
+
+namespace PyBoard {
+
+namespace {
+
+// Códigos de largo 257..285 y de distancia 0..29 (RFC 1951, 3.2.5)
+const uint16_t LEN_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                               35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t LEN_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                               3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                6145, 8193, 12289, 16385, 24577};
+const uint8_t DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+inline unsigned hash3(const uint8_t *p, unsigned bits) {
+    const uint32_t v = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+    return (v * 2654435761u) >> (32 - bits);
+}
+
+} // namespace
+
+void Deflater::put(uint32_t value, unsigned n) {
+    bits |= value << nbits;
+    nbits += n;
+    while (nbits >= 8) {
+        dst->push_back(static_cast<uint8_t>(bits));
+        bits >>= 8;
+        nbits -= 8;
+    }
+}
+
+void Deflater::putCode(uint32_t code, unsigned n) {
+    uint32_t r = 0;
+    for (unsigned i = 0; i < n; ++i) r = (r << 1) | ((code >> i) & 1u);
+    put(r, n);
+}
+
+// Tabla fija de literales/largos (RFC 1951, 3.2.6)
+void Deflater::literal(unsigned sym) {
+    if (sym < 144) putCode(0x30 + sym, 8);
+    else if (sym < 256) putCode(0x190 + sym - 144, 9);
+    else if (sym < 280) putCode(sym - 256, 7);
+    else putCode(0xC0 + sym - 280, 8);
+}
+
+void Deflater::match(unsigned len, unsigned dist) {
+    unsigned lc = 28;
+    while (LEN_BASE[lc] > len) --lc;
+    literal(257 + lc);
+    if (LEN_EXTRA[lc]) put(len - LEN_BASE[lc], LEN_EXTRA[lc]);
+
+    unsigned dc = 29;
+    while (DIST_BASE[dc] > dist) --dc;
+    putCode(dc, 5);
+    if (DIST_EXTRA[dc]) put(dist - DIST_BASE[dc], DIST_EXTRA[dc]);
+}
+
+bool Deflater::compress(const uint8_t *in, size_t len, std::vector<uint8_t> &out) {
+    if (len > MAX_INPUT) return false;
+    out.clear();
+    out.reserve(len / 2 + 16);
+    dst = &out;
+    bits = 0;
+    nbits = 0;
+
+    head.assign(1u << HASH_BITS, 0);
+    prev.resize(len);
+
+    put(1, 1); // BFINAL
+    put(1, 2); // BTYPE = 01, Huffman fijo
+
+    auto insert = [&](size_t i) {
+        const unsigned h = hash3(in + i, HASH_BITS);
+        prev[i] = head[h];
+        head[h] = static_cast<uint16_t>(i + 1);
+    };
+
+    size_t i = 0;
+    while (i < len) {
+        unsigned best = 0, bestDist = 0;
+        if (i + MIN_MATCH <= len) {
+            const unsigned limit = (unsigned)std::min<size_t>(MAX_MATCH, len - i);
+            uint16_t cand = head[hash3(in + i, HASH_BITS)];
+            for (unsigned chain = 0; cand && chain < MAX_CHAIN; ++chain) {
+                const size_t j = cand - 1u;
+                if (in[j + best] == in[i + best]) {
+                    unsigned l = 0;
+                    while (l < limit && in[j + l] == in[i + l]) ++l;
+                    if (l > best) {
+                        best = l;
+                        bestDist = (unsigned)(i - j);
+                        if (l == limit) break;
+                    }
+                }
+                cand = prev[j];
+            }
+            insert(i);
+        }
+
+        if (best >= MIN_MATCH) {
+            match(best, bestDist);
+            for (size_t k = i + 1; k < i + best && k + MIN_MATCH <= len; ++k) insert(k);
+            i += best;
+        } else {
+            literal(in[i]);
+            ++i;
+        }
+    }
+
+    literal(256); // fin de bloque
+    if (nbits) out.push_back(static_cast<uint8_t>(bits));
+    dst = nullptr;
+    return true;
+}
+
+} // namespace PyBoard
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace PyBoard
+{
+
+    // Compresor DEFLATE crudo (RFC 1951, sin cabecera zlib) para subir
+    // archivos comprimidos: la placa los abre con deflate.DeflateIO o
+    // zlib/uzlib.decompress(d, -wbits). Cada llamada produce un stream
+    // completo (un bloque final con Huffman fijo) y las distancias no pasan
+    // del largo de la entrada: con entradas de 2^wbits bytes alcanza una
+    // ventana de wbits en la placa.
+    //
+    // Huffman fijo + LZ77 con cadenas cortas: en .py/.json da 2-3x, que es
+    // lo que importa en la UART. El miniz de la ROM pide ~100 KB de estado;
+    // esto usa 8 KB de tabla más 2 bytes por byte de entrada.
+    class Deflater
+    {
+    public:
+        static constexpr size_t MAX_INPUT = 32768; // ventana de DEFLATE
+
+        // Deja en 'out' (reutilizable) el stream comprimido de 'in'.
+        // Devuelve false si len > MAX_INPUT.
+        bool compress(const uint8_t *in, size_t len, std::vector<uint8_t> &out);
+
+    private:
+        static constexpr unsigned HASH_BITS = 12;
+        static constexpr unsigned MAX_CHAIN = 16;  // candidatos por posición
+        static constexpr unsigned MIN_MATCH = 3;
+        static constexpr unsigned MAX_MATCH = 258;
+
+        std::vector<uint16_t> head; // última posición + 1 por hash (0 = vacío)
+        std::vector<uint16_t> prev; // posición anterior + 1 con el mismo hash
+
+        std::vector<uint8_t> *dst = nullptr;
+        uint32_t bits = 0;
+        unsigned nbits = 0;
+        void put(uint32_t value, unsigned n);
+        void putCode(uint32_t code, unsigned n); // Huffman: MSB primero
+        void literal(unsigned sym);
+        void match(unsigned len, unsigned dist);
+    };
+
+} // namespace PyBoard
@@ -0,0 +1,136 @@
+#pragma once
+
+// Shim mínimo para que el protocolo REPL compile igual en ESP-IDF y en Linux
+// (pruebas de carga contra el port unix de MicroPython, ver PosixTransport).
+
+#include <cstdint>
+#include <cstddef>
+
+#ifdef ESP_PLATFORM
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "esp_rom_crc.h"
+#include "mbedtls/sha256.h"
+
+namespace PyBoard
+{
+    inline uint64_t nowUs() { return (uint64_t)esp_timer_get_time(); }
+
+    // Redondea hacia arriba: con HZ=100, pdMS_TO_TICKS(5) daría 0 ticks
+    inline TickType_t msToTicks(uint32_t ms)
+    {
+        if (ms == 0) return 0;
+        TickType_t t = (TickType_t)((ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+        return t ? t : 1;
+    }
+
+    inline void sleepMs(uint32_t ms) { vTaskDelay(msToTicks(ms)); }
+    inline void delayUs(uint32_t us) { esp_rom_delay_us(us); }
+
+    // CRC-32 (IEEE, igual a zlib/binascii.crc32); encadenable: crc32(crc32(0,a),b)
+    inline uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len)
+    {
+        return esp_rom_crc32_le(crc, data, (uint32_t)len);
+    }
+
+    // SHA-256 (igual a hashlib.sha256 de la placa)
+    inline void sha256(const uint8_t *data, size_t len, uint8_t out[32])
+    {
+        mbedtls_sha256(data, len, out, 0);
+    }
+} // namespace PyBoard
+
+#else
+
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+
+namespace PyBoard
+{
+    inline uint64_t nowUs()
+    {
+        using namespace std::chrono;
+        return (uint64_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+    inline void sleepMs(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+    inline void delayUs(uint32_t us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+
+    inline uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len)
+    {
+        static const struct Table {
+            uint32_t v[256];
+            Table() {
+                for (uint32_t i = 0; i < 256; ++i) {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    v[i] = c;
+                }
+            }
+        } table;
+        crc = ~crc;
+        for (size_t i = 0; i < len; ++i) crc = table.v[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    inline void sha256(const uint8_t *data, size_t len, uint8_t out[32])
+    {
+        static const uint32_t K[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                         0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        auto rotr = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+        auto block = [&](const uint8_t *b) {
+            uint32_t w[64];
+            for (int t = 0; t < 16; ++t)
+                w[t] = (uint32_t)b[4 * t] << 24 | (uint32_t)b[4 * t + 1] << 16 | (uint32_t)b[4 * t + 2] << 8 | b[4 * t + 3];
+            for (int t = 16; t < 64; ++t)
+                w[t] = w[t - 16] + (rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3)) + w[t - 7] +
+                       (rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10));
+            uint32_t v[8];
+            std::memcpy(v, h, sizeof(v));
+            for (int t = 0; t < 64; ++t) {
+                uint32_t t1 = v[7] + (rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25)) +
+                              ((v[4] & v[5]) ^ (~v[4] & v[6])) + K[t] + w[t];
+                uint32_t t2 = (rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22)) +
+                              ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+                std::memmove(v + 1, v, 7 * sizeof(uint32_t));
+                v[4] += t1;
+                v[0] = t1 + t2;
+            }
+            for (int i = 0; i < 8; ++i) h[i] += v[i];
+        };
+
+        size_t i = 0;
+        for (; i + 64 <= len; i += 64) block(data + i);
+        uint8_t tail[128] = {};
+        const size_t r = len - i, tl = r < 56 ? 64 : 128;
+        std::memcpy(tail, data + i, r);
+        tail[r] = 0x80;
+        for (int k = 0; k < 8; ++k) tail[tl - 1 - k] = (uint8_t)(((uint64_t)len * 8) >> (8 * k));
+        block(tail);
+        if (tl == 128) block(tail + 64);
+        for (int k = 0; k < 32; ++k) out[k] = (uint8_t)(h[k / 4] >> (24 - 8 * (k % 4)));
+    }
+} // namespace PyBoard
+
+#ifndef ESP_LOGI
+#define ESP_LOGE(tag, fmt, ...) std::fprintf(stderr, "E (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) std::fprintf(stderr, "W (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) std::fprintf(stderr, "I (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef ESP_PLATFORM
+
+#include "PosixTransport.hpp"
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <netdb.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace PyBoard {
+
+// ============================================================================
+// FdTransport
+// ============================================================================
+int FdTransport::write(const void *data, size_t len) {
+    if (fd < 0) return -1;
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = ::write(fd, p + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                struct pollfd pfd = {fd, POLLOUT, 0};
+                (void)::poll(&pfd, 1, 100);
+                continue;
+            }
+            lastError = std::strerror(errno);
+            return -1;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return static_cast<int>(done);
+}
+
+size_t FdTransport::readRaw(uint8_t *buf, size_t max, uint32_t timeoutMs) {
+    if (fd < 0) return 0;
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int r = ::poll(&pfd, 1, static_cast<int>(timeoutMs));
+    if (r <= 0 || !(pfd.revents & POLLIN)) return 0;
+    ssize_t n = ::read(fd, buf, max);
+    return n > 0 ? static_cast<size_t>(n) : 0;
+}
+
+size_t FdTransport::availableRaw() const {
+    int n = 0;
+    if (fd < 0 || ::ioctl(fd, FIONREAD, &n) < 0) return 0;
+    return n > 0 ? static_cast<size_t>(n) : 0;
+}
+
+void FdTransport::flushRaw() {
+    uint8_t buf[256];
+    while (readRaw(buf, sizeof(buf), 0) > 0) {}
+}
+
+void FdTransport::closeFd() {
+    if (fd >= 0) { ::close(fd); fd = -1; }
+}
+
+// ============================================================================
+// PtyTransport
+// ============================================================================
+bool PtyTransport::open() {
+    if (fd >= 0) return true;
+    if (argv.empty()) { lastError = "PtyTransport: empty command"; return false; }
+
+    int master = ::posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || ::grantpt(master) < 0 || ::unlockpt(master) < 0) {
+        lastError = std::string("posix_openpt: ") + std::strerror(errno);
+        if (master >= 0) ::close(master);
+        return false;
+    }
+    const char *slaveName = ::ptsname(master);
+
+    child = ::fork();
+    if (child < 0) {
+        lastError = std::string("fork: ") + std::strerror(errno);
+        ::close(master);
+        return false;
+    }
+    if (child == 0) {
+        ::setsid();
+        int slave = ::open(slaveName, O_RDWR);
+        if (slave < 0) ::_exit(127);
+        // Sin traducción CR/LF ni eco del tty: bytes crudos como en la UART
+        struct termios tio;
+        if (::tcgetattr(slave, &tio) == 0) { ::cfmakeraw(&tio); ::tcsetattr(slave, TCSANOW, &tio); }
+        ::dup2(slave, 0); ::dup2(slave, 1); ::dup2(slave, 2);
+        if (slave > 2) ::close(slave);
+        ::close(master);
+
+        std::vector<char *> args;
+        for (auto &a : argv) args.push_back(const_cast<char *>(a.c_str()));
+        args.push_back(nullptr);
+        ::execvp(args[0], args.data());
+        ::_exit(127);
+    }
+
+    fd = master;
+    return true;
+}
+
+void PtyTransport::close() {
+    closeFd();
+    if (child > 0) {
+        ::kill(child, SIGTERM);
+        ::waitpid(child, nullptr, 0);
+        child = -1;
+    }
+}
+
+// ============================================================================
+// TcpTransport
+// ============================================================================
+bool TcpTransport::open() {
+    if (fd >= 0) return true;
+
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *res = nullptr;
+    const std::string portStr = std::to_string(port);
+    int rc = ::getaddrinfo(host.c_str(), portStr.c_str(), &hints, &res);
+    if (rc != 0) {
+        lastError = std::string("getaddrinfo: ") + ::gai_strerror(rc);
+        return false;
+    }
+
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        int s = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s < 0) continue;
+        if (::connect(s, ai->ai_addr, ai->ai_addrlen) == 0) { fd = s; break; }
+        ::close(s);
+    }
+    ::freeaddrinfo(res);
+
+    if (fd < 0) {
+        lastError = "connect " + host + ":" + portStr + ": " + std::strerror(errno);
+        return false;
+    }
+    // Las tramas de control son de 1-3 bytes: sin Nagle
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return true;
+}
+
+} // namespace PyBoard
+
+#endif // !ESP_PLATFORM
@@ -0,0 +1,67 @@
+#pragma once
+
+#ifndef ESP_PLATFORM
+
+#include "Transport.hpp"
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+namespace PyBoard
+{
+
+    // Base para transportes sobre un descriptor POSIX (poll + read/write)
+    class FdTransport : public Transport
+    {
+    public:
+        ~FdTransport() override { closeFd(); }
+
+        bool isOpen() const override { return fd >= 0; }
+        int write(const void *data, size_t len) override;
+
+    protected:
+        size_t readRaw(uint8_t *buf, size_t max, uint32_t timeoutMs) override;
+        size_t availableRaw() const override;
+        void flushRaw() override;
+        void closeFd();
+
+        int fd = -1;
+    };
+
+    // Lanza un intérprete (p.ej. el port unix de MicroPython) sobre un pty:
+    //   PtyTransport({"micropython"})
+    // El REPL del port unix habla el mismo protocolo que la placa (^A/^B/^D/^E).
+    class PtyTransport : public FdTransport
+    {
+    public:
+        explicit PtyTransport(std::vector<std::string> argv) : argv(std::move(argv)) {}
+        ~PtyTransport() override { close(); }
+
+        bool open() override;
+        void close() override;
+        const char *name() const override { return "pty"; }
+
+    private:
+        std::vector<std::string> argv;
+        pid_t child = -1;
+    };
+
+    // Conexión TCP a un REPL expuesto por socket (WebREPL crudo, socat, ser2net...)
+    class TcpTransport : public FdTransport
+    {
+    public:
+        TcpTransport(std::string host, uint16_t port) : host(std::move(host)), port(port) {}
+        ~TcpTransport() override { close(); }
+
+        bool open() override;
+        void close() override { closeFd(); }
+        const char *name() const override { return "tcp"; }
+
+    private:
+        std::string host;
+        uint16_t port;
+    };
+
+} // namespace PyBoard
+
+#endif // !ESP_PLATFORM
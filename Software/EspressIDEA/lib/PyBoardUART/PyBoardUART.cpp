@@ -1,4 +1,9 @@
 #include "PyBoardUART.hpp"
+#include "Platform.hpp"
+#include "PyTemplates.hpp"
+#ifdef ESP_PLATFORM
+#include "UartTransport.hpp"
+#endif
 #include <cstring>
 #include <algorithm>
 #include <sstream>
@@ -6,10 +11,6 @@
 #include <cstdio>
 #include <cctype>
 
-#include "esp_log.h"
-#include "esp_system.h"
-#include "esp_timer.h"
-#include "esp_rom_sys.h"  // esp_rom_delay_us()
 
 static const char *TAG = "PyBoardUART";
 
@@ -18,18 +19,6 @@ static const char *TAG = "PyBoardUART";
 // ============================================================================
 namespace {
 
-// Quota segura para literales Python: ' -> \'
-static std::string pyQuote(const std::string& s) {
-    std::string out; out.reserve(s.size()+2);
-    out.push_back('\'');
-    for (char c: s) {
-        if (c=='\'') out += "\\'";
-        else out.push_back(c);
-    }
-    out.push_back('\'');
-    return out;
-}
-
 static inline void stripCR(std::string &s) {
     s.erase(std::remove(s.begin(), s.end(), '\r'), s.end());
 }
@@ -83,82 +72,55 @@ static void stripPasteArtifacts(std::string &raw) {
     raw.swap(out);
 }
 
-// Espera un substring en UART con timeout
-static PyBoard::ErrorCode waitForSubstring(uart_port_t u, const char* needle, uint32_t timeoutMs) {
-    using namespace PyBoard;
-    const uint64_t deadline = (uint64_t)esp_timer_get_time() + (uint64_t)timeoutMs * 1000ULL;
-    std::string acc; acc.reserve(512);
-    uint8_t buf[128];
-    while ((uint64_t)esp_timer_get_time() < deadline) {
-        int n = uart_read_bytes(u, buf, sizeof(buf), pdMS_TO_TICKS(30));
-        if (n > 0) {
-            acc.append(reinterpret_cast<const char*>(buf), n);
-            if (acc.find(needle) != std::string::npos) return ErrorCode::OK;
-            if (acc.size() > 4096) acc.erase(0, acc.size() - 1024);
-        }
-        vTaskDelay(pdMS_TO_TICKS(5));
-    }
-    return ErrorCode::TIMEOUT;
+// Salida del raw REPL con la misma forma que la de paste mode
+static void stripRawOutput(std::string &raw) {
+    stripCR(raw);
+    while (!raw.empty() && raw.back() == '\n') raw.pop_back();
 }
 
 // Asegura estar en prompt >>> (maneja “Press any key...”)
-static PyBoard::ErrorCode ensureAtPrompt(uart_port_t u, uint32_t timeoutMs = 1500) {
+static PyBoard::ErrorCode ensureAtPrompt(PyBoard::Transport& io, uint32_t timeoutMs = 1500) {
     using namespace PyBoard;
-    const uint64_t deadline = (uint64_t)esp_timer_get_time() + (uint64_t)timeoutMs * 1000ULL;
+    const uint64_t deadline = nowUs() + (uint64_t)timeoutMs * 1000ULL;
 
     const char CR = '\r';
-    uart_flush_input(u);
-    (void)uart_write_bytes(u, &CR, 1);
-
-    std::string acc; acc.reserve(512);
-    uint8_t buf[128];
-    bool pressedAnyKey = false;
-
-    while ((uint64_t)esp_timer_get_time() < deadline) {
-        int n = uart_read_bytes(u, buf, sizeof(buf), pdMS_TO_TICKS(40));
-        if (n > 0) {
-            acc.append(reinterpret_cast<const char*>(buf), n);
-
-            if (!pressedAnyKey &&
-                (acc.find("Press any key to enter the REPL") != std::string::npos ||
-                 acc.find("Press any key to enter the REPL.") != std::string::npos)) {
-                (void)uart_write_bytes(u, &CR, 1);
-                pressedAnyKey = true;
-            }
+    io.flush();
+    (void)io.write(&CR, 1);
 
-            if (acc.find(">>>") != std::string::npos) return ErrorCode::OK;
+    NeedleMatcher m;
+    const uint32_t PROMPT = m.add(">>>");
+    const uint32_t ANYKEY = m.add("Press any key to enter the REPL");
+    std::string acc;
 
-            if (acc.size() > 4096) acc.erase(0, acc.size() - 1024);
-        }
-        vTaskDelay(pdMS_TO_TICKS(10));
+    for (;;) {
+        uint64_t now = nowUs();
+        if (now >= deadline) return ErrorCode::TIMEOUT;
+        uint32_t hit = io.readUntil(m, acc, (uint32_t)((deadline - now) / 1000ULL), 1024);
+        if (hit & PROMPT) return ErrorCode::OK;
+        if (hit & ANYKEY) (void)io.write(&CR, 1);
+        if (!hit) return ErrorCode::TIMEOUT;
     }
-    return ErrorCode::TIMEOUT;
 }
 
-// Entra a paste mode (^E) y verifica banner ("paste mode" o "=== ")
-static PyBoard::ErrorCode enterPasteMode(uart_port_t u) {
+// Entra a paste mode (^E) y verifica banner ("paste mode" o "=== ").
+// El llamador ya dejó la placa en el prompt (PyBoardUART::readyAtPrompt).
+static PyBoard::ErrorCode enterPasteMode(PyBoard::Transport& io) {
     using namespace PyBoard;
     const uint8_t CTRL_E = 0x05;
 
-    auto rc = ensureAtPrompt(u, 2000);
-    if (rc != ErrorCode::OK) return rc;
-
-    uart_flush_input(u);
+    io.flush();
 
-    if (uart_write_bytes(u, &CTRL_E, 1) != 1) return ErrorCode::UART_ERROR;
+    if (io.write(&CTRL_E, 1) != 1) return ErrorCode::UART_ERROR;
 
-    if (waitForSubstring(u, "paste mode", 800) == ErrorCode::OK) return ErrorCode::OK;
-    if (waitForSubstring(u, "=== ", 800) == ErrorCode::OK)       return ErrorCode::OK;
-
-    return ErrorCode::REPL_ERROR;
+    // Hasta el "=== " que cierra el banner: desde ahí todo es eco del pegado
+    NeedleMatcher m("=== ");
+    std::string acc;
+    return io.readUntil(m, acc, 1600, 1024) ? ErrorCode::OK : ErrorCode::REPL_ERROR;
 }
 
-// Pega en paste mode carácter por carácter con pequeño pacing y ejecuta (^D)
-static PyBoard::ErrorCode pasteLiteralBlock(uart_port_t u, const char* data, size_t len) {
-    using namespace PyBoard;
-    if (!data || len == 0) return ErrorCode::OK;
-
-    std::string norm; norm.reserve(len * 2);
+// Fines de línea como los tipea una terminal (CRLF) y CRLF al final
+static std::string normalizePaste(const char* data, size_t len) {
+    std::string norm; norm.reserve(len + len / 16 + 2);
     for (size_t i=0;i<len;i++){
         char ch = data[i];
         if (ch == '\r') {
@@ -171,67 +133,380 @@ static PyBoard::ErrorCode pasteLiteralBlock(uart_port_t u, const char* data, siz
         }
     }
     if (norm.empty() || norm.back() != '\n') norm += "\r\n";
-
-    const uint32_t per_char_us = 200;
-    const uint32_t per_nl_extra_us = 300;
-
-    for (size_t i=0;i<norm.size(); ++i) {
-        const char ch = norm[i];
-        int wr = uart_write_bytes(u, &ch, 1);
-        if (wr != 1) return ErrorCode::UART_ERROR;
-
-        esp_rom_delay_us(per_char_us);
-        if (ch == '\n') esp_rom_delay_us(per_nl_extra_us);
-    }
-
-    const uint8_t CTRL_D = 0x04;
-    if (uart_write_bytes(u, &CTRL_D, 1) != 1) return ErrorCode::UART_ERROR;
-
-    return ErrorCode::OK;
+    return norm;
 }
 
 // Lee hasta ver 'end' y devuelve en 'output'
-static PyBoard::ErrorCode readTo(uart_port_t u, const char* end, std::string& output, uint32_t timeoutMs) {
+static PyBoard::ErrorCode readTo(PyBoard::Transport& io, const char* end, std::string& output, uint32_t timeoutMs) {
     using namespace PyBoard;
     output.clear();
-    const uint64_t deadline = (uint64_t)esp_timer_get_time() + (uint64_t)timeoutMs * 1000ULL;
-    std::string acc; acc.reserve(1024);
-    uint8_t buf[256];
+    NeedleMatcher m(end);
+    return io.readUntil(m, output, timeoutMs) ? ErrorCode::OK : ErrorCode::TIMEOUT;
+}
 
-    while ((uint64_t)esp_timer_get_time() < deadline) {
-        int n = uart_read_bytes(u, buf, sizeof(buf), pdMS_TO_TICKS(40));
-        if (n > 0) {
-            acc.append(reinterpret_cast<const char*>(buf), n);
-            size_t p = acc.find(end);
-            if (p != std::string::npos) {
-                output.append(acc.data(), p + std::strlen(end));
-                return ErrorCode::OK;
-            }
-            if (acc.size() > 4096) {
-                output.append(acc);
-                acc.clear();
-            }
-        } else {
-            vTaskDelay(pdMS_TO_TICKS(5));
-        }
+// Drena hasta ver el prompt '>>>'; true si lo vio
+static bool drainToPrompt(PyBoard::Transport& io, uint32_t timeoutMs = 800) {
+    using namespace PyBoard;
+    NeedleMatcher m(">>>");
+    std::string acc;
+    return io.readUntil(m, acc, timeoutMs, 512) != 0;
+}
+
+// Lee exactamente 'len' bytes (respuestas de handshake: "OK", "R\x01", ventana)
+static int readExact(PyBoard::Transport& io, uint8_t* buf, size_t len, uint32_t timeoutMs) {
+    using namespace PyBoard;
+    const uint64_t deadline = nowUs() + (uint64_t)timeoutMs * 1000ULL;
+    size_t got = 0;
+    while (got < len) {
+        uint64_t now = nowUs();
+        if (now >= deadline) break;
+        got += io.read(buf + got, len - got, (uint32_t)((deadline - now + 999) / 1000ULL));
     }
-    return ErrorCode::TIMEOUT;
+    return static_cast<int>(got);
 }
 
-// Drena hasta ver el prompt '>>>'
-static void drainToPrompt(uart_port_t u, uint32_t timeoutMs = 800) {
-    const uint64_t deadline = (uint64_t)esp_timer_get_time() + (uint64_t)timeoutMs * 1000ULL;
-    std::string acc; acc.reserve(512);
-    uint8_t buf[128];
-    while ((uint64_t)esp_timer_get_time() < deadline) {
-        int n = uart_read_bytes(u, buf, sizeof(buf), pdMS_TO_TICKS(30));
-        if (n > 0) {
-            acc.append(reinterpret_cast<const char*>(buf), n);
-            if (acc.find(">>>") != std::string::npos) return;
-            if (acc.size() > 4096) acc.erase(0, acc.size() - 1024);
-        } else {
-            vTaskDelay(pdMS_TO_TICKS(10));
+// Agente residente: se pega una vez por sesión y deja '_e' en globals.
+// Cada operación FS pasa a ser una línea ("_e.st('/main.py')") y responde
+// con una sola línea de sentinela (@@S/@@L/@@X/@@K o @@E <error>).
+// rs/ws son los lazos de transferencia por ventana (ver readFileStream y
+// writeStream); el contenido viaja según WireCodec. dr descarta la entrada
+// tras una trama dañada hasta STREAM_QUIET_MS de silencio; sin select no
+// puede, y ws termina con el error como antes de los NAK. Una trama con la
+// seq siguiente a la esperada es la que ya estaba en vuelo tras el NAK (el
+// host la reenvía): se tira sin responder, como hace el host con su crédito.
+// Subir AGENT_VERSION cuando cambie la fuente (agentSource arma "V=" con ella).
+// Con un perfil de la placa (ver probeBoard) se arma sin las pruebas de
+// import/atributo: el módulo base64 y ls con o sin ilistdir ya se conocen.
+static constexpr int AGENT_VERSION = 10;
+static const char AGENT_IMPORT_ANY[] =
+    "import os as _eo,sys as _es\n"
+    "try:\n"
+    " import ubinascii as _eb\n"
+    "except ImportError:\n"
+    " import binascii as _eb\n";
+static const char AGENT_HEAD[] =
+    " def k(f,*a):\n"
+    "  try:\n"
+    "   f(*a);print('@@K');return 1\n"
+    "  except Exception as x:print('@@E',repr(x))\n"
+    " def st(p):\n"
+    "  try:\n"
+    "   s=_eo.stat(p);print('@@S',s[0],s[6]);return 1\n"
+    "  except Exception as x:print('@@E',repr(x))\n"
+    " def ex(p):\n"
+    "  try:\n"
+    "   _eo.stat(p);print('@@X 1')\n"
+    "  except Exception:print('@@X 0')\n"
+    ;
+// it(p): (nombre, 0x4000 si es directorio, tamaño) de cada entrada
+static const char AGENT_IT_ANY[] =
+    " def it(p):\n"
+    "  try:\n"
+    "   l=_eo.ilistdir(p)\n"
+    "  except AttributeError:\n"
+    "   l=None\n"
+    "  if l is not None:\n"
+    "   for f in l:yield f[0],f[1]&0x4000,f[3] if len(f)>3 else 0\n"
+    "  else:\n"
+    "   for m in _eo.listdir(p):\n"
+    "    try:\n"
+    "     s=_eo.stat(p.rstrip('/')+'/'+m);yield m,s[0]&0x4000,s[6]\n"
+    "    except Exception:yield m,0,0\n";
+static const char AGENT_IT_ILISTDIR[] =
+    " def it(p):\n"
+    "  for f in _eo.ilistdir(p):yield f[0],f[1]&0x4000,f[3] if len(f)>3 else 0\n";
+// bt: lote de operaciones (ver runBatch); cada una devuelve 1 si salió bien.
+// hb/pw/pc: guardado por diferencias (ver writeFileDelta); cf responde
+// "@@C <bytes> <crc> <mtime>" del archivo que quedó.
+// hs: "@@D <tamaño> <mtime> <hash|->" para el manifiesto (ver unchangedOnBoard).
+// tr: recorrido en anchura, una línea "d|f<TAB>tamaño<TAB>ruta relativa" por
+// entrada y "@@T <entradas> <niveles completos>" al final (ver walkTree)
+static const char AGENT_TAIL[] =
+    " def ls(p):\n"
+    "  n=0\n"
+    "  try:\n"
+    "   for m,d,s in _e.it(p):print(m+'|'+str(d)+'|'+str(s));n+=1\n"
+    "   print('@@L',n)\n"
+    "  except Exception as x:print('@@E',repr(x))\n"
+    " def gm(n,g):\n"
+    "  i=j=k=0;s=-1\n"
+    "  while i<len(n):\n"
+    "   if j<len(g) and g[j]=='*':s=j;k=i;j+=1\n"
+    "   elif j<len(g) and g[j] in('?',n[i]):i+=1;j+=1\n"
+    "   elif s>=0:j=s+1;k+=1;i=k\n"
+    "   else:return 0\n"
+    "  while j<len(g) and g[j]=='*':j+=1\n"
+    "  return j==len(g)\n"
+    " def tr(p,D,g,L):\n"
+    "  b=p.rstrip('/');q=[(b,'',0)];n=0;c=D;w=_es.stdout.write\n"
+    "  print('@@GO')\n"
+    "  try:\n"
+    "   while q:\n"
+    "    a,r,v=q.pop(0)\n"
+    "    for m,d,s in _e.it(a or '/'):\n"
+    "     if n>=L:c=v;q=0;break\n"
+    "     x=r+m\n"
+    "     if d:\n"
+    "      w('d\\t0\\t'+x+'\\n');n+=1\n"
+    "      if v+1<D:q.append((a+'/'+m,x+'/',v+1))\n"
+    "     elif not g or _e.gm(m,g):w('f\\t'+str(s)+'\\t'+x+'\\n');n+=1\n"
+    "   print('@@T',n,c)\n"
+    "  except Exception as x:print('@@E',repr(x))\n"
+    " def rt(p):\n"
+    "  def r(a):\n"
+    "   for m,d,s in list(_e.it(a)):\n"
+    "    x=a.rstrip('/')+'/'+m\n"
+    "    if d:r(x)\n"
+    "    else:_eo.remove(x)\n"
+    "   _eo.rmdir(a)\n"
+    "  return _e.k(r,p)\n"
+    " def rm(p):return _e.k(_eo.remove,p)\n"
+    " def md(p):return _e.k(_eo.mkdir,p)\n"
+    " def rd(p):return _e.k(_eo.rmdir,p)\n"
+    " def mv(a,b):return _e.k(_eo.rename,a,b)\n"
+    " def dl(p):\n"
+    "  try:d=_eo.stat(p)[0]&0x4000\n"
+    "  except Exception as x:print('@@E',repr(x));return\n"
+    "  return _e.rt(p) if d else _e.rm(p)\n"
+    " def wr(p,d):\n"
+    "  def w():\n"
+    "   with open(p,'wb') as f:f.write(_eb.a2b_base64(d))\n"
+    "  return _e.k(w)\n"
+    " def x(c):return _e.k(exec,c,globals())\n"
+    " def bt(L,s):\n"
+    "  for i,o in enumerate(L):\n"
+    "   print('@@B',i)\n"
+    "   if not getattr(_e,o[0])(*o[1:]) and s:break\n"
+    "  print('@@Z')\n"
+    " def rs(p,c,v,e):\n"
+    "  f=open(p,'rb');r=_es.stdin.read;w=_es.stdout.write;q=getattr(_eb,'crc32',None);k=0;x=0\n"
+    "  if e:\n"
+    "   try:o=_es.stdout.buffer.write\n"
+    "   except AttributeError:e=0\n"
+    "  print('@@GO',e,int(not not q))\n"
+    "  while 1:\n"
+    "   d=f.read(c)\n"
+    "   if d:\n"
+    "    h='%02x%08x'%(x&255,q(d) if q else 0)\n"
+    "    if e:w('%04x'%len(d)+h);o(d)\n"
+    "    else:w(h+_eb.b2a_base64(d).decode())\n"
+    "    x+=1;k+=1\n"
+    "   else:w('0000' if e else '@@EOF\\n')\n"
+    "   while k and(k>=v or not d):\n"
+    "    k-=1\n"
+    "    if r(1)=='N':s=x-1-(x-1-int(r(2),16)&255);f.seek(s*c);x=s;k=0;d=1\n"
+    "   if not d:break\n"
+    "  print('@@END',f.tell());f.close()\n"
+    " def hb(p,B,K):\n"
+    "  try:\n"
+    "   s=_eo.stat(p);n=s[6];c=_eb.crc32;r=[]\n"
+    "   while n>B*K:B*=2\n"
+    "   f=open(p,'rb')\n"
+    "   for o in range(0,n,B):r.append('%x'%c(f.read(B)))\n"
+    "   for o in range(n,0,-B):a=max(o-B,0);f.seek(a);r.append('%x'%c(f.read(o-a)))\n"
+    "   f.close();print('@@H',n,B,s[8],' '.join(r))\n"
+    "  except Exception as x:print('@@E',repr(x))\n"
+    " def cf(p):\n"
+    "  c=_eb.crc32;h=0;n=0\n"
+    "  with open(p,'rb') as f:\n"
+    "   while 1:\n"
+    "    x=f.read(512)\n"
+    "    if not x:break\n"
+    "    h=c(x,h);n+=len(x)\n"
+    "  print('@@C',n,h,_eo.stat(p)[8])\n"
+    " def hs(p,m):\n"
+    "  try:\n"
+    "   s=_eo.stat(p);d='-'\n"
+    "   if m:\n"
+    "    try:import hashlib as H\n"
+    "    except ImportError:\n"
+    "     try:import uhashlib as H\n"
+    "     except ImportError:H=None\n"
+    "    h=getattr(H,'sha256',None);h=h and h();c=0\n"
+    "    with open(p,'rb') as f:\n"
+    "     while 1:\n"
+    "      x=f.read(512)\n"
+    "      if not x:break\n"
+    "      if h:h.update(x)\n"
+    "      else:c=_eb.crc32(x,c)\n"
+    "    d=_eb.hexlify(h.digest()).decode() if h else '%08x'%c\n"
+    "   print('@@D',s[6],s[8],d)\n"
+    "  except Exception:print('@@D -1 0 -')\n"
+    " def pw(p,L):\n"
+    "  try:\n"
+    "   with open(p,'r+b') as f:\n"
+    "    for o,d in L:f.seek(o);f.write(_eb.a2b_base64(d))\n"
+    "   _e.cf(p)\n"
+    "  except Exception as x:print('@@E',repr(x))\n"
+    " def pc(p,P,S,d):\n"
+    "  try:\n"
+    "   t=p+'.~';n=_eo.stat(p)[6]\n"
+    "   with open(p,'rb') as f:\n"
+    "    with open(t,'wb') as g:\n"
+    "     def cp(k):\n"
+    "      while k>0:\n"
+    "       x=f.read(min(k,512))\n"
+    "       if not x:break\n"
+    "       g.write(x);k-=len(x)\n"
+    "     cp(P);g.write(_eb.a2b_base64(d));f.seek(n-S);cp(S)\n"
+    "   _eo.remove(p);_eo.rename(t,p);_e.cf(p)\n"
+    "  except Exception as x:print('@@E',repr(x))\n"
+    " def ws(p,m,z,e):\n"
+    "  f=open(p,m);i=_es.stdin;r=i.read;w=_es.stdout.write;a=_eb.a2b_base64;c=getattr(_eb,'crc32',None);n=0;h=0;x=0\n"
+    "  if z:\n"
+    "   try:z=_e.dz(z)\n"
+    "   except Exception:z=0\n"
+    "  if e>1:\n"
+    "   try:import micropython as M;b=i.buffer.read;M.kbd_intr(-1);r=b\n"
+    "   except Exception:e=1\n"
+    "  print('@@GO',int(not not z),e)\n"
+    "  try:\n"
+    "   while 1:\n"
+    "    try:\n"
+    "     t=r(4)\n"
+    "     if e>1:t=t.decode()\n"
+    "     if t=='0000':break\n"
+    "     s=r(10)\n"
+    "     if e>1:s=s.decode()\n"
+    "     k=t[0];d=r(int('0x'+t[1:],16));q=int(s[:2],16)\n"
+    "     if q==x+1&255:continue\n"
+    "     if k=='B':d=a(d)\n"
+    "     elif k=='Z':d=z(a(d))\n"
+    "     elif k=='T':d=_e.ue(d)\n"
+    "     elif k=='P':d=z(d)\n"
+    "     elif k!='R':raise ValueError\n"
+    "     if q!=x or c and c(d)!=int(s[2:],16):raise ValueError\n"
+    "    except Exception:\n"
+    "     if not _e.dr(i,e):raise\n"
+    "     w('\\x15%02x'%x);continue\n"
+    "    f.write(d);n+=len(d);x=x+1&255\n"
+    "    if c:h=c(d,h)\n"
+    "    w('\\x01')\n"
+    "  finally:\n"
+    "   if e>1:M.kbd_intr(3)\n"
+    "  f.close();print('@@OK',n,h if c else -1,_eo.stat(p)[8])\n"
+    " def dr(i,e):\n"
+    "  try:import select;P=select.poll();P.register(i,1)\n"
+    "  except Exception:return\n"
+    "  r=i.buffer.read if e>1 else i.read\n"
+    "  while P.poll(50):r(1)\n"
+    "  return 1\n"
+    " def ue(s):\n"
+    "  p=s.split('\\x7f');b=bytearray(p[0].encode())\n"
+    "  for x in p[1:]:b.append(int(x[:2],16));b+=x[2:].encode()\n"
+    "  return b\n"
+    " def dz(b):\n"
+    "  try:\n"
+    "   import deflate,io\n"
+    "   return lambda d:deflate.DeflateIO(io.BytesIO(d),deflate.RAW,b).read()\n"
+    "  except ImportError:pass\n"
+    "  try:import zlib as Z\n"
+    "  except ImportError:import uzlib as Z\n"
+    "  return lambda d:Z.decompress(d,-b)\n"
+    "print('@@'+'AG',_e.V)\n";
+
+// Sondeo de capacidades: una línea "@@P clave=valor|..." (ver BoardProfile).
+// _pb(0) solo identifica la placa (dialecto, versión, id); _pb(1) además
+// prueba los módulos y mide el heap libre.
+static const char PROBE_SRC[] =
+    "def _pb(full):\n"
+    " import sys,os\n"
+    " i=sys.implementation;u=b''\n"
+    " try:\n"
+    "  import microcontroller;u=microcontroller.cpu.uid\n"
+    " except Exception:\n"
+    "  try:\n"
+    "   import machine;u=machine.unique_id()\n"
+    "  except Exception:pass\n"
+    " r='d='+i.name+'|v='+'.'.join(str(x) for x in i.version[:3])+'|u='+''.join('%02x'%x for x in u)\n"
+    " if full:\n"
+    "  import gc\n"
+    "  def h(*n):\n"
+    "   for m in n:\n"
+    "    try:\n"
+    "     __import__(m);return m\n"
+    "    except Exception:pass\n"
+    "   return ''\n"
+    "  b=h('ubinascii','binascii');z=h('zlib','uzlib');k=h('hashlib','uhashlib')\n"
+    "  c=int(bool(b) and hasattr(__import__(b),'crc32'))\n"
+    "  gc.collect()\n"
+    "  r+='|m='+getattr(i,'_machine','').replace('|','/')+'|b='+b+'|c='+str(c)"
+    "+'|df='+str(int(bool(h('deflate'))))+'|z='+z+'|hl='+k"
+    "+'|il='+str(int(hasattr(os,'ilistdir')))+'|mf='+str(gc.mem_free())\n"
+    " print('@@'+'P',r)\n";
+
+// Llamadas de una línea (ver PyTemplates.hpp); las rutas van como PyQuoted
+static constexpr PyBoard::PyTemplate CALL_LS{"_e.ls({0})"};
+static constexpr PyBoard::PyTemplate CALL_ST{"_e.st({0})"};
+static constexpr PyBoard::PyTemplate CALL_EX{"_e.ex({0})"};
+static constexpr PyBoard::PyTemplate CALL_RM{"_e.rm({0})"};
+static constexpr PyBoard::PyTemplate CALL_MD{"_e.md({0})"};
+static constexpr PyBoard::PyTemplate CALL_RD{"_e.rd({0})"};
+static constexpr PyBoard::PyTemplate CALL_RT{"_e.rt({0})"};
+static constexpr PyBoard::PyTemplate CALL_TR{"_e.tr({0},{1},{2},{3})"};
+static constexpr PyBoard::PyTemplate CALL_MV{"_e.mv({0},{1})"};
+static constexpr PyBoard::PyTemplate CALL_RS{"_e.rs({0},{1},{2},{3})"};
+static constexpr PyBoard::PyTemplate CALL_WS{"_e.ws({0},{1},{2},{3})"};
+static constexpr PyBoard::PyTemplate CALL_BT{"_e.bt([{0}],{1})"};
+static constexpr PyBoard::PyTemplate BT_OP1{"('{0}',{1}),"};
+static constexpr PyBoard::PyTemplate BT_OP2{"('{0}',{1},{2}),"};
+static constexpr PyBoard::PyTemplate CALL_HB{"_e.hb({0},{1},{2})"};
+static constexpr PyBoard::PyTemplate CALL_HS{"_e.hs({0},{1})"};
+static constexpr PyBoard::PyTemplate CALL_PW{"_e.pw({0},[{1}])"};
+static constexpr PyBoard::PyTemplate PW_SEG{"({0},'{1}'),"};
+static constexpr PyBoard::PyTemplate CALL_PC{"_e.pc({0},{1},{2},'{3}')"};
+static constexpr PyBoard::PyTemplate CALL_PROBE{"{0}_pb({1})\ndel _pb\n"};
+static constexpr PyBoard::PyTemplate CALL_EVAL{"print(repr({0}))"};
+// execFriendly: {0} es el código ya indentado un espacio, línea a línea.
+// Los marcadores van partidos para que su eco no contenga "<<<END>>>" (ni '>>>')
+static constexpr PyBoard::PyTemplate FRIENDLY_WRAP{
+    "print('<<<BEGIN'+'>>>')\r\ntry:\r\n{0}"
+    "except Exception as e:import sys;sys.print_exception(e)\r\n"
+    "print('<<<END'+'>>>')\r\n"};
+
+// Busca la línea de respuesta del agente que empieza con 'tag'.
+// Devuelve false y deja el texto de @@E (o la salida completa) en 'rest'.
+static bool agentReply(const std::string &out, const char *tag, std::string &rest) {
+    const size_t tlen = std::strlen(tag);
+    for (size_t pos = 0; pos < out.size();) {
+        size_t end = out.find('\n', pos);
+        if (end == std::string::npos) end = out.size();
+        size_t len = end - pos;
+        if (len && out[pos + len - 1] == '\r') --len;
+        if (len >= tlen && out.compare(pos, tlen, tag) == 0) {
+            rest = len > tlen ? out.substr(pos + tlen + 1, len - tlen - 1) : std::string();
+            return true;
+        }
+        if (len >= 3 && out.compare(pos, 3, "@@E") == 0) {
+            rest = len > 3 ? out.substr(pos + 4, len - 4) : std::string("error");
+            return false;
         }
+        pos = end + 1;
+    }
+    rest = out;
+    return false;
+}
+
+// WireCodec::ESCAPE: ASCII imprimible, TAB y LF van tal cual; el resto
+// (controles, DEL, bytes >= 0x80) como \x7f + 2 dígitos hex (_e.ue los deshace).
+// CR también: ESCAPE se lee con sys.stdin en modo texto, que lo vuelve LF.
+static inline bool wireSafe(uint8_t c) {
+    return (c >= 0x20 && c < 0x7f) || c == '\t' || c == '\n';
+}
+
+static size_t escapedSize(const uint8_t *data, size_t len) {
+    size_t n = len;
+    for (size_t i = 0; i < len; ++i) if (!wireSafe(data[i])) n += 2;
+    return n;
+}
+
+static void escapeAppend(const uint8_t *data, size_t len, std::string &out) {
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; ++i) {
+        const uint8_t c = data[i];
+        if (wireSafe(c)) { out.push_back(static_cast<char>(c)); continue; }
+        const char e[3] = {'\x7f', hex[c >> 4], hex[c & 0xf]};
+        out.append(e, 3);
     }
 }
 
@@ -245,12 +520,19 @@ namespace PyBoard {
 static const char base64_chars[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
+#ifdef ESP_PLATFORM
 PyBoardUART::PyBoardUART(uart_port_t uart, int tx, int rx, BaudRate baud,
                          Timeout timeout, ChunkSize chunk)
-    : uartNum(uart), txPin(tx), rxPin(rx), baudRate(baud),
+    : PyBoardUART(std::make_unique<UartTransport>(uart, tx, rx, static_cast<int>(baud), BUFFER_SIZE * 2),
+                  timeout, chunk) {
+    baudRate = baud;
+}
+#endif
+
+PyBoardUART::PyBoardUART(std::unique_ptr<Transport> t, Timeout timeout, ChunkSize chunk)
+    : transport(std::move(t)), baudRate(BaudRate::BAUD_115200),
       defaultTimeout(timeout), chunkSize(chunk),
-      inRawRepl(false), useRawPaste(true), monitorEnabled(false),
-      eventQueue(nullptr), monitorTask(nullptr) {
+      inRawRepl(false), useRawPaste(true), monitorEnabled(false), agentReady(false) {
     rxBuffer = std::make_unique<uint8_t[]>(BUFFER_SIZE);
     txBuffer = std::make_unique<uint8_t[]>(BUFFER_SIZE);
 }
@@ -260,50 +542,28 @@ PyBoardUART::~PyBoardUART() {
 }
 
 ErrorCode PyBoardUART::init() {
-    uart_config_t uart_config = {
-        .baud_rate = static_cast<int>(baudRate),
-        .data_bits = UART_DATA_8_BITS,
-        .parity    = UART_PARITY_DISABLE,
-        .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
-        .rx_flow_ctrl_thresh = 0,
-        .source_clk = UART_SCLK_APB,
-    };
-
-    esp_err_t err = uart_driver_install(uartNum, BUFFER_SIZE*2, BUFFER_SIZE*2, 20, &eventQueue, 0);
-    if (err != ESP_OK) {
-        setError("Failed to install UART driver");
-        return ErrorCode::UART_ERROR;
+    if (!transport) {
+        setError("No transport");
+        return ErrorCode::INVALID_PARAM;
     }
-    err = uart_param_config(uartNum, &uart_config);
-    if (err != ESP_OK) {
-        uart_driver_delete(uartNum);
-        setError("Failed to configure UART parameters");
+    if (!transport->open()) {
+        setError(transport->error());
         return ErrorCode::UART_ERROR;
     }
-    err = uart_set_pin(uartNum, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
-    if (err != ESP_OK) {
-        uart_driver_delete(uartNum);
-        setError("Failed to set UART pins");
-        return ErrorCode::UART_ERROR;
-    }
-
-    ESP_LOGI(TAG, "Initialized on UART%d (TX:%d, RX:%d, Baud:%d)",
-             uartNum, txPin, rxPin, static_cast<int>(baudRate));
+    ESP_LOGI(TAG, "Initialized on %s", transport->name());
     return ErrorCode::OK;
 }
 
 ErrorCode PyBoardUART::deinit() {
-    if (eventQueue != nullptr) {
-        uart_driver_delete(uartNum);
-        eventQueue = nullptr;
+    if (transport && transport->isOpen()) {
+        transport->close();
+        ESP_LOGI(TAG, "Deinitialized");
     }
-    ESP_LOGI(TAG, "Deinitialized");
     return ErrorCode::OK;
 }
 
 ErrorCode PyBoardUART::writeData(const uint8_t *data, size_t len) {
-    int written = uart_write_bytes(uartNum, data, len);
+    int written = transport->write(data, len);
     if (written != static_cast<int>(len)) {
         setError("Failed to write all bytes to UART");
         return ErrorCode::UART_ERROR;
@@ -317,105 +577,485 @@ ErrorCode PyBoardUART::writeData(const std::string &data) {
 
 ErrorCode PyBoardUART::write(const void *data, size_t len) {
     if (!data || len == 0) return ErrorCode::OK;
+    // Un ^D desde la terminal reinicia el intérprete y borra el agente
+    if (std::memchr(data, CTRL_D, len) != nullptr) agentReady = false;
+    // Lo que tipee el terminal deja el REPL en un estado que no seguimos
+    replState = ReplState::UNKNOWN;
     return writeData(reinterpret_cast<const uint8_t *>(data), len);
 }
 ErrorCode PyBoardUART::write(const std::string &data) {
-    if (data.empty()) return ErrorCode::OK;
-    return writeData(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+    return write(data.data(), data.size());
 }
 ErrorCode PyBoardUART::write(const char *data, size_t len) {
-    if (!data || len == 0) return ErrorCode::OK;
-    return writeData(reinterpret_cast<const uint8_t *>(data), len);
+    return write(static_cast<const void *>(data), len);
 }
 
-ErrorCode PyBoardUART::readUntil(const std::string &ending, std::string &output, uint32_t timeoutMs) {
-    output.clear();
-    uint64_t deadline = (uint64_t)esp_timer_get_time() + (uint64_t)timeoutMs * 1000ULL;
-
-    while ((uint64_t)esp_timer_get_time() < deadline) {
-        uint8_t byte;
-        int len = uart_read_bytes(uartNum, &byte, 1, 10 / portTICK_PERIOD_MS);
-        if (len > 0) {
-            output += static_cast<char>(byte);
-            if (output.length() >= ending.length()) {
-                if (output.substr(output.length() - ending.length()) == ending) {
-                    return ErrorCode::OK;
-                }
-            }
+size_t PyBoardUART::read(void *data, size_t len, uint32_t timeoutMs) {
+    if (!data || len == 0) return 0;
+    size_t n = transport->read(static_cast<uint8_t *>(data), len, timeoutMs);
+    // Salida sin pedirla (code.py, auto-reload...): el prompt ya no es seguro.
+    // El espacio que sigue a '>>>' no cuenta.
+    if (n > 0 && replState == ReplState::PROMPT) {
+        const uint8_t *p = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < n; ++i) {
+            if (p[i] != ' ') { replState = ReplState::UNKNOWN; break; }
         }
-        vTaskDelay(1 / portTICK_PERIOD_MS);
     }
+    return n;
+}
+
+ErrorCode PyBoardUART::readUntil(const std::string &ending, std::string &output, uint32_t timeoutMs) {
+    output.clear();
+    NeedleMatcher m(ending.c_str());
+    if (transport->readUntil(m, output, timeoutMs)) return ErrorCode::OK;
     setError("Timeout waiting for: " + ending);
     return ErrorCode::TIMEOUT;
 }
 
 ErrorCode PyBoardUART::flushInput() {
-    uart_flush_input(uartNum);
+    transport->flush();
+    return ErrorCode::OK;
+}
+
+// ============================================================================
+// Lectura bufferizada para transferencias por ventana
+// ============================================================================
+ErrorCode PyBoardUART::readByte(uint8_t &b, uint32_t timeoutMs) {
+    return transport->read(&b, 1, timeoutMs) == 1 ? ErrorCode::OK : ErrorCode::TIMEOUT;
+}
+
+ErrorCode PyBoardUART::readLine(std::string &line, uint32_t timeoutMs) {
+    NeedleMatcher m;
+    const uint32_t NL = m.add("\n");
+    m.add(">>>");   // el programa terminó (traceback + prompt) sin cerrar la línea
+    m.add("\x04"); // ídem en raw REPL (fin de salida)
+
+    line.clear();
+    uint32_t hit = transport->readUntil(m, line, timeoutMs);
+    if (hit == 0) {
+        transport->unread(line.data(), line.size());
+        return ErrorCode::TIMEOUT;
+    }
+    if (!(hit & NL)) return ErrorCode::REPL_ERROR;
+
+    line.pop_back();
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    return ErrorCode::OK;
+}
+
+// Espera una línea que empiece con 'prefix' (descarta eco/ruido previo).
+// Las sentinelas se imprimen como '@@'+'XX' para que el eco del paste no coincida.
+ErrorCode PyBoardUART::waitForLine(const char *prefix, std::string &line, uint32_t timeoutMs) {
+    const uint64_t deadline = nowUs() + (uint64_t)timeoutMs * 1000ULL;
+    std::string seen;
+    for (;;) {
+        uint64_t now = nowUs();
+        if (now >= deadline) break;
+        auto rc = readLine(line, (uint32_t)((deadline - now) / 1000ULL));
+        if (rc == ErrorCode::REPL_ERROR) {
+            seen += line;
+            stripPasteArtifacts(seen);
+            setError("Program aborted: " + seen);
+            return ErrorCode::EXEC_ERROR;
+        }
+        if (rc != ErrorCode::OK) break;
+        if (line.rfind(prefix, 0) == 0) return ErrorCode::OK;
+        seen += line;
+        seen.push_back('\n');
+        if (seen.size() > 1024) seen.erase(0, seen.size() - 512);
+    }
+    setError(std::string("Timeout waiting for ") + prefix);
+    return ErrorCode::TIMEOUT;
+}
+
+// Pega y arranca un programa sin esperar a '>>>' (su stdin queda para el host)
+ErrorCode PyBoardUART::startProgram(const std::string &code) {
+    ErrorCode rc = prepareEngine();
+    if (rc != ErrorCode::OK) return rc;
+    if (inRawRepl) return execRawNoFollow(code);
+    return pasteAndRun(code);
+}
+
+// Igual que startProgram() pero para una sola llamada al agente: no hace
+// falta paste mode, basta con tipear la línea en el prompt.
+ErrorCode PyBoardUART::startCall(const std::string &call) {
+    ErrorCode rc = ensureAgent();
+    if (rc == ErrorCode::OK) rc = prepareEngine();
+    if (rc != ErrorCode::OK) return rc;
+    if (inRawRepl) return execRawNoFollow(call);
+
+    rc = readyAtPrompt(1500);
+    if (rc != ErrorCode::OK) return rc;
+    replState = ReplState::RUNNING;
+    return writeData(call + "\r");
+}
+
+// Espera el final del programa arrancado con startProgram()/startCall()
+ErrorCode PyBoardUART::finishProgram(uint32_t timeoutMs) {
+    std::string tail;
+    if (inRawRepl) {
+        std::string err;
+        auto rc = follow(tail, err, timeoutMs);
+        if (rc == ErrorCode::OK && !err.empty()) { setError(err); return ErrorCode::EXEC_ERROR; }
+        return rc;
+    }
+    NeedleMatcher m(">>>");
+    if (transport->readUntil(m, tail, timeoutMs, 256)) {
+        replState = ReplState::PROMPT;
+        return ErrorCode::OK;
+    }
+    replState = ReplState::UNKNOWN;
+    setError("Timeout waiting for '>>>' after program");
+    return ErrorCode::TIMEOUT;
+}
+
+// Hay prompt confirmado y desde entonces solo llegó (a lo sumo) el espacio
+// que lo sigue: no hace falta preguntarle a la placa
+bool PyBoardUART::promptCached() {
+    if (replState != ReplState::PROMPT) return false;
+    uint8_t c;
+    while (transport->available() > 0 && transport->read(&c, 1, 0) == 1) {
+        if (c != ' ') {
+            transport->unread(reinterpret_cast<const char *>(&c), 1);
+            replState = ReplState::UNKNOWN;
+            return false;
+        }
+    }
+    return true;
+}
+
+ErrorCode PyBoardUART::readyAtPrompt(uint32_t timeoutMs) {
+    if (promptCached()) return ErrorCode::OK;
+    ErrorCode rc = ensureAtPrompt(*transport, timeoutMs);
+    replState = (rc == ErrorCode::OK) ? ReplState::PROMPT : ReplState::UNKNOWN;
+    return rc;
+}
+
+ErrorCode PyBoardUART::pasteAndRun(const std::string &code) {
+    const std::string norm = normalizePaste(code.data(), code.size());
+    ErrorCode rc = ErrorCode::OK;
+    for (int attempt = 0; attempt < PASTE_ATTEMPTS; ++attempt) {
+        const bool cached = promptCached();
+        rc = cached ? ErrorCode::OK : readyAtPrompt(2000);
+        if (rc == ErrorCode::OK) rc = enterPasteMode(*transport);
+        if (rc != ErrorCode::OK && cached) {
+            // El estado guardado no era cierto (la placa cambió sin avisar):
+            // una vez más con el handshake completo
+            replState = ReplState::UNKNOWN;
+            rc = readyAtPrompt(2000);
+            if (rc == ErrorCode::OK) rc = enterPasteMode(*transport);
+        }
+        if (rc != ErrorCode::OK) {
+            replState = ReplState::UNKNOWN;
+            return rc;
+        }
+        replState = ReplState::PASTE;
+
+        bool overrun = false;
+        rc = pasteBlock(norm, overrun);
+        if (rc == ErrorCode::OK) {
+            replState = ReplState::RUNNING;
+            return writeData(&CTRL_D, 1);
+        }
+        replState = ReplState::UNKNOWN;
+        if (!overrun) return rc;
+        // Nada se ejecutó todavía: ^C descarta el pegado y se reintenta con
+        // la ventana ya reducida
+        (void)writeData(&CTRL_C, 1);
+        (void)drainToPrompt(*transport, 500);
+    }
+    setError("paste: la placa pierde caracteres aun con la ventana mínima");
+    return rc;
+}
+
+// Pegado con ventana: a lo sumo pasteWindow bytes enviados sin su eco, en
+// ráfagas y esperando en el RX (sin busy-wait). Cada línea vuelve como su
+// texto + "\r\n=== " y se compara con lo enviado antes de mandar el ^D, así
+// que un byte perdido por desborde del RX de la placa se detecta sin haber
+// ejecutado nada. La ventana crece con pegados limpios (x2 hasta el primer
+// desborde, luego +PASTE_WINDOW_STEP sin llegar a la que desbordó) y se
+// reduce a la mitad ante uno.
+ErrorCode PyBoardUART::pasteBlock(const std::string &norm, bool &overrun) {
+    overrun = false;
+    NeedleMatcher marker("\r\n=== ");
+    size_t sent = 0;       // bytes de norm ya escritos
+    size_t lineStart = 0;  // inicio (en norm) de la línea cuyo eco se espera
+    std::string echo;      // eco visible (sin CR/LF) de esa línea
+    uint64_t lineSentUs = 0;
+    uint64_t lastRxUs = nowUs();
+    bool windowFull = false;
+    uint8_t buf[128];
+
+    [[maybe_unused]] const uint64_t t0 = nowUs(); // solo lo usa ESP_LOGD
+    size_t lineEnd = norm.find("\r\n") + 2;
+    while (lineStart < norm.size()) {
+        const size_t inflight = sent - std::min(sent, lineStart + echo.size());
+        if (sent < norm.size() && inflight < pasteWindow) {
+            const size_t n = std::min<size_t>(pasteWindow - inflight, norm.size() - sent);
+            if (transport->write(norm.data() + sent, n) != (int)n) {
+                setError("paste: write failed");
+                return ErrorCode::UART_ERROR;
+            }
+            sent += n;
+            if (sent >= lineEnd && !lineSentUs) lineSentUs = nowUs();
+            if (inflight + n >= pasteWindow) windowFull = true;
+        }
+
+        // Con ventana libre solo se recoge lo que haya; si no, se espera eco
+        const bool canSend = sent < norm.size() && sent - std::min(sent, lineStart + echo.size()) < pasteWindow;
+        const size_t got = transport->read(buf, sizeof(buf), canSend ? 0 : 20);
+        const uint64_t now = nowUs();
+        if (got == 0) {
+            // Sin eco: se perdió un CR (la línea nunca se cierra) o la placa se colgó
+            const uint64_t stallUs = std::max<uint64_t>((uint64_t)PASTE_STALL_MS * 1000ULL, echoLagUs * 8);
+            if (!canSend && now - lastRxUs > stallUs) {
+                overrun = true;
+                break;
+            }
+            continue;
+        }
+        lastRxUs = now;
+
+        for (size_t i = 0; i < got && !overrun; ++i) {
+            const char c = static_cast<char>(buf[i]);
+            const bool endOfLine = marker.feed(c) != 0;
+            if (c != '\r' && c != '\n') echo.push_back(c);
+            if (!endOfLine) {
+                // Más eco que texto (+ "=== "): llegó basura o se mezclaron líneas
+                if (echo.size() > lineEnd - lineStart - 2 + 4) overrun = true;
+                continue;
+            }
+            echo.resize(echo.size() >= 4 ? echo.size() - 4 : 0); // sin "=== "
+            if (echo.compare(0, std::string::npos, norm, lineStart, lineEnd - lineStart - 2) != 0) {
+                overrun = true;
+                break;
+            }
+            if (lineSentUs) {
+                const uint64_t lag = now - lineSentUs;
+                echoLagUs = echoLagUs ? (echoLagUs * 7 + lag) / 8 : lag;
+            }
+            lineStart = lineEnd;
+            lineEnd = norm.find("\r\n", lineStart) + 2;
+            lineSentUs = (lineStart < norm.size() && sent >= lineEnd) ? now : 0;
+            echo.clear();
+        }
+        if (overrun) break;
+    }
+
+    if (overrun) {
+        pasteSlowStart = false;
+        pasteCeiling = pasteWindow;
+        pasteWindow = std::max<uint16_t>(PASTE_WINDOW_MIN, pasteWindow / 2);
+        ESP_LOGW(TAG, "paste: eco distinto de lo enviado (RX desbordado), ventana %u", (unsigned)pasteWindow);
+        setError("paste: eco no coincide");
+        return ErrorCode::REPL_ERROR;
+    }
+
+    // Solo si la ventana limitó el envío hay algo que aprender
+    if (windowFull) {
+        uint16_t next = pasteSlowStart ? pasteWindow * 2 : pasteWindow + PASTE_WINDOW_STEP;
+        // Sin volver a la ventana que ya desbordó: cada desborde cuesta un repegado
+        if (pasteCeiling && next >= pasteCeiling) next = std::max<uint16_t>(pasteWindow, pasteCeiling - PASTE_WINDOW_STEP);
+        pasteWindow = std::min<uint16_t>(PASTE_WINDOW_MAX, next);
+    }
+    ESP_LOGD(TAG, "paste: %u bytes en %u ms, ventana %u, eco %u ms", (unsigned)norm.size(),
+             (unsigned)((nowUs() - t0) / 1000ULL), (unsigned)pasteWindow, (unsigned)(echoLagUs / 1000));
     return ErrorCode::OK;
 }
 
+// Espera el prompt '>>>' sin interrumpir nada: un CR lo hace repintar si la
+// placa ya está en el prompt, y se repite tras cada SYNC_NUDGE_MS sin
+// coincidencias o ante "Press any key". Vuelve apenas aparece el prompt.
 ErrorCode PyBoardUART::waitForReplPrompt(uint32_t timeoutMs) {
-    if (!uart_is_driver_installed(uartNum)) {
-        setError("UART driver not installed");
+    if (!transport || !transport->isOpen()) {
+        setError("Transport not open");
         return ErrorCode::UART_ERROR;
     }
-    const uint64_t deadline = (uint64_t)esp_timer_get_time() + (uint64_t)timeoutMs * 1000ULL;
-    std::string acc; acc.reserve(512);
-    uint8_t tmp[128];
+    const uint64_t deadline = nowUs() + (uint64_t)timeoutMs * 1000ULL;
 
-    interrupt();
-    vTaskDelay(pdMS_TO_TICKS(200));
+    // El motor raw deja la placa en el raw REPL: '>>>' está tras ^B
+    if (inRawRepl) (void)exitRawRepl();
 
-    return ErrorCode::OK;
+    NeedleMatcher m;
+    const uint32_t PROMPT = m.add(">>> ");
+    const uint32_t ANYKEY = m.add("Press any key to enter the REPL");
+    std::string acc;
+    const char CR = '\r';
+    (void)transport->write(&CR, 1);
 
-    /*while ((uint64_t)esp_timer_get_time() < deadline) {
-        int n = uart_read_bytes(uartNum, tmp, sizeof(tmp), pdMS_TO_TICKS(50));
-        if (n > 0) {
-            acc.append(reinterpret_cast<const char *>(tmp), n);
-            if (acc.find(">>>") != std::string::npos) return ErrorCode::OK;
-            if (acc.size() > 4096) acc.erase(0, acc.size() - 1024);
-        }
-        vTaskDelay(pdMS_TO_TICKS(5));
+    for (;;) {
+        const uint64_t now = nowUs();
+        if (now >= deadline) break;
+        const uint32_t slice = (uint32_t)std::min<uint64_t>((deadline - now + 999) / 1000ULL, SYNC_NUDGE_MS);
+        acc.clear();
+        const uint32_t hit = transport->readUntil(m, acc, slice, 256);
+        if (hit & PROMPT) { replState = ReplState::PROMPT; return ErrorCode::OK; }
+        if (hit & ANYKEY || !hit) (void)transport->write(&CR, 1);
     }
     setError("Timeout esperando prompt '>>>'");
-    return ErrorCode::TIMEOUT;*/
+    return ErrorCode::TIMEOUT;
+}
+
+// Deja la placa en el prompt amigable leyendo lo que realmente responde, sin
+// esperas fijas: ^C (y ^D si softReset) y luego, según lo que llegue,
+//   "soft reboot"          -> el reinicio empezó; se espera su prompt
+//   "Press any key ..."    -> CR (CircuitPython terminó code.py)
+//   "raw REPL; CTRL-B ..." -> ^B (salir del raw REPL)
+//   "paste mode"           -> ^C (abandonar el pegado)
+//   '>>> '                 -> listo (tras el reinicio, si se pidió)
+// Si en SYNC_NUDGE_MS no llega nada de eso se vuelve a tocar: un programa que
+// arrancó con el reinicio (code.py), que ignoró el primer ^C, o un raw REPL.
+ErrorCode PyBoardUART::syncRepl(uint32_t timeoutMs, bool softReset) {
+    if (!transport || !transport->isOpen()) {
+        setError("Transport not open");
+        return ErrorCode::UART_ERROR;
+    }
+    const uint64_t t0 = nowUs();
+    const uint64_t deadline = t0 + (uint64_t)timeoutMs * 1000ULL;
+
+    NeedleMatcher m;
+    const uint32_t PROMPT = m.add(">>> ");
+    const uint32_t ANYKEY = m.add("Press any key to enter the REPL");
+    const uint32_t REBOOT = m.add("soft reboot");
+    const uint32_t RAW    = m.add("raw REPL; CTRL-B to exit");
+    const uint32_t PASTE  = m.add("paste mode; Ctrl-C to cancel");
+    std::string acc;
+    const char CR = '\r';
+
+    upload = UploadState();
+    replState = ReplState::UNKNOWN;
+    transport->flush();
+    // En raw REPL ^C no imprime nada: salir primero con ^B
+    if (inRawRepl && transport->write(&CTRL_B, 1) != 1) return ErrorCode::UART_ERROR;
+    if (softReset) {
+        const uint8_t seq[] = {CTRL_C, CTRL_D};
+        if (transport->write(seq, sizeof(seq)) != (int)sizeof(seq)) return ErrorCode::UART_ERROR;
+        agentReady = false;
+    } else {
+        if (transport->write(&CTRL_C, 1) != 1) return ErrorCode::UART_ERROR;
+    }
+
+    bool rebooted = !softReset;
+    unsigned nudges = 0;
+    for (;;) {
+        const uint64_t now = nowUs();
+        if (now >= deadline) break;
+        const uint32_t slice = (uint32_t)std::min<uint64_t>((deadline - now + 999) / 1000ULL, SYNC_NUDGE_MS);
+        acc.clear();
+        const uint32_t hit = transport->readUntil(m, acc, slice, 256);
+
+        if (hit & REBOOT) { rebooted = true; agentReady = false; continue; }
+        if (hit & RAW)    { (void)transport->write(&CTRL_B, 1); inRawRepl = false; continue; }
+        if (hit & PASTE)  { (void)transport->write(&CTRL_C, 1); continue; }
+        if (hit & ANYKEY) { (void)transport->write(&CR, 1); continue; }
+        if (hit & PROMPT) {
+            // Un prompt anterior al reinicio no sirve; y si llegó más detrás
+            // (otro prompt, el banner), se sigue leyendo
+            if (!rebooted || transport->available() > 0) continue;
+            inRawRepl = false;
+            replState = ReplState::PROMPT;
+            ESP_LOGI(TAG, "syncRepl: listo en %u ms", (unsigned)((nowUs() - t0) / 1000ULL));
+            return ErrorCode::OK;
+        }
+        if (!hit) {
+            // Nada útil en SYNC_NUDGE_MS (silencio o un programa imprimiendo):
+            // sin reinicio visto se reintenta ^C^D; si no, se rota ^B (sale
+            // de un raw REPL que no sabíamos; en el prompt repinta el banner),
+            // ^C y CR
+            if (!rebooted) {
+                const uint8_t seq[] = {CTRL_C, CTRL_D};
+                (void)transport->write(seq, sizeof(seq));
+            } else {
+                static const uint8_t poke[] = {CTRL_B, CTRL_C, '\r'};
+                (void)transport->write(&poke[nudges++ % sizeof(poke)], 1);
+            }
+        }
+    }
+    setError("syncRepl: timeout esperando prompt '>>>'");
+    return ErrorCode::TIMEOUT;
 }
 
 ErrorCode PyBoardUART::syncReplCircuitPython(uint32_t timeoutMs) {
-    const uint8_t ctrlC = 0x03;
-    const uint8_t ctrlD = 0x04;
+    return syncRepl(timeoutMs, true);
+}
 
-    write(&ctrlC, 1);
-    vTaskDelay(pdMS_TO_TICKS(120));
-    write(&ctrlD, 1);
+// Sondeo barato antes de escalar: en el prompt un CR devuelve "\r\n>>> " en
+// un par de ms y no se toca el estado del usuario. Si en cambio vuelve el eco
+// de paste mode ("=== "), nada (code.py corriendo o raw REPL) u otra cosa, se
+// pasa a ^C y, si tampoco alcanza, a ^D.
+ErrorCode PyBoardUART::ensureIdle(uint32_t timeoutMs, bool allowReset, IdleLevel *level) {
+    if (!transport || !transport->isOpen()) {
+        setError("Transport not open");
+        return ErrorCode::UART_ERROR;
+    }
+    const uint64_t deadline = nowUs() + (uint64_t)timeoutMs * 1000ULL;
+    auto remainingMs = [&]() -> uint32_t {
+        const uint64_t now = nowUs();
+        return now >= deadline ? 0 : (uint32_t)((deadline - now) / 1000ULL);
+    };
 
-    auto rc = waitForReplPrompt(timeoutMs);
-    if (rc != ErrorCode::OK) {
-        const char crlf[] = "\r\n";
-        write(crlf, sizeof(crlf) - 1);
-        rc = waitForReplPrompt(800);
+    // Raw REPL al día (motor raw entre operaciones): ^B vuelve a '>>>' sin
+    // cortar nada
+    if (inRawRepl && replState == ReplState::RAW && !upload.open) {
+        (void)exitRawRepl();
+        if (replState == ReplState::PROMPT) {
+            if (level) *level = IdleLevel::NONE;
+            return ErrorCode::OK;
+        }
     }
-    return rc;
+
+    if (!inRawRepl && !upload.open) {
+        NeedleMatcher m;
+        const uint32_t PROMPT = m.add(">>> ");
+        m.add("=== ");
+        std::string acc;
+        const char CR = '\r';
+        transport->flush();
+        if (transport->write(&CR, 1) == 1) {
+            const uint32_t hit = transport->readUntil(m, acc, std::min(IDLE_PROBE_MS, remainingMs()), 256);
+            // Solo prompt y nada detrás (si sigue llegando, algo está corriendo)
+            if (hit == PROMPT && transport->available() == 0) {
+                replState = ReplState::PROMPT;
+                if (level) *level = IdleLevel::NONE;
+                return ErrorCode::OK;
+            }
+        }
+    }
+
+    ErrorCode rc = syncRepl(std::min(IDLE_INTERRUPT_MS, remainingMs()), false);
+    if (rc == ErrorCode::OK || !allowReset) {
+        if (level) *level = IdleLevel::INTERRUPT;
+        return rc;
+    }
+
+    if (level) *level = IdleLevel::RESET;
+    return syncRepl(remainingMs(), true);
 }
 
 ErrorCode PyBoardUART::enterRawRepl(bool softReset) {
     ErrorCode err;
     std::string response;
 
-    uint8_t ctrlC[] = {'\r', CTRL_C};
-    err = writeData(ctrlC, sizeof(ctrlC));
-    if (err != ErrorCode::OK) return err;
+    if (inRawRepl && !softReset && replState == ReplState::RAW) return ErrorCode::OK;
 
-    vTaskDelay(100 / portTICK_PERIOD_MS);
+    // Desde un prompt confirmado basta ^A; si no, ^C corta lo que corra (en
+    // raw también vacía lo tipeado) y se espera el prompt en lugar de dormir.
+    // Lo que llegue antes del banner se descarta al buscarlo.
+    if (!promptCached()) {
+        uint8_t ctrlC[] = {'\r', CTRL_C};
+        err = writeData(ctrlC, sizeof(ctrlC));
+        if (err != ErrorCode::OK) return err;
+        if (!inRawRepl) (void)drainToPrompt(*transport, 500);
+    }
+    replState = ReplState::UNKNOWN;
 
     err = flushInput();
     if (err != ErrorCode::OK) return err;
 
-    uint8_t ctrlA[] = {'\r', CTRL_A};
-    err = writeData(ctrlA, sizeof(ctrlA));
+    err = writeData(&CTRL_A, 1);
     if (err != ErrorCode::OK) return err;
 
-    err = readUntil("raw REPL; CTRL-B to exit\r\n>", response, static_cast<uint32_t>(defaultTimeout));
+    err = readUntil("raw REPL; CTRL-B to exit\r\n>", response, RAW_ENTER_MS);
     if (err != ErrorCode::OK) {
         setError("Failed to enter raw REPL");
         return ErrorCode::REPL_ERROR;
@@ -424,6 +1064,7 @@ ErrorCode PyBoardUART::enterRawRepl(bool softReset) {
     if (softReset) {
         err = writeData(&CTRL_D, 1);
         if (err != ErrorCode::OK) return err;
+        agentReady = false;
 
         err = readUntil("soft reboot\r\n", response, static_cast<uint32_t>(defaultTimeout));
         if (err != ErrorCode::OK) {
@@ -431,25 +1072,87 @@ ErrorCode PyBoardUART::enterRawRepl(bool softReset) {
             return ErrorCode::REPL_ERROR;
         }
 
-        err = readUntil("raw REPL; CTRL-B to exit\r\n", response, static_cast<uint32_t>(defaultTimeout));
+        err = readUntil("raw REPL; CTRL-B to exit\r\n>", response, static_cast<uint32_t>(defaultTimeout));
         if (err != ErrorCode::OK) return ErrorCode::REPL_ERROR;
     }
 
     inRawRepl = true;
+    replState = ReplState::RAW;
     ESP_LOGI(TAG, "Entered raw REPL mode");
     return ErrorCode::OK;
 }
 
 ErrorCode PyBoardUART::exitRawRepl() {
-    uint8_t ctrlB[] = {'\r', CTRL_B};
-    ErrorCode err = writeData(ctrlB, sizeof(ctrlB));
+    if (!inRawRepl) return ErrorCode::OK;
+    ErrorCode err = writeData(&CTRL_B, 1);
     if (err != ErrorCode::OK) return err;
 
     inRawRepl = false;
+    // ^B imprime el banner y '>>> ': leerlo deja el prompt confirmado
+    NeedleMatcher m(">>> ");
+    std::string acc;
+    replState = transport->readUntil(m, acc, RAW_ENTER_MS, 256) ? ReplState::PROMPT : ReplState::UNKNOWN;
     ESP_LOGI(TAG, "Exited raw REPL mode");
     return ErrorCode::OK;
 }
 
+void PyBoardUART::setEngine(ExecEngine e) {
+    engine = e;
+    if (e == ExecEngine::FRIENDLY) (void)exitRawRepl();
+    else rawSupport = Support::UNKNOWN;
+}
+
+// Antes de ejecutar: con motor AUTO/RAW entra al raw REPL (sin eco ni
+// pacing). La primera vez que la placa no lo acepta, AUTO queda en FRIENDLY.
+ErrorCode PyBoardUART::prepareEngine() {
+    (void)transport->takeOverflow(); // lo perdido antes del comando no cuenta
+    if (inRawRepl || upload.open || engine == ExecEngine::FRIENDLY || rawSupport == Support::NO) {
+        return ErrorCode::OK;
+    }
+    ErrorCode rc = enterRawRepl(false);
+    if (rc == ErrorCode::OK) {
+        rawSupport = Support::YES;
+        return rc;
+    }
+    if (engine == ExecEngine::RAW) return rc;
+
+    // ^A ignorado: limpiar la línea y seguir con paste mode
+    rawSupport = Support::NO;
+    ESP_LOGW(TAG, "raw REPL no disponible; se usa paste mode");
+    (void)writeData(&CTRL_C, 1);
+    replState = ReplState::UNKNOWN;
+    return ErrorCode::OK;
+}
+
+// La salida de un comando llegó entera: si el RX perdió bytes en el medio
+// (ring lleno) el resultado no sirve aunque el protocolo haya cerrado bien.
+ErrorCode PyBoardUART::checkRxOverflow(ErrorCode rc) {
+    if (rc != ErrorCode::OK || !transport->takeOverflow()) return rc;
+    ESP_LOGW(TAG, "RX overflow: se perdió parte de la salida");
+    setError("RX overflow: board output incomplete");
+    return ErrorCode::UART_ERROR;
+}
+
+// Tras el segundo 0x04 de una respuesta raw la placa manda '>'
+void PyBoardUART::expectRawPrompt() {
+    uint8_t c = 0;
+    replState = (readExact(*transport, &c, 1, 200) == 1 && c == '>') ? ReplState::RAW : ReplState::UNKNOWN;
+}
+
+bool PyBoardUART::recoverAfterInterrupt(uint32_t timeoutMs) {
+    if (inRawRepl) {
+        // salida \x04 traceback(KeyboardInterrupt) \x04 '>'
+        NeedleMatcher m("\x04>");
+        std::string acc;
+        const bool ok = transport->readUntil(m, acc, timeoutMs, 512) != 0;
+        replState = ok ? ReplState::RAW : ReplState::UNKNOWN;
+        return ok;
+    }
+    const bool ok = drainToPrompt(*transport, timeoutMs);
+    replState = ok ? ReplState::PROMPT : ReplState::UNKNOWN;
+    return ok;
+}
+
 ErrorCode PyBoardUART::execRawNoFollow(const std::string &command) {
     if (!inRawRepl) {
         setError("Not in raw REPL mode");
@@ -457,9 +1160,15 @@ ErrorCode PyBoardUART::execRawNoFollow(const std::string &command) {
     }
 
     std::string response;
+    ErrorCode err = ErrorCode::OK;
 
-    ErrorCode err = readUntil(">", response, static_cast<uint32_t>(defaultTimeout));
-    if (err != ErrorCode::OK) return err;
+    // Si el '>' del raw REPL no se vio (programa cortado, error a medias) se
+    // vuelve a pedir el banner: los tracebacks también tienen '>'
+    if (replState != ReplState::RAW) {
+        err = enterRawRepl(false);
+        if (err != ErrorCode::OK) return err;
+    }
+    replState = ReplState::RUNNING;
 
     if (useRawPaste) {
         uint8_t pasteCmd[] = {CTRL_E, 'A', 0x01};
@@ -467,7 +1176,7 @@ ErrorCode PyBoardUART::execRawNoFollow(const std::string &command) {
         if (err != ErrorCode::OK) return err;
 
         uint8_t pasteResponse[2];
-        int len = uart_read_bytes(uartNum, pasteResponse, 2, 100 / portTICK_PERIOD_MS);
+        int len = readExact(*transport, pasteResponse, 2, 100);
 
         if (len == 2 && pasteResponse[0] == 'R') {
             if (pasteResponse[1] == 0x01) {
@@ -475,22 +1184,29 @@ ErrorCode PyBoardUART::execRawNoFollow(const std::string &command) {
             } else {
                 useRawPaste = false;
             }
+        } else {
+            // Firmware sin raw-paste: ^A reinició el raw REPL ("raw REPL; ...>")
+            useRawPaste = false;
+            if (readUntil(">", response, 300) != ErrorCode::OK) return ErrorCode::REPL_ERROR;
         }
     }
 
+    // Sin raw-paste no hay control de flujo: una pausa entre trozos (no tras
+    // el último) deja a la placa vaciar su buffer de RX
     size_t chunkSizeVal = static_cast<size_t>(chunkSize);
     for (size_t i = 0; i < command.length(); i += chunkSizeVal) {
+        if (i) sleepMs(10);
         size_t len = std::min(chunkSizeVal, command.length() - i);
         err = writeData(reinterpret_cast<const uint8_t *>(command.c_str() + i), len);
         if (err != ErrorCode::OK) return err;
-        vTaskDelay(10 / portTICK_PERIOD_MS);
     }
 
     err = writeData(&CTRL_D, 1);
     if (err != ErrorCode::OK) return err;
 
+    // "OK" llega cuando la placa leyó el ^D: lo que quede en el buffer de TX
     uint8_t okResponse[2];
-    int okLen = uart_read_bytes(uartNum, okResponse, 2, 100 / portTICK_PERIOD_MS);
+    int okLen = readExact(*transport, okResponse, 2, static_cast<uint32_t>(defaultTimeout));
     if (okLen != 2 || okResponse[0] != 'O' || okResponse[1] != 'K') {
         setError("Command not accepted by device");
         return ErrorCode::EXEC_ERROR;
@@ -509,6 +1225,7 @@ ErrorCode PyBoardUART::follow(std::string &output, std::string &error, uint32_t
     if (err != ErrorCode::OK) return err;
     if (!error.empty() && error.back() == '\x04') error.pop_back();
 
+    expectRawPrompt();
     return ErrorCode::OK;
 }
 
@@ -525,33 +1242,142 @@ ErrorCode PyBoardUART::execRaw(const std::string &command, std::string &output,
 // Ruta TEXT (CircuitPython): paste literal con pacing, lee hasta ">>>", limpia artefactos
 ErrorCode PyBoardUART::exec(const std::string &command, std::string &output, uint32_t timeoutMs) {
     if (timeoutMs == 0) timeoutMs = static_cast<uint32_t>(defaultTimeout);
+    ErrorCode pre = prepareEngine();
+    if (pre != ErrorCode::OK) return pre;
 
     if (inRawRepl) {
         std::string errTxt;
         auto rc = execRaw(command, output, errTxt, timeoutMs);
+        stripRawOutput(output);
+        stripRawOutput(errTxt);
         if (!errTxt.empty()) {
             ESP_LOGE(TAG, "Execution error: %s", errTxt.c_str());
             setError(errTxt);
             if (rc == ErrorCode::OK) rc = ErrorCode::EXEC_ERROR;
         }
-        return rc;
+        return checkRxOverflow(rc);
     }
 
-    auto rc = ensureAtPrompt(uartNum, 1500);
-    if (rc != ErrorCode::OK) return rc;
-
-    rc = enterPasteMode(uartNum);
-    if (rc != ErrorCode::OK) return rc;
-
-    rc = pasteLiteralBlock(uartNum, command.c_str(), command.size());
+    auto rc = pasteAndRun(command);
     if (rc != ErrorCode::OK) return rc;
 
     std::string raw;
-    rc = readTo(uartNum, ">>>", raw, timeoutMs);
-    if (rc != ErrorCode::OK) return rc;
+    rc = readTo(*transport, ">>>", raw, timeoutMs);
+    if (rc != ErrorCode::OK) { replState = ReplState::UNKNOWN; return rc; }
+    replState = ReplState::PROMPT;
 
     stripPasteArtifacts(raw);
     output.swap(raw);
+    return checkRxOverflow(ErrorCode::OK);
+}
+
+// Igual que exec() pero entrega la salida a medida que llega y corta en el
+// prompt '>>>' sin acumular nada.
+// Si onOutput devuelve false se interrumpe el programa (^C) y se vuelve al prompt.
+ErrorCode PyBoardUART::execStream(const std::string &command, const ChunkCallback &onOutput,
+                                  uint32_t timeoutMs) {
+    if (timeoutMs == 0) timeoutMs = static_cast<uint32_t>(defaultTimeout);
+    const uint64_t deadline = nowUs() + (uint64_t)timeoutMs * 1000ULL;
+
+    ErrorCode rc = prepareEngine();
+    if (rc != ErrorCode::OK) return rc;
+    if (inRawRepl) {
+        rc = execRawNoFollow(command);
+    } else {
+        rc = pasteAndRun(command);
+    }
+    if (rc != ErrorCode::OK) return rc;
+
+    // pasteAndRun() ya consumió el eco: solo hay salida y el prompt final.
+    // Hasta saber si una línea empieza con '>>>' se retienen a lo sumo 3
+    // bytes. En raw REPL la salida termina en 0x04.
+    enum { UNKNOWN, EMIT } lineMode = UNKNOWN;
+    std::string head;       // inicio de línea aún sin clasificar
+    size_t pendingGt = 0;   // '>' retenidos en EMIT por si son el prompt
+    std::string out;
+    uint8_t buf[256];
+    bool finished = false;
+
+    size_t used = 0;
+    size_t n = 0;
+    while (!finished) {
+        const uint64_t now = nowUs();
+        if (now >= deadline) {
+            (void)interrupt();
+            (void)recoverAfterInterrupt(800);
+            setError("execStream: timeout");
+            return ErrorCode::TIMEOUT;
+        }
+        const uint32_t waitMs = (uint32_t)std::min<uint64_t>((deadline - now) / 1000ULL + 1, 50);
+        n = transport->read(buf, sizeof(buf), waitMs);
+
+        out.clear();
+        for (used = 0; used < n && !finished; ++used) {
+            const char c = static_cast<char>(buf[used]);
+            if (inRawRepl) {
+                if (c == 0x04) finished = true;
+                else if (c != '\r') out.push_back(c);
+                continue;
+            }
+            if (c == '\r') continue;
+
+            if (lineMode == EMIT) {
+                if (c == '>') {
+                    if (++pendingGt == 3) finished = true;
+                    continue;
+                }
+                out.append(pendingGt, '>');
+                pendingGt = 0;
+                out.push_back(c);
+                if (c == '\n') lineMode = UNKNOWN;
+                continue;
+            }
+            // UNKNOWN: clasificar por los primeros bytes
+            if (c == '\n') {
+                if (!head.empty()) out += head + "\n";
+                head.clear();
+                continue;
+            }
+            head.push_back(c);
+            if (head == ">>>") { finished = true; continue; }
+            if (std::strncmp(head.c_str(), ">>>", head.size()) == 0) continue;
+            lineMode = EMIT;
+            // los '>' del principio quedan como pendientes del prompt
+            size_t gt = 0;
+            while (gt < head.size() && head[head.size() - 1 - gt] == '>') ++gt;
+            out.append(head, 0, head.size() - gt);
+            pendingGt = gt;
+            head.clear();
+        }
+
+        // Se llama aunque no haya salida (latido) para que el que cancela no
+        // dependa de que el programa imprima
+        const bool more = (out.empty() && finished) ||
+                          onOutput(reinterpret_cast<const uint8_t *>(out.data()), out.size());
+        if (!more && !finished) {
+            (void)interrupt();
+            (void)recoverAfterInterrupt(1500);
+            setError("execStream: cancelled");
+            return ErrorCode::EXEC_ERROR;
+        }
+    }
+
+    // Lo leído tras el fin (traceback en raw, espacio del prompt) se devuelve
+    if (used < n) transport->unread(reinterpret_cast<const char *>(buf + used), n - used);
+    if (!inRawRepl) replState = ReplState::PROMPT;
+    if (inRawRepl) {
+        // Tras la salida viene el traceback (si hubo) hasta el segundo 0x04
+        std::string errTxt;
+        rc = readUntil("\x04", errTxt, static_cast<uint32_t>(defaultTimeout));
+        if (rc != ErrorCode::OK) return rc;
+        if (!errTxt.empty() && errTxt.back() == '\x04') errTxt.pop_back();
+        expectRawPrompt();
+        if (!errTxt.empty()) {
+            (void)onOutput(reinterpret_cast<const uint8_t *>(errTxt.data()), errTxt.size());
+            setError(errTxt);
+            return ErrorCode::EXEC_ERROR;
+        }
+    }
     return ErrorCode::OK;
 }
 
@@ -579,46 +1405,31 @@ ErrorCode PyBoardUART::execFriendly(const std::string &command,
 
     uint8_t ctrlE = 0x05;
     write(&ctrlE, 1);
-    vTaskDelay(pdMS_TO_TICKS(60));
-
-    auto toCRLF = [](const std::string &s) {
-        std::string o; o.reserve(s.size()+8);
-        for (char c: s) {
-            if (c=='\n') { o+="\r\n"; }
-            else { o.push_back(c=='\r' ? '\r' : c); }
-        }
-        return o;
-    };
-
-    std::string prog;
-    prog.reserve(command.size() + 256);
-    prog += "print('<<<BEGIN>>>')\r\n";
-    prog += "try:\r\n";
-    {
-        std::string crlf = toCRLF(command);
-        size_t pos = 0;
-        while (pos < crlf.size()) {
-            size_t e = crlf.find("\r\n", pos);
-            std::string line = (e == std::string::npos) ? crlf.substr(pos)
-                                                        : crlf.substr(pos, e - pos);
-            prog += "  " + line + "\r\n";
-            if (e == std::string::npos) break;
-            pos = e + 2;
-        }
+    sleepMs(60);
+
+    // Cada línea con un espacio de sangría dentro del try, en CRLF
+    std::string body;
+    body.reserve(command.size() + command.size() / 16 + 4);
+    bool lineStart = true;
+    for (char c : command) {
+        if (c == '\r') continue;
+        if (lineStart) { body.push_back(' '); lineStart = false; }
+        if (c == '\n') { body += "\r\n"; lineStart = true; }
+        else body.push_back(c);
     }
-    prog += "except Exception as e:\r\n";
-    prog += "  import sys,traceback\r\n";
-    prog += "  sys.print_exception(e)\r\n";
-    prog += "print('<<<END>>>')\r\n";
+    if (!lineStart) body += "\r\n";
+    if (body.empty()) body = " pass\r\n";
+    render<FRIENDLY_WRAP>(cmd, body);
 
-    auto wrc = write(prog);
+    auto wrc = write(cmd);
     if (wrc != ErrorCode::OK) return wrc;
 
     uint8_t ctrlD = 0x04;
     write(&ctrlD, 1);
 
-    std::string cap;
-    rc = readUntil(">>>", cap, timeoutMs);
+    std::string cap, tail;
+    rc = readUntil("<<<END>>>", cap, timeoutMs);
+    if (rc == ErrorCode::OK) rc = readUntil(">>>", tail, timeoutMs);
     if (rc != ErrorCode::OK) { setError("Timeout leyendo salida hasta >>>"); return rc; }
 
     const char *B = "<<<BEGIN>>>", *E = "<<<END>>>";
@@ -635,8 +1446,8 @@ ErrorCode PyBoardUART::execFriendly(const std::string &command,
 }
 
 ErrorCode PyBoardUART::eval(const std::string &expression, std::string &result, uint32_t timeoutMs) {
-    std::string command = "print(repr(" + std::string(expression) + "))";
-    ErrorCode err = exec(command, result, timeoutMs);
+    render<CALL_EVAL>(cmd, expression);
+    ErrorCode err = exec(cmd, result, timeoutMs);
     if (err == ErrorCode::OK) {
         while (!result.empty() && (result.back() == '\n' || result.back() == '\r'))
             result.pop_back();
@@ -649,17 +1460,24 @@ ErrorCode PyBoardUART::eval(const std::string &expression, std::string &result,
 // ============================================================================
 std::string PyBoardUART::base64Encode(const std::vector<uint8_t> &data) {
     std::string encoded;
+    base64Append(data.data(), data.size(), encoded);
+    return encoded;
+}
+
+// Agrega a 'out' sin copiar la entrada (tramas de subida)
+void PyBoardUART::base64Append(const uint8_t *data, size_t len, std::string &out) {
+    const size_t start = out.size();
+    out.reserve(start + (len + 2) / 3 * 4);
     int val = 0, valb = -6;
-    for (uint8_t c : data) {
-        val = (val << 8) + c; valb += 8;
+    for (size_t i = 0; i < len; ++i) {
+        val = (val << 8) + data[i]; valb += 8;
         while (valb >= 0) {
-            encoded.push_back(base64_chars[(val >> valb) & 0x3F]);
+            out.push_back(base64_chars[(val >> valb) & 0x3F]);
             valb -= 6;
         }
     }
-    if (valb > -6) encoded.push_back(base64_chars[((val << 8) >> (valb + 8)) & 0x3F]);
-    while (encoded.size() % 4) encoded.push_back('=');
-    return encoded;
+    if (valb > -6) out.push_back(base64_chars[((val << 8) >> (valb + 8)) & 0x3F]);
+    while ((out.size() - start) % 4) out.push_back('=');
 }
 
 std::vector<uint8_t> PyBoardUART::base64Decode(const std::string &encoded) {
@@ -688,50 +1506,245 @@ std::vector<uint8_t> PyBoardUART::base64Decode(const std::string &encoded) {
 }
 
 // ============================================================================
-// Filesystem
+// Agente residente
 // ============================================================================
-ErrorCode PyBoardUART::listDir(const std::string &path, std::vector<FileInfo> &files) {
-    files.clear();
-    std::string normPath = path.empty() ? "/" : path;
-
-    std::stringstream cmd;
-    cmd
-        << "import os\r\n"
-        << "BASE=" << pyQuote(normPath) << "\r\n"
-        << "try:\r\n"
-        << "  il = os.ilistdir\r\n"
-        << "  use_il = True\r\n"
-        << "except AttributeError:\r\n"
-        << "  use_il = False\r\n"
-        << "if use_il:\r\n"
-        << "  for f in os.ilistdir(BASE):\r\n"
-        << "    name=f[0]\r\n"
-        << "    mode=f[1]\r\n"
-        << "    size=(f[3] if len(f)>3 else 0)\r\n"
-        << "    print(name+'|'+str(mode)+'|'+str(size))\r\n"
-        << "else:\r\n"
-        << "  L = os.listdir(BASE if BASE else '/')\r\n"
-        << "  for name in L:\r\n"
-        << "    p=(BASE.rstrip('/')+'/'+name) if BASE and BASE!='/' else '/' + name\r\n"
-        << "    try:\r\n"
-        << "      st=os.stat(p)\r\n"
-        << "      print(name+'|'+str(st[0])+'|'+str(st[6]))\r\n"
-        << "    except Exception:\r\n"
-        << "      print(name+'|0|0')\r\n";
+std::string PyBoardUART::agentSource() const {
+    std::string src;
+    if (profile.valid && !profile.binascii.empty()) {
+        src = "import os as _eo,sys as _es," + profile.binascii + " as _eb\n";
+    } else {
+        src = AGENT_IMPORT_ANY;
+    }
+    src += "class _e:\n V=" + std::to_string(AGENT_VERSION) + "\n";
+    src += AGENT_HEAD;
+    src += (profile.valid && profile.ilistdir) ? AGENT_IT_ILISTDIR : AGENT_IT_ANY;
+    src += AGENT_TAIL;
+    return src;
+}
 
-    std::string output;
-    ErrorCode err = exec(cmd.str(), output);
-    if (err != ErrorCode::OK) return err;
+ErrorCode PyBoardUART::ensureAgent() {
+    if (agentReady) return ErrorCode::OK;
+
+    std::string out;
+    ErrorCode rc = exec(agentSource(), out);
+    if (rc != ErrorCode::OK) return rc;
+
+    std::string ver;
+    if (!agentReply(out, "@@AG", ver) || std::atoi(ver.c_str()) != AGENT_VERSION) {
+        setError("Agent install failed: " + out);
+        return ErrorCode::EXEC_ERROR;
+    }
+    agentReady = true;
+    ESP_LOGI(TAG, "Agente v%d instalado", AGENT_VERSION);
+    return ErrorCode::OK;
+}
+
+// Ejecuta una sola línea en el prompt (sin paste mode) y devuelve su salida
+ErrorCode PyBoardUART::execLine(const std::string &line, std::string &output, uint32_t timeoutMs) {
+    if (timeoutMs == 0) timeoutMs = static_cast<uint32_t>(defaultTimeout);
+    ErrorCode pre = prepareEngine();
+    if (pre != ErrorCode::OK) return pre;
+
+    if (inRawRepl) {
+        std::string errTxt;
+        ErrorCode rc = execRaw(line, output, errTxt, timeoutMs);
+        if (rc == ErrorCode::OK && !errTxt.empty()) output += errTxt;
+        stripRawOutput(output);
+        return checkRxOverflow(rc);
+    }
+
+    ErrorCode rc = readyAtPrompt(1500);
+    if (rc != ErrorCode::OK) return rc;
+    replState = ReplState::RUNNING;
+    rc = writeData(line + "\r");
+    if (rc != ErrorCode::OK) return rc;
+
+    std::string raw;
+    rc = readTo(*transport, ">>>", raw, timeoutMs);
+    if (rc != ErrorCode::OK) { replState = ReplState::UNKNOWN; return rc; }
+    replState = ReplState::PROMPT;
+
+    // Descarta el eco de la línea tipeada
+    size_t nl = raw.find('\n');
+    raw.erase(0, nl == std::string::npos ? raw.size() : nl + 1);
+    stripPasteArtifacts(raw);
+    output.swap(raw);
+    return checkRxOverflow(ErrorCode::OK);
+}
+
+// La placa se reinició y '_e' ya no existe: el traceback termina en
+// "NameError: name '_e' isn't defined" (o "NameError:" a secas en builds con
+// mensajes cortos). Un NameError en cualquier otra parte de la salida es dato.
+static bool agentMissing(const std::string &out) {
+    for (size_t pos = 0; pos < out.size();) {
+        size_t end = out.find('\n', pos);
+        if (end == std::string::npos) end = out.size();
+        size_t len = end - pos;
+        while (len && (out[pos + len - 1] == '\r' || out[pos + len - 1] == ' ')) --len;
+        const std::string line = out.substr(pos, len);
+        if (line.rfind("NameError", 0) == 0 &&
+            (line.find("'_e'") != std::string::npos || line == "NameError" || line == "NameError:"))
+            return true;
+        pos = end + 1;
+    }
+    return false;
+}
+
+// Llama al agente; si la placa se reinició (NameError) lo reinstala una vez.
+// En paste mode una línea larga tipeada en el prompt puede desbordar la RX
+// de la placa (no hay ventana de eco): esas van por exec().
+ErrorCode PyBoardUART::agentCall(const std::string &call, std::string &output, uint32_t timeoutMs) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        ErrorCode rc = ensureAgent();
+        if (rc != ErrorCode::OK) return rc;
+
+        rc = (!inRawRepl && call.size() > AGENT_LINE_MAX) ? exec(call, output, timeoutMs)
+                                                          : execLine(call, output, timeoutMs);
+        if (rc != ErrorCode::OK) return rc;
+        if (!agentMissing(output)) return ErrorCode::OK;
+        agentReady = false;
+    }
+    setError("Agent not available: " + output);
+    return ErrorCode::EXEC_ERROR;
+}
+
+// Operaciones simples del agente que responden @@K / @@E
+static ErrorCode agentOk(const std::string &out, const char *what, std::string &err) {
+    std::string rest;
+    if (agentReply(out, "@@K", rest)) return ErrorCode::OK;
+    err = std::string(what) + " failed: " + rest;
+    return ErrorCode::EXEC_ERROR;
+}
+
+// ============================================================================
+// Perfil de la placa
+// ============================================================================
+std::string BoardProfile::serialize() const {
+    return "d=" + dialect + "|v=" + version + "|u=" + uid + "|m=" + machine +
+           "|r=" + (rawRepl ? "1" : "0") + "|rp=" + (rawPaste ? "1" : "0") +
+           "|b=" + binascii + "|c=" + (crc32 ? "1" : "0") +
+           "|df=" + (deflate ? "1" : "0") + "|z=" + zlib + "|hl=" + hashlib +
+           "|il=" + (ilistdir ? "1" : "0") + "|mf=" + std::to_string(memFree) +
+           "|pw=" + std::to_string(pasteWindow);
+}
+
+// Acepta la línea del sondeo o lo guardado por serialize(); claves
+// desconocidas se ignoran. valid solo si vino el sondeo completo (mf).
+bool BoardProfile::parse(const std::string &s) {
+    *this = BoardProfile();
+    bool full = false;
+    size_t pos = 0;
+    while (pos <= s.size()) {
+        size_t end = s.find('|', pos);
+        if (end == std::string::npos) end = s.size();
+        const std::string item = s.substr(pos, end - pos);
+        pos = end + 1;
+        const size_t eq = item.find('=');
+        if (eq == std::string::npos) continue;
+        const std::string k = item.substr(0, eq), v = item.substr(eq + 1);
+        if      (k == "d")  dialect = v;
+        else if (k == "v")  version = v;
+        else if (k == "u")  uid = v;
+        else if (k == "m")  machine = v;
+        else if (k == "r")  rawRepl = (v == "1");
+        else if (k == "rp") rawPaste = (v == "1");
+        else if (k == "b")  binascii = v;
+        else if (k == "c")  crc32 = (v == "1");
+        else if (k == "df") deflate = (v == "1");
+        else if (k == "z")  zlib = v;
+        else if (k == "hl") hashlib = v;
+        else if (k == "il") ilistdir = (v == "1");
+        else if (k == "mf") { memFree = (uint32_t)std::strtoul(v.c_str(), nullptr, 10); full = true; }
+        else if (k == "pw") pasteWindow = (uint16_t)std::strtoul(v.c_str(), nullptr, 10);
+    }
+    valid = full && !dialect.empty() && !version.empty();
+    return !dialect.empty();
+}
+
+// Un solo exec: el motor (raw / paste) queda decidido en el mismo paso, así
+// que el perfil registra lo que realmente funcionó.
+ErrorCode PyBoardUART::probeBoard(BoardProfile &out, bool full) {
+    std::string text;
+    render<CALL_PROBE>(cmd, PROBE_SRC, full ? 1 : 0);
+    ErrorCode rc = exec(cmd, text);
+    if (rc != ErrorCode::OK) return rc;
+
+    std::string line;
+    if (!agentReply(text, "@@P", line) || !out.parse(line)) {
+        setError("probe: unexpected reply: " + text);
+        return ErrorCode::EXEC_ERROR;
+    }
+    if (!full) return ErrorCode::OK;
+
+    out.rawRepl = (rawSupport == Support::YES);
+    out.rawPaste = out.rawRepl && useRawPaste;
+    out.pasteWindow = pasteWindow;
+    applyProfile(out);
+    ESP_LOGI(TAG, "Placa %s %s (%s) raw=%d raw-paste=%d b64=%s heap=%u", out.dialect.c_str(),
+             out.version.c_str(), out.uid.empty() ? "sin id" : out.uid.c_str(), (int)out.rawRepl,
+             (int)out.rawPaste, out.binascii.empty() ? "-" : out.binascii.c_str(), (unsigned)out.memFree);
+    return ErrorCode::OK;
+}
+
+void PyBoardUART::applyProfile(const BoardProfile &p) {
+    if (!p.valid) return;
+    // El agente instalado con otra fuente sigue sirviendo: no se reinstala
+    if (p.uid != profile.uid) {
+        manifest.clear();
+        digestKind = DigestKind::UNKNOWN;
+        boardInflate = Support::UNKNOWN;
+    }
+    // Otra placa o primer perfil: el techo del trozo sale de su mem_free
+    if (p.uid != profile.uid || !profile.valid) chunkNow = 0;
+    // Primer dato para el manifiesto; _e.hs lo corrige si hashlib no tiene sha256
+    if (digestKind == DigestKind::UNKNOWN)
+        digestKind = p.hashlib.empty() ? DigestKind::CRC32 : DigestKind::SHA256;
+    profile = p;
+    rawSupport = p.rawRepl ? Support::YES : Support::NO;
+    useRawPaste = p.rawPaste;
+    // Ventana ya probada en esta placa: seguir desde ahí sin arranque lento
+    if (p.pasteWindow >= PASTE_WINDOW_MIN && p.pasteWindow <= PASTE_WINDOW_MAX) {
+        pasteWindow = p.pasteWindow;
+        pasteSlowStart = false;
+    }
+}
+
+// ============================================================================
+// Filesystem
+// ============================================================================
+ErrorCode PyBoardUART::listDir(const std::string &path, std::vector<FileInfo> &files) {
+    files.clear();
+    std::string normPath = path.empty() ? "/" : path;
+
+    std::string output;
+    render<CALL_LS>(cmd, PyQuoted{normPath});
+    ErrorCode err = agentCall(cmd, output);
+    if (err != ErrorCode::OK) return err;
 
     stripANSIEscapes(output);
     stripCR(output);
 
-    std::istringstream stream(output);
+    // El sentinela es la última línea ("@@L <n>" o "@@E ..."): un nombre que
+    // empiece con "@@" no corta el listado. Las entradas se parten desde la
+    // derecha, así un '|' en el nombre tampoco las rompe.
+    size_t tail = output.find_last_not_of('\n');
+    tail = (tail == std::string::npos) ? 0 : output.rfind('\n', tail);
+    tail = (tail == std::string::npos) ? 0 : tail + 1;
+    const std::string last = output.substr(tail);
+    if (last.size() < 5 || last.compare(0, 4, "@@L ") != 0 ||
+        last.find_first_not_of("0123456789\n", 4) != std::string::npos) {
+        std::string rest;
+        (void)agentReply(last, "@@L", rest);
+        setError("listDir failed: " + rest);
+        return ErrorCode::FILE_ERROR;
+    }
+
+    std::istringstream stream(output.substr(0, tail));
     std::string line;
     while (std::getline(stream, line)) {
         if (!line.empty() && line.back() == '\r') line.pop_back();
-        size_t pos1 = line.find('|');
-        size_t pos2 = (pos1 == std::string::npos) ? std::string::npos : line.find('|', pos1 + 1);
+        size_t pos2 = line.rfind('|');
+        size_t pos1 = (pos2 == std::string::npos || pos2 == 0) ? std::string::npos : line.rfind('|', pos2 - 1);
         if (pos1 != std::string::npos && pos2 != std::string::npos) {
             std::string name = line.substr(0, pos1);
             int mode = std::atoi(line.substr(pos1 + 1, pos2 - pos1 - 1).c_str());
@@ -758,238 +1771,1039 @@ ErrorCode PyBoardUART::writeFile(const std::string &path, const std::string &bas
 ErrorCode PyBoardUART::writeFileChunk(const std::string& path,
                                       const uint8_t* data, size_t len,
                                       bool append) {
-    // 1) Abrir en modo adecuado
-    std::string openCmd =
-        "f=open(" + pyQuote(path) + (append ? ",'ab')\n" : ",'wb')\n") +
-        "w=f.write";
-    {
-        ErrorCode e = exec(openCmd);
-        if (e != ErrorCode::OK) return e;
-    }
-
-    // 2) Base64 del trozo
-    std::vector<uint8_t> v(data, data + len);
-    std::string b64 = base64Encode(v);
-
-    // 3) Escribir + sentinelas para robustez
-    std::string writeCmd =
-        "try:\n"
-        " import ubinascii as b\n"
-        "except ImportError:\n"
-        " import binascii as b\n"
-        "x=b.a2b_base64(" + pyQuote(b64) + ")\n"
-        "w(x)\n"
-        "print('@@WCHUNK', len(x))\n";
+    return writeStream(path, data, len, append);
+}
 
-    std::string out;
-    ErrorCode e2 = exec(writeCmd, out);
-    if (e2 != ErrorCode::OK) {
-        exec("f.close()");
-        return e2;
-    }
 
-    // (Opcional) validar que vimos @@WCHUNK N
-    bool ok=false;
-    {
-        stripCR(out);
-        std::istringstream is(out);
-        std::string line;
-        while (std::getline(is, line)) {
-            if (!line.empty() && line.back()=='\r') line.pop_back();
-            int n=0;
-            if (std::sscanf(line.c_str(), "@@WCHUNK %d", &n) == 1) { ok = (n==(int)len); break; }
+ErrorCode PyBoardUART::readFileRaw(const std::string &path, std::vector<uint8_t> &content) {
+    content.clear();
+    return readFileStream(path, [&](const uint8_t *data, size_t len) {
+        content.insert(content.end(), data, data + len);
+        return true;
+    });
+}
+
+// Lectura por ventana: la placa envía el archivo en líneas
+// "<seq><crc><base64>" (o, con WireCodec::RAW y stdout.buffer, tramas
+// "llll<seq><crc><bytes>"), cierra con "@@EOF"/"0000" y espera un byte de
+// crédito ('A') del host cada STREAM_WINDOW tramas (backpressure). Una trama
+// dañada (CRC, cabecera, bytes perdidos) se contesta, tras descartar la
+// entrada, con "N<seq>": la placa vuelve a esa posición del archivo y sigue
+// desde ahí. Cada trozo va directo a onChunk; si devuelve false se corta el
+// programa con ^C y se vuelve al prompt. Al final "@@END <bytes>" se compara
+// con lo recibido.
+ErrorCode PyBoardUART::readFileStream(const std::string &path, const ChunkCallback &onChunk) {
+    const size_t chunk = transferChunk();
+    const uint64_t t0 = nowUs();
+    size_t total = 0, resent = 0;
+    bool binary = false;
+    ErrorCode err = readStream(path, onChunk, chunk, total, resent, binary);
+
+    lastTransfer.chunk = chunk;
+    lastTransfer.bytes = total;
+    lastTransfer.ms = (uint32_t)((nowUs() - t0) / 1000ULL);
+    lastTransfer.resent = resent;
+    chunkFeedback(err, total / chunk);
+    if (err != ErrorCode::OK) return err;
+
+    const std::string again = resent ? ", " + std::to_string(resent) + " reenvíos" : "";
+    ESP_LOGI(TAG, "readFileStream %s: %u bytes en %u ms (%u B/s), trozo %u%s%s", path.c_str(),
+             (unsigned)total, (unsigned)lastTransfer.ms, (unsigned)lastTransfer.bytesPerSec(),
+             (unsigned)chunk, binary ? ", binario" : "", again.c_str());
+    return ErrorCode::OK;
+}
+
+ErrorCode PyBoardUART::readStream(const std::string &path, const ChunkCallback &onChunk,
+                                  size_t chunkSizeVal, size_t &total, size_t &resent, bool &binaryOut) {
+    const uint32_t tmo = static_cast<uint32_t>(defaultTimeout);
+
+    render<CALL_RS>(cmd, PyQuoted{path}, chunkSizeVal, STREAM_WINDOW,
+                    wireCodec == WireCodec::RAW ? 1 : 0);
+    ErrorCode err = startCall(cmd);
+    if (err != ErrorCode::OK) return err;
+
+    // "@@GO <e> <c>": e=1 tramas binarias; c=0 si la placa no tiene crc32
+    // (el campo viaja en 0 y solo se controla la secuencia)
+    std::string line;
+    err = waitForLine("@@GO", line, tmo);
+    if (err != ErrorCode::OK) return err;
+    int binary = 0, checked = 1;
+    (void)std::sscanf(line.c_str(), "@@GO %d %d", &binary, &checked);
+    binaryOut = binary != 0;
+
+    const uint8_t credit = 'A';
+    uint8_t seq = 0;
+    bool resync = false; // se pidió reenvío: un "0000" es de la pasada anterior
+    unsigned retries = 0;
+    std::vector<uint8_t> chunk;
+
+    auto nak = [&]() -> ErrorCode {
+        if (++retries > STREAM_RETRIES) {
+            (void)interrupt();
+            (void)finishProgram(tmo);
+            setError("readFileStream: too many retransmissions");
+            return ErrorCode::FILE_ERROR;
+        }
+        // Si la placa ya cerró (se dañó el fin de archivo) no hay a quién
+        // pedirle reenvío: se deja el "@@END" para el lazo. Un traceback es
+        // error de la placa, no ruido.
+        const std::string junk = drainQuiet();
+        const size_t end = junk.find("@@END");
+        if (end != std::string::npos) {
+            transport->unread(junk.data() + end, junk.size() - end);
+            return ErrorCode::OK;
+        }
+        const size_t tb = junk.find("Traceback");
+        if (tb != std::string::npos) {
+            transport->unread(junk.data() + tb, junk.size() - tb);
+            if (waitForLine("@@END", line, STREAM_RESYNC_MS) != ErrorCode::EXEC_ERROR)
+                setError("readFileStream aborted: " + junk.substr(tb));
+            return ErrorCode::EXEC_ERROR;
+        }
+        char msg[4];
+        std::snprintf(msg, sizeof(msg), "N%02x", (unsigned)seq);
+        resync = true;
+        ++resent;
+        return writeData(reinterpret_cast<const uint8_t *>(msg), 3);
+    };
+
+    for (;;) {
+        bool framed = false; // cabecera legible
+        unsigned long fseq = 0, fcrc = 0;
+        if (binary) {
+            char hdr[FRAME_HDR + 1] = {};
+            const int got = readExact(*transport, reinterpret_cast<uint8_t *>(hdr), 4, tmo);
+            if (got == 0) {
+                setError("readFileStream: timeout waiting for data");
+                return ErrorCode::TIMEOUT;
+            }
+            if (got == 4 && std::memcmp(hdr, "@@EN", 4) == 0) {
+                // La placa cerró y el "0000" se perdió en el descarte
+                transport->unread(hdr, 4);
+                err = waitForLine("@@END", line, tmo);
+                if (err != ErrorCode::OK) return err;
+                break;
+            }
+            if (got == 4 && std::memcmp(hdr, "0000", 4) == 0) {
+                if (resync) continue; // cierre de la pasada anterior al NAK
+                // Un largo dañado también puede leerse "0000": el cierre de
+                // verdad va seguido de "@@END" (la placa ya tiene los créditos)
+                char peek[5];
+                const int n = readExact(*transport, reinterpret_cast<uint8_t *>(peek), 5, resyncMs());
+                transport->unread(peek, n);
+                if (n == 5 && std::memcmp(peek, "@@END", 5) == 0) {
+                    err = waitForLine("@@END", line, tmo);
+                    if (err != ErrorCode::OK) return err;
+                    break;
+                }
+            } else if (got == 4) {
+                char *endp = nullptr;
+                const unsigned long len = std::strtoul(hdr, &endp, 16);
+                if (endp == hdr + 4 && len <= chunkSizeVal &&
+                    readExact(*transport, reinterpret_cast<uint8_t *>(hdr + 4), FRAME_HDR - 4,
+                              resyncMs()) == static_cast<int>(FRAME_HDR - 4)) {
+                    chunk.resize(len);
+                    framed = readExact(*transport, chunk.data(), len, resyncMs()) == static_cast<int>(len) &&
+                             std::sscanf(hdr + 4, "%2lx%8lx", &fseq, &fcrc) == 2;
+                }
+            }
+        } else {
+            err = readLine(line, tmo);
+            if (err != ErrorCode::OK) {
+                if (err == ErrorCode::REPL_ERROR) {
+                    stripPasteArtifacts(line);
+                    setError("readFileStream aborted: " + line);
+                    return ErrorCode::EXEC_ERROR;
+                }
+                setError("readFileStream: timeout waiting for data");
+                return err;
+            }
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.rfind("@@EOF", 0) == 0) {
+                if (resync) continue;
+                err = waitForLine("@@END", line, tmo);
+                if (err != ErrorCode::OK) return err;
+                break;
+            }
+            if (line.rfind("@@END", 0) == 0) break;
+            if (line.empty()) continue;
+            if (line.size() > FRAME_HDR - 4 &&
+                std::sscanf(line.c_str(), "%2lx%8lx", &fseq, &fcrc) == 2) {
+                chunk = base64Decode(line.substr(FRAME_HDR - 4));
+                framed = true;
+            }
+        }
+
+        if (!framed || fseq != seq || (checked && fcrc != crc32(0, chunk.data(), chunk.size()))) {
+            err = nak();
+            if (err != ErrorCode::OK) return err;
+            continue;
         }
+
+        resync = false;
+        retries = 0;
+        ++seq;
+        total += chunk.size();
+        if (!onChunk(chunk.data(), chunk.size())) {
+            (void)interrupt();
+            (void)finishProgram(tmo);
+            setError("readFileStream: cancelled");
+            return ErrorCode::EXEC_ERROR;
+        }
+        err = writeData(&credit, 1);
+        if (err != ErrorCode::OK) return err;
     }
-    exec("f.close()");
-    if (!ok) {
-        setError("writeFileChunk: missing @@WCHUNK ack");
-        return ErrorCode::EXEC_ERROR;
+
+    err = finishProgram(tmo);
+    if (err != ErrorCode::OK) return err;
+
+    unsigned long n = 0;
+    if (std::sscanf(line.c_str(), "@@END %lu", &n) == 1 && n != total) {
+        setError("readFileStream: size mismatch");
+        return ErrorCode::FILE_ERROR;
     }
     return ErrorCode::OK;
 }
 
+// Trozo para la próxima transferencia. El techo sale del heap libre de la
+// placa: ws/rs tienen a la vez la trama codificada, los bytes decodificados
+// y copias intermedias, y el heap de MicroPython se fragmenta.
+size_t PyBoardUART::transferChunk() {
+    const size_t fixed = static_cast<size_t>(chunkSize);
+    if (!chunkAuto) return fixed;
+    if (chunkNow == 0) {
+        size_t cap = CHUNK_UNKNOWN_MAX;
+        if (profile.valid && profile.memFree) {
+            const size_t fit = profile.memFree / CHUNK_HEAP_DIV;
+            for (cap = CHUNK_MIN; cap * 2 <= std::min(fit, CHUNK_MAX);) cap *= 2;
+        }
+        chunkCeiling = cap;
+        chunkNow = std::min(std::max(fixed, CHUNK_MIN), chunkCeiling);
+    }
+    return chunkNow;
+}
 
-ErrorCode PyBoardUART::readFileRaw(const std::string &path, std::vector<uint8_t> &content) {
-    content.clear();
+// Ajusta el trozo con el resultado de una transferencia de 'frames' tramas
+// (datos en lastTransfer). Un error de la placa ajeno a la línea (archivo
+// inexistente, cancelación) no cambia nada.
+void PyBoardUART::chunkFeedback(ErrorCode err, size_t frames) {
+    if (!chunkAuto || lastTransfer.chunk != chunkNow) return;
+    const size_t before = chunkNow;
+    const bool noMemory = err != ErrorCode::OK && lastError.find("MemoryError") != std::string::npos;
+    if (noMemory) chunkCeiling = std::max(CHUNK_MIN, chunkNow / 2);
+
+    // Los errores de línea son por byte: con reenvíos en más de ~1 de cada 16
+    // tramas conviene una trama más corta; por debajo de 1 cada 64 se crece
+    // (entre medio se queda, para no oscilar)
+    if (noMemory || err == ErrorCode::TIMEOUT || err == ErrorCode::FILE_ERROR ||
+        lastTransfer.resent * 16 > frames + 1) {
+        chunkNow = std::max(CHUNK_MIN, chunkNow / 2);
+    } else if (err == ErrorCode::OK && frames >= CHUNK_GROW_FRAMES &&
+               lastTransfer.resent * 64 <= frames) {
+        chunkNow = std::min(chunkCeiling, chunkNow * 2);
+    }
+    if (chunkNow != before)
+        ESP_LOGI(TAG, "trozo %u -> %u (techo %u)", (unsigned)before, (unsigned)chunkNow,
+                 (unsigned)chunkCeiling);
+}
 
-    FileInfo info;
-    ErrorCode err = getFileInfo(path, info);
+// Descarta lo que llegue hasta STREAM_QUIET_MS sin bytes (tras una trama
+// dañada, para volver a sincronizar las tramas) y lo devuelve
+std::string PyBoardUART::drainQuiet() {
+    std::string junk;
+    uint8_t buf[64];
+    const uint64_t deadline = nowUs() + (uint64_t)defaultTimeout * 1000ULL;
+    size_t n;
+    while ((n = transport->read(buf, sizeof(buf), STREAM_QUIET_MS)) > 0) {
+        junk.append(reinterpret_cast<const char *>(buf), n);
+        if (nowUs() >= deadline) break;
+    }
+    return junk;
+}
+
+// Plazo sin respuesta antes de sospechar bytes perdidos: una ventana de
+// tramas máximas en la línea más STREAM_RESYNC_MS
+uint32_t PyBoardUART::resyncMs() const {
+    const uint32_t baud = static_cast<uint32_t>(baudRate);
+    return STREAM_RESYNC_MS +
+           (uint32_t)(STREAM_WINDOW * (FRAME_HDR + FRAME_MAX) * 10ULL * 1000ULL / (baud ? baud : 115200));
+}
+
+ErrorCode PyBoardUART::writeFileRaw(const std::string &path, const std::vector<uint8_t> &content) {
+    if (unchangedOnBoard(path, content.data(), content.size(), true)) {
+        ESP_LOGI(TAG, "write %s: la placa ya tiene ese contenido", path.c_str());
+        return ErrorCode::OK;
+    }
+    return writeWhole(path, content.data(), content.size());
+}
+
+// Archivo completo por ventana; queda anotado en el manifiesto
+ErrorCode PyBoardUART::writeWhole(const std::string &path, const uint8_t *data, size_t size) {
+    ErrorCode err = writeStream(path, data, size, false);
+    if (err == ErrorCode::OK) manifestRecord(path, data, size, upload.mtime);
+    return err;
+}
+
+// ============================================================================
+// Manifiesto (contenido ya presente en la placa)
+// ============================================================================
+std::string PyBoardUART::contentDigest(const uint8_t *data, size_t size) const {
+    char hex[65];
+    if (digestKind == DigestKind::SHA256) {
+        uint8_t d[32];
+        sha256(data, size, d);
+        for (int i = 0; i < 32; ++i) std::snprintf(hex + 2 * i, 3, "%02x", d[i]);
+    } else {
+        std::snprintf(hex, sizeof(hex), "%08x", (unsigned)crc32(0, data, size));
+    }
+    return hex;
+}
+
+// Con una entrada que coincide alcanza con comparar tamaño y mtime (la placa
+// no lee el archivo). Sin entrada, y si hashOnBoard, la placa hashea su copia.
+// Una llamada al agente en ambos casos.
+bool PyBoardUART::unchangedOnBoard(const std::string &path, const uint8_t *data, size_t size,
+                                   bool hashOnBoard) {
+    auto it = manifest.find(path);
+    const bool known = it != manifest.end() && digestKind != DigestKind::UNKNOWN &&
+                       it->second.size == size && it->second.mtime != 0 &&
+                       it->second.digest == contentDigest(data, size);
+    if (!known && !hashOnBoard) return false;
+
+    std::string out, rest;
+    render<CALL_HS>(cmd, PyQuoted{path}, known ? 0 : 1);
+    if (agentCall(cmd, out) != ErrorCode::OK || !agentReply(out, "@@D", rest)) return false;
+
+    long long bsize = -1;
+    unsigned long mtime = 0;
+    char dig[72] = {};
+    if (std::sscanf(rest.c_str(), "%lld %lu %71s", &bsize, &mtime, dig) != 3 || bsize < 0) {
+        manifest.erase(path);
+        return false;
+    }
+    if (known) {
+        if ((size_t)bsize == size && mtime == it->second.mtime) return true;
+        manifest.erase(it); // cambió en la placa (un script, el terminal...)
+        return false;
+    }
+
+    const size_t dlen = std::strlen(dig);
+    digestKind = dlen == 64 ? DigestKind::SHA256 : dlen == 8 ? DigestKind::CRC32 : DigestKind::UNKNOWN;
+    if (digestKind == DigestKind::UNKNOWN || (size_t)bsize != size || contentDigest(data, size) != dig)
+        return false;
+    manifestRecord(path, data, size, (uint32_t)mtime);
+    return true;
+}
+
+void PyBoardUART::manifestRecord(const std::string &path, const uint8_t *data, size_t size,
+                                 uint32_t mtime) {
+    if (digestKind == DigestKind::UNKNOWN || mtime == 0) {
+        manifest.erase(path);
+        return;
+    }
+    if (manifest.size() >= MANIFEST_MAX && !manifest.count(path)) manifest.clear();
+    ManifestEntry &e = manifest[path];
+    e.size = size;
+    e.mtime = mtime;
+    e.digest = contentDigest(data, size);
+}
+
+void PyBoardUART::manifestForget(const std::string &path, bool subtree) {
+    manifest.erase(path);
+    if (!subtree) return;
+    const std::string prefix = path.empty() || path.back() == '/' ? path : path + "/";
+    for (auto it = manifest.begin(); it != manifest.end();) {
+        if (it->first.compare(0, prefix.size(), prefix) == 0) it = manifest.erase(it);
+        else ++it;
+    }
+}
+
+// Guardado por diferencias. La placa devuelve el CRC-32 de cada bloque del
+// archivo actual dos veces: alineados desde el inicio y desde el final. Con
+// eso se elige el parche más barato:
+//  - en el lugar (pw): solo los bloques que cambiaron (y lo agregado al
+//    final), con seek + write; sirve si el archivo no se achica;
+//  - desplazado (pc): se conserva el prefijo y el sufijo que coinciden y solo
+//    viaja el medio; la placa arma el archivo nuevo en local (inserciones,
+//    borrados y archivos que se achican: MicroPython no tiene truncate).
+// Ambos responden el CRC del archivo resultante; si no coincide, si el
+// archivo no existe o si el parche no ahorra, se escribe completo.
+ErrorCode PyBoardUART::writeFileDelta(const std::string &path, const uint8_t *data, size_t size,
+                                      size_t *sent) {
+    if (sent) *sent = size;
+    const uint64_t t0 = nowUs();
+    if (unchangedOnBoard(path, data, size, false)) {
+        if (sent) *sent = 0;
+        ESP_LOGI(TAG, "delta %s: sin cambios (manifiesto)", path.c_str());
+        return ErrorCode::OK;
+    }
+    std::string out, rest;
+    render<CALL_HB>(cmd, PyQuoted{path}, DELTA_BLOCK, DELTA_BLOCKS);
+    ErrorCode err = agentCall(cmd, out);
+    if (err != ErrorCode::OK) return err;
+    if (!agentReply(out, "@@H", rest)) {
+        ESP_LOGD(TAG, "delta %s: sin hashes (%s), se escribe completo", path.c_str(), rest.c_str());
+        return writeWhole(path, data, size);
+    }
+
+    // "@@H <tamaño> <bloque> <mtime> <hashes desde el inicio...> <hashes desde el final...>"
+    const char *p = rest.c_str();
+    char *end = nullptr;
+    const size_t old = std::strtoul(p, &end, 10);
+    const size_t B = std::strtoul(end, &end, 10);
+    const uint32_t oldMtime = static_cast<uint32_t>(std::strtoul(end, &end, 10));
+    const size_t k = B ? (old + B - 1) / B : 0;
+    std::vector<uint32_t> fwd(k), bwd(k);
+    bool parsed = B > 0;
+    for (size_t i = 0; parsed && i < 2 * k; ++i) {
+        const char *from = end;
+        const uint32_t h = static_cast<uint32_t>(std::strtoul(from, &end, 16));
+        parsed = end != from;
+        (i < k ? fwd[i] : bwd[i - k]) = h;
+    }
+    if (!parsed) {
+        ESP_LOGW(TAG, "delta %s: respuesta inválida, se escribe completo", path.c_str());
+        return writeWhole(path, data, size);
+    }
+    auto blockMatches = [&](size_t newOff, size_t len, uint32_t h) {
+        return newOff + len <= size && crc32(0, data + newOff, len) == h;
+    };
+
+    // En el lugar: bloques distintos (contiguos se unen) + lo que crece
+    std::vector<std::pair<size_t, size_t>> spans; // (offset, largo) en el archivo nuevo
+    size_t inPlace = 0;
+    if (size >= old) {
+        for (size_t i = 0; i < k; ++i) {
+            const size_t off = i * B, len = std::min(B, old - off);
+            if (blockMatches(off, len, fwd[i])) continue;
+            if (!spans.empty() && spans.back().first + spans.back().second == off) spans.back().second += len;
+            else spans.emplace_back(off, len);
+            inPlace += len;
+        }
+        if (size > old) {
+            if (!spans.empty() && spans.back().first + spans.back().second == old) spans.back().second += size - old;
+            else spans.emplace_back(old, size - old);
+            inPlace += size - old;
+        }
+    }
+
+    // Desplazado: prefijo y sufijo que coinciden
+    size_t P = 0, S = 0;
+    for (size_t i = 0; i < k; ++i) {
+        const size_t len = std::min(B, old - i * B);
+        if (!blockMatches(P, len, fwd[i])) break;
+        P += len;
+    }
+    for (size_t j = 0; j < k; ++j) {
+        const size_t a = (old > (j + 1) * B) ? old - (j + 1) * B : 0;
+        const size_t len = old - j * B - a;
+        if (a < P || size < old - a || size - (old - a) < P) break;
+        if (!blockMatches(size - (old - a), len, bwd[j])) break;
+        S += len;
+    }
+    const size_t shifted = size - P - S;
+
+    // A igual costo (± un bloque) se prefiere en el lugar: no reescribe el
+    // archivo entero en la flash de la placa
+    const bool usePw = size >= old && inPlace <= shifted + B;
+    const size_t cost = usePw ? inPlace : shifted;
+    if (cost * 4 > size * 3 || cost > DELTA_INLINE_MAX) {
+        ESP_LOGD(TAG, "delta %s: %u de %u bytes cambian, se escribe completo", path.c_str(),
+                 (unsigned)cost, (unsigned)size);
+        return writeWhole(path, data, size);
+    }
+    if (cost == 0 && size == old) {
+        if (sent) *sent = 0;
+        manifestRecord(path, data, size, oldMtime);
+        ESP_LOGI(TAG, "delta %s: sin cambios", path.c_str());
+        return ErrorCode::OK;
+    }
+
+    if (usePw) {
+        std::string segs, seg;
+        for (const auto &sp : spans) {
+            render<PW_SEG>(seg, sp.first, base64Encode(std::vector<uint8_t>(data + sp.first, data + sp.first + sp.second)));
+            segs += seg;
+        }
+        render<CALL_PW>(cmd, PyQuoted{path}, segs);
+    } else {
+        render<CALL_PC>(cmd, PyQuoted{path}, P, S,
+                        base64Encode(std::vector<uint8_t>(data + P, data + size - S)));
+    }
+    err = agentCall(cmd, out);
+    if (err != ErrorCode::OK) return err;
+
+    unsigned long n = 0, mtime = 0;
+    unsigned long long crc = 0;
+    if (!agentReply(out, "@@C", rest) || std::sscanf(rest.c_str(), "%lu %llu %lu", &n, &crc, &mtime) != 3 ||
+        n != size || static_cast<uint32_t>(crc) != crc32(0, data, size)) {
+        ESP_LOGW(TAG, "delta %s: verificación falló (%s), se escribe completo", path.c_str(), rest.c_str());
+        return writeWhole(path, data, size);
+    }
+    manifestRecord(path, data, size, (uint32_t)mtime);
+    if (sent) *sent = cost;
+    ESP_LOGI(TAG, "delta %s: %u bytes, %u enviados (%s) en %u ms", path.c_str(), (unsigned)size,
+             (unsigned)cost, usePw ? "en el lugar" : "desplazado",
+             (unsigned)((nowUs() - t0) / 1000ULL));
+    return ErrorCode::OK;
+}
+
+// Escritura por ventana: tramas "Klll<seq><crc><contenido>" (ver
+// uploadFrame); la placa responde 0x01 por trama escrita, 0x15 + seq por una
+// dañada, y "0000" cierra el archivo.
+ErrorCode PyBoardUART::writeStream(const std::string &path, const uint8_t *data, size_t size,
+                                   bool append) {
+    ErrorCode err = uploadBegin(path, append);
     if (err != ErrorCode::OK) return err;
+    const bool zip = upload.zip;
+    err = uploadWrite(data, size);
+    if (err == ErrorCode::OK) err = uploadEnd();
+
+    // La placa dijo que descomprimía pero falló (sin memoria, módulo roto; con
+    // select llega como NAK repetidos): no se vuelve a pedir y se reescribe
+    // sin comprimir
+    if ((err == ErrorCode::EXEC_ERROR || err == ErrorCode::FILE_ERROR) && zip && !append &&
+        !upload.open) {
+        ESP_LOGW(TAG, "upload %s: la placa no pudo descomprimir (%s), se sube sin comprimir",
+                 path.c_str(), lastError.c_str());
+        boardInflate = Support::NO;
+        err = uploadBegin(path, append);
+        if (err != ErrorCode::OK) return err;
+        err = uploadWrite(data, size);
+        if (err == ErrorCode::OK) err = uploadEnd();
+    }
+    return err;
+}
 
-    // Abrir archivo y obtener closure de lectura
-    std::string openCmd = "f=open(" + pyQuote(path) + ",'rb')\n"
-                          "r=f.read";
-    err = exec(openCmd);
+bool PyBoardUART::zipWanted() const {
+    if (!compression || boardInflate == Support::NO) return false;
+    // Con perfil se sabe de antemano si hay deflate/zlib en la placa
+    return !profile.valid || profile.deflate || !profile.zlib.empty();
+}
+
+ErrorCode PyBoardUART::uploadBegin(const std::string &path, bool append) {
+    if (upload.open) {
+        setError("uploadBegin: session already open for " + upload.path);
+        return ErrorCode::INVALID_PARAM;
+    }
+
+    const uint64_t t0 = nowUs();
+    const bool zip = zipWanted();
+    render<CALL_WS>(cmd, PyQuoted{path}, append ? "'ab'" : "'wb'", zip ? ZIP_WBITS : 0u,
+                    static_cast<unsigned>(wireCodec));
+    ErrorCode err = startCall(cmd);
     if (err != ErrorCode::OK) return err;
 
-    const size_t chunkSizeVal = static_cast<size_t>(chunkSize);
+    // "@@GO <z> <e>": z=1 si la placa pudo importar deflate/zlib; e es el
+    // WireCodec que pudo usar (<= el pedido)
+    std::string line;
+    err = waitForLine("@@GO", line, static_cast<uint32_t>(defaultTimeout));
+    if (err != ErrorCode::OK) return err;
+    int z = 0, e = 0;
+    (void)std::sscanf(line.c_str(), "@@GO %d %d", &z, &e);
+
+    manifestForget(path);
+    upload = UploadState();
+    upload.open = true;
+    upload.path = path;
+    upload.t0 = t0;
+    upload.codec = static_cast<WireCodec>(std::min(std::max(e, 0), static_cast<int>(wireCodec)));
+    upload.chunk = transferChunk();
+    if (zip) {
+        upload.zip = z == 1;
+        if (!upload.zip && boardInflate != Support::NO)
+            ESP_LOGI(TAG, "upload: la placa no descomprime, se sube sin comprimir");
+        boardInflate = upload.zip ? Support::YES : Support::NO;
+    }
+    return ErrorCode::OK;
+}
 
+// Espera la respuesta a la trama en vuelo más vieja. 0x01 la confirma;
+// 0x15 + seq (NAK) dice que llegó dañada y que la placa descartó lo que venía
+// detrás, así que se reenvía desde ahí. Sin respuesta en resyncMs() la placa
+// puede estar esperando bytes que se perdieron: se manda una vez relleno, que
+// completa la trama, falla el CRC y termina en NAK. Cualquier otra cosa es
+// salida de error de la placa (el programa ya terminó, la sesión queda cerrada).
+ErrorCode PyBoardUART::takeUploadCredit() {
+    const uint32_t tmo = static_cast<uint32_t>(defaultTimeout);
     for (;;) {
-        // Imprime banderas claras para distinguir de cualquier eco del REPL
-        std::string readCmd =
-            "try:\n"
-            " import ubinascii as b\n"
-            "except ImportError:\n"
-            " import binascii as b\n"
-            "x=r(" + std::to_string(chunkSizeVal) + ")\n"
-            "print('@@RF', 0) if (x is None) else print('@@RF', 1)\n"
-            "print('@@DATA', b.b2a_base64(x).decode().strip()) if x else None";
-
-        std::string out;
-        err = exec(readCmd, out);
-        if (err != ErrorCode::OK) { break; }
-
-        // Normalizar y recorrer líneas
-        stripCR(out);
-        std::istringstream is(out);
-        std::string line;
-        int haveData = -1;     // -1: no visto, 0: EOF, 1: hay datos
-        std::string b64;
-
-        while (std::getline(is, line)) {
-            if (!line.empty() && line.back()=='\r') line.pop_back();
-
-            if (line.rfind("@@RF ", 0) == 0) {
-                int flag = 0;
-                (void)std::sscanf(line.c_str(), "@@RF %d", &flag);
-                haveData = flag; // 0 => None/EOF, 1 => hay chunk
-            } else if (line.rfind("@@DATA ", 0) == 0) {
-                b64 = line.substr(7); // después de "@@DATA "
-            }
+        uint8_t b;
+        ErrorCode rc = readByte(b, upload.padded ? tmo : std::min(tmo, resyncMs()));
+        if (rc != ErrorCode::OK && !upload.padded) {
+            ESP_LOGW(TAG, "upload %s: sin respuesta, se rellena para resincronizar", upload.path.c_str());
+            upload.padded = true;
+            rc = writeData(std::string(FRAME_HDR + FRAME_MAX, '~'));
+            if (rc == ErrorCode::OK) continue;
         }
-
-        if (haveData == 0) { // EOF limpio
-            break;
+        if (rc != ErrorCode::OK) {
+            upload.open = false;
+            setError("upload: no credit from board");
+            return rc;
         }
-        if (haveData == 1) {
-            // Solo decodificamos la parte marcada como DATA
-            std::vector<uint8_t> chunk = base64Decode(b64);
-            if (!chunk.empty()) {
-                content.insert(content.end(), chunk.begin(), chunk.end());
+        if (b == 0x01) {
+            if (!upload.sent.empty()) {
+                frame = std::move(upload.sent.front());
+                upload.sent.pop_front();
             }
-            // Si el chunk vino más pequeño, ya terminamos
-            if (chunk.size() < chunkSizeVal) break;
+            upload.retries = 0;
+            return ErrorCode::OK;
+        }
+        if (b == 0x15) {
+            char hex[3] = {};
+            if (readExact(*transport, reinterpret_cast<uint8_t *>(hex), 2, tmo) != 2) {
+                upload.open = false;
+                setError("upload: truncated NAK from board");
+                return ErrorCode::TIMEOUT;
+            }
+            upload.padded = false; // la placa descartó todo, relleno incluido
+            rc = resendFrom(static_cast<uint8_t>(std::strtoul(hex, nullptr, 16)));
+            if (rc != ErrorCode::OK || upload.sent.empty()) return rc;
+            continue;
+        }
+
+        upload.open = false;
+        const char back = static_cast<char>(b);
+        transport->unread(&back, 1);
+        std::string line;
+        if (waitForLine("@@OK", line, 1000) != ErrorCode::EXEC_ERROR)
+            setError("upload: unexpected output from board");
+        return ErrorCode::EXEC_ERROR;
+    }
+}
+
+// Reenvía las tramas en vuelo desde 'seq' (las anteriores ya tienen crédito).
+// Tras STREAM_RETRIES NAK seguidos se cierra el archivo y se abandona: la
+// placa está esperando una cabecera y "0000" la termina.
+ErrorCode PyBoardUART::resendFrom(uint8_t seq) {
+    if (++upload.retries > STREAM_RETRIES) {
+        upload.open = false;
+        const uint32_t tmo = static_cast<uint32_t>(defaultTimeout);
+        std::string line;
+        (void)drainQuiet(); // NAK que siguen llegando de tramas ya en vuelo
+        if (writeData("0000") == ErrorCode::OK && waitForLine("@@OK", line, tmo) == ErrorCode::OK)
+            (void)finishProgram(tmo);
+        setError("upload: too many retransmissions");
+        return ErrorCode::FILE_ERROR;
+    }
+    while (!upload.sent.empty() &&
+           std::strtoul(upload.sent.front().substr(4, 2).c_str(), nullptr, 16) != seq) {
+        upload.sent.pop_front();
+    }
+    for (const std::string &f : upload.sent) {
+        ErrorCode err = writeData(f);
+        if (err != ErrorCode::OK) { upload.open = false; return err; }
+        ++upload.resent;
+    }
+    return ErrorCode::OK;
+}
+
+ErrorCode PyBoardUART::uploadWrite(const uint8_t *data, size_t size) {
+    if (!upload.open) {
+        setError("uploadWrite: no open session");
+        return ErrorCode::INVALID_PARAM;
+    }
+    ErrorCode err = upload.zip ? ErrorCode::OK : uploadFrames(data, size);
+
+    // Se comprime por bloques de ZIP_BLOCK; lo que sobra espera al próximo trozo
+    while (upload.zip && err == ErrorCode::OK && size > 0) {
+        const size_t take = std::min(size, ZIP_BLOCK - upload.pending.size());
+        if (upload.pending.empty() && take == ZIP_BLOCK) {
+            err = uploadBlock(data, take);
         } else {
-            // No vimos bandera; probablemente ruido/eco: trata como error
-            setError("REPL noise: missing @@RF/@@DATA in output");
-            exec("f.close()");
-            return ErrorCode::EXEC_ERROR;
+            upload.pending.insert(upload.pending.end(), data, data + take);
+            if (upload.pending.size() == ZIP_BLOCK) {
+                err = uploadBlock(upload.pending.data(), ZIP_BLOCK);
+                upload.pending.clear();
+            }
         }
+        data += take;
+        size -= take;
+    }
+    if (err != ErrorCode::OK) {
+        lastTransfer = {upload.chunk, upload.bytes, (uint32_t)((nowUs() - upload.t0) / 1000ULL), upload.resent};
+        chunkFeedback(err, upload.frames);
     }
+    return err;
+}
 
-    exec("f.close()");
+// Un bloque comprimido en una sola trama, o en tramas normales si no conviene
+// (lo que cuesta en la línea con el codec de la sesión)
+ErrorCode PyBoardUART::uploadBlock(const uint8_t *data, size_t size) {
+    const bool raw = upload.codec == WireCodec::RAW;
+    const size_t b64 = (size + 2) / 3 * 4;
+    const size_t plainCost = raw ? size
+                           : upload.codec == WireCodec::ESCAPE ? std::min(escapedSize(data, size), b64)
+                           : b64;
+    if (!deflater.compress(data, size, zbuf) || zbuf.size() > (raw ? FRAME_MAX : ZIP_FRAME_MAX)) {
+        return uploadFrames(data, size);
+    }
+    const size_t zipCost = raw ? zbuf.size() : (zbuf.size() + 2) / 3 * 4;
+    if (zipCost * 8 > plainCost * 7) return uploadFrames(data, size);
+
+    ErrorCode err = uploadFrame('Z', zbuf.data(), zbuf.size(), crc32(0, data, size));
+    if (err != ErrorCode::OK) return err;
+    upload.bytes += size;
+    upload.wire += zbuf.size();
+    upload.crc = crc32(upload.crc, data, size);
     return ErrorCode::OK;
 }
 
-ErrorCode PyBoardUART::writeFileRaw(const std::string &path, const std::vector<uint8_t> &content) {
-    std::string openCmd = "f=open(" + pyQuote(path) + ",'wb')\nw=f.write";
-    ErrorCode err = exec(openCmd);
+ErrorCode PyBoardUART::uploadFrames(const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i += upload.chunk) {
+        const size_t len = std::min(upload.chunk, size - i);
+        ErrorCode err = uploadFrame(0, data + i, len, crc32(0, data + i, len));
+        if (err != ErrorCode::OK) return err;
+        if (len == upload.chunk) ++upload.frames;
+        upload.bytes += len;
+        upload.wire += len;
+        upload.crc = crc32(upload.crc, data + i, len);
+    }
+    return ErrorCode::OK;
+}
+
+// Arma y manda una trama ('Z': bloque DEFLATE, 0: datos) con el codec de la
+// sesión: "Blll" base64, "Zlll" DEFLATE en base64, "Tlll" escapado, "Rlll"
+// crudo, "Plll" DEFLATE crudo; siguen la secuencia y el CRC-32 de 'crc' (lo
+// que la placa escribe, ya descomprimido). Con ESCAPE se usa base64 si sale
+// más corto. La trama queda en upload.sent hasta su crédito.
+ErrorCode PyBoardUART::uploadFrame(char kind, const uint8_t *data, size_t len, uint32_t crc) {
+    while (upload.sent.size() >= STREAM_WINDOW) {
+        ErrorCode err = takeUploadCredit();
+        if (err != ErrorCode::OK) return err;
+    }
+
+    frame.assign(FRAME_HDR, '0');
+    if (upload.codec == WireCodec::RAW) {
+        kind = kind ? 'P' : 'R';
+        frame.append(reinterpret_cast<const char *>(data), len);
+    } else if (!kind && upload.codec == WireCodec::ESCAPE &&
+               escapedSize(data, len) < (len + 2) / 3 * 4) {
+        kind = 'T';
+        escapeAppend(data, len, frame);
+    } else {
+        kind = kind ? kind : 'B';
+        base64Append(data, len, frame);
+    }
+    char hdr[FRAME_HDR + 1];
+    std::snprintf(hdr, sizeof(hdr), "%c%03X%02X%08X", kind, (unsigned)(frame.size() - FRAME_HDR),
+                  (unsigned)upload.seq, (unsigned)crc);
+    frame.replace(0, FRAME_HDR, hdr, FRAME_HDR);
+
+    ErrorCode err = writeData(frame);
+    if (err != ErrorCode::OK) { upload.open = false; return err; }
+    upload.sent.push_back(std::move(frame));
+    ++upload.seq;
+    return ErrorCode::OK;
+}
+
+ErrorCode PyBoardUART::uploadEnd() {
+    if (!upload.open) {
+        setError("uploadEnd: no open session");
+        return ErrorCode::INVALID_PARAM;
+    }
+    ErrorCode err = uploadClose();
+    lastTransfer = {upload.chunk, upload.bytes, (uint32_t)((nowUs() - upload.t0) / 1000ULL), upload.resent};
+    chunkFeedback(err, upload.frames);
     if (err != ErrorCode::OK) return err;
 
-    size_t chunkSizeVal = static_cast<size_t>(chunkSize);
+    const std::string zip = upload.zip ? ", comprimido a " + std::to_string(upload.wire) : "";
+    const std::string again =
+        upload.resent ? ", " + std::to_string(upload.resent) + " reenvíos" : "";
+    ESP_LOGI(TAG, "upload %s: %u bytes en %u ms (%u B/s), trozo %u%s%s%s", upload.path.c_str(),
+             (unsigned)upload.bytes, (unsigned)lastTransfer.ms, (unsigned)lastTransfer.bytesPerSec(),
+             (unsigned)upload.chunk, upload.verified ? ", crc ok" : "", zip.c_str(), again.c_str());
+    return ErrorCode::OK;
+}
 
-    for (size_t i = 0; i < content.size(); i += chunkSizeVal) {
-        size_t len = std::min(chunkSizeVal, content.size() - i);
-        std::vector<uint8_t> chunk(content.begin() + i, content.begin() + i + len);
+// Cierra el archivo en la placa y verifica "@@OK <bytes> <crc>".
+// La placa informa crc -1 si su binascii no tiene crc32: se valida solo el tamaño.
+ErrorCode PyBoardUART::uploadClose() {
+    if (!upload.pending.empty()) {
+        ErrorCode err = uploadBlock(upload.pending.data(), upload.pending.size());
+        if (err != ErrorCode::OK) return err;
+        upload.pending.clear();
+    }
 
-        std::string base64Chunk = base64Encode(chunk);
-        std::string writeCmd =
-            "try:\n import ubinascii as binascii\n"
-            "except ImportError:\n import binascii as binascii\n"
-            "w(binascii.a2b_base64('" + base64Chunk + "'))";
+    // Recoger los créditos pendientes (y el NAK de un relleno) antes de cerrar
+    while (!upload.sent.empty() || upload.padded) {
+        ErrorCode err = takeUploadCredit();
+        if (err != ErrorCode::OK) return err;
+    }
+    upload.open = false;
 
-        err = exec(writeCmd);
-        if (err != ErrorCode::OK) {
-            exec("f.close()");
-            return err;
-        }
+    ErrorCode err = writeData("0000");
+    if (err != ErrorCode::OK) return err;
+
+    std::string line;
+    err = waitForLine("@@OK", line, static_cast<uint32_t>(defaultTimeout));
+    if (err != ErrorCode::OK) return err;
+
+    err = finishProgram(static_cast<uint32_t>(defaultTimeout));
+    if (err != ErrorCode::OK) return err;
+
+    unsigned long n = 0, mtime = 0;
+    long long crc = -1;
+    if (std::sscanf(line.c_str(), "@@OK %lu %lld %lu", &n, &crc, &mtime) < 2) {
+        setError("upload: bad close reply: " + line);
+        return ErrorCode::EXEC_ERROR;
+    }
+    if (n != upload.bytes) {
+        setError("upload: size mismatch (sent " + std::to_string(upload.bytes) +
+                 ", board wrote " + std::to_string(n) + ")");
+        return ErrorCode::FILE_ERROR;
+    }
+    if (crc >= 0 && static_cast<uint32_t>(crc) != upload.crc) {
+        setError("upload: CRC mismatch");
+        return ErrorCode::FILE_ERROR;
     }
+    upload.mtime = static_cast<uint32_t>(mtime);
+    upload.verified = crc >= 0;
+    return ErrorCode::OK;
+}
 
-    return exec("f.close()");
+// Corta la sesión (p.ej. el cliente HTTP se desconectó): cierra el archivo
+// con lo recibido hasta ahora y vuelve al prompt sin validar.
+void PyBoardUART::uploadAbort() {
+    if (!upload.open) return;
+    if (!upload.pending.empty()) {
+        if (uploadBlock(upload.pending.data(), upload.pending.size()) != ErrorCode::OK) return;
+        upload.pending.clear();
+    }
+    while (!upload.sent.empty() || upload.padded) {
+        if (takeUploadCredit() != ErrorCode::OK) return;
+    }
+    upload.open = false;
+    std::string line;
+    if (writeData("0000") == ErrorCode::OK &&
+        waitForLine("@@OK", line, static_cast<uint32_t>(defaultTimeout)) == ErrorCode::OK) {
+        (void)finishProgram(static_cast<uint32_t>(defaultTimeout));
+    }
+    ESP_LOGW(TAG, "upload %s abortado tras %u bytes", upload.path.c_str(), (unsigned)upload.bytes);
 }
 
 ErrorCode PyBoardUART::deleteFile(const std::string &path) {
-    std::string cmd = "import os\nos.remove(" + pyQuote(path) + ")";
-    return exec(cmd);
+    manifestForget(path);
+    std::string out, why;
+    render<CALL_RM>(cmd, PyQuoted{path});
+    ErrorCode err = agentCall(cmd, out);
+    if (err != ErrorCode::OK) return err;
+    err = agentOk(out, "remove", why);
+    if (err != ErrorCode::OK) setError(why);
+    return err;
 }
 
 ErrorCode PyBoardUART::createDir(const std::string &path) {
-    std::string cmd = "import os\nos.mkdir(" + pyQuote(path) + ")";
-    return exec(cmd);
+    std::string out, why;
+    render<CALL_MD>(cmd, PyQuoted{path});
+    ErrorCode err = agentCall(cmd, out);
+    if (err != ErrorCode::OK) return err;
+    err = agentOk(out, "mkdir", why);
+    if (err != ErrorCode::OK) setError(why);
+    return err;
 }
 
 ErrorCode PyBoardUART::deleteDir(const std::string &path) {
-    std::string cmd = "import os\nos.rmdir(" + pyQuote(path) + ")";
-    return exec(cmd);
+    manifestForget(path, true);
+    std::string out, why;
+    render<CALL_RD>(cmd, PyQuoted{path});
+    ErrorCode err = agentCall(cmd, out);
+    if (err != ErrorCode::OK) return err;
+    err = agentOk(out, "rmdir", why);
+    if (err != ErrorCode::OK) setError(why);
+    return err;
 }
 
-ErrorCode PyBoardUART::exists(const std::string &path, bool &result) {
-    std::string cmd =
-        "import os\ntry:\n os.stat(" + pyQuote(path) + ")\n print('1')\nexcept:\n print('0')";
-    std::string output;
+ErrorCode PyBoardUART::deleteTree(const std::string &path) {
+    manifestForget(path, true);
+    std::string out, why;
+    render<CALL_RT>(cmd, PyQuoted{path});
+    ErrorCode err = agentCall(cmd, out);
+    if (err != ErrorCode::OK) return err;
+    err = agentOk(out, "rmtree", why);
+    if (err != ErrorCode::OK) setError(why);
+    return err;
+}
+
+// Una línea por entrada, tal como llega: no se acumula la salida entera
+ErrorCode PyBoardUART::walkTree(const std::string &root, int maxDepth, const std::string &glob,
+                                size_t limit, const TreeCallback &onEntry, int *completeDepth) {
+    [[maybe_unused]] const uint64_t t0 = nowUs(); // solo lo usa ESP_LOGD
+    render<CALL_TR>(cmd, PyQuoted{root.empty() ? std::string("/") : root}, maxDepth,
+                    PyQuoted{glob}, limit);
+    ErrorCode err = startCall(cmd);
+    if (err != ErrorCode::OK) return err;
+
+    std::string line;
+    err = waitForLine("@@GO", line, static_cast<uint32_t>(defaultTimeout));
+    if (err != ErrorCode::OK) return err;
+
+    size_t count = 0;
+    FileInfo entry;
+    for (;;) {
+        err = readLine(line, static_cast<uint32_t>(defaultTimeout));
+        if (err != ErrorCode::OK) {
+            if (err == ErrorCode::REPL_ERROR) {
+                stripPasteArtifacts(line);
+                setError("walkTree aborted: " + line);
+                return ErrorCode::EXEC_ERROR;
+            }
+            setError("walkTree: timeout waiting for entries");
+            return err;
+        }
+        if (line.rfind("@@", 0) == 0) break;
+
+        // "d|f <TAB> tamaño <TAB> ruta"
+        const size_t t1 = line.find('\t');
+        const size_t t2 = (t1 == std::string::npos) ? t1 : line.find('\t', t1 + 1);
+        if (t1 != 1 || t2 == std::string::npos) continue;
+        entry.isDirectory = line[0] == 'd';
+        entry.size = static_cast<size_t>(std::strtoull(line.c_str() + t1 + 1, nullptr, 10));
+        entry.name.assign(line, t2 + 1, std::string::npos);
+        ++count;
+        if (!onEntry(entry)) {
+            (void)interrupt();
+            (void)finishProgram(static_cast<uint32_t>(defaultTimeout));
+            setError("walkTree: cancelled");
+            return ErrorCode::EXEC_ERROR;
+        }
+    }
 
-    ErrorCode err = exec(cmd, output);
+    std::string rest;
+    const bool ok = agentReply(line, "@@T", rest);
+    err = finishProgram(static_cast<uint32_t>(defaultTimeout));
+    if (!ok) {
+        setError("walkTree failed: " + rest);
+        return ErrorCode::FILE_ERROR;
+    }
     if (err != ErrorCode::OK) return err;
 
-    result = (!output.empty() && output[0] == '1');
+    unsigned long n = 0;
+    int complete = 0;
+    if (std::sscanf(rest.c_str(), "%lu %d", &n, &complete) != 2 || n != count) {
+        setError("walkTree: entradas perdidas (" + std::to_string(count) + " de " + rest + ")");
+        return ErrorCode::EXEC_ERROR;
+    }
+    if (completeDepth) *completeDepth = complete;
+    ESP_LOGD(TAG, "walkTree %s: %u entradas en %u ms", root.c_str(), (unsigned)count,
+             (unsigned)((nowUs() - t0) / 1000ULL));
     return ErrorCode::OK;
 }
 
-ErrorCode PyBoardUART::getFileInfo(const std::string &path, FileInfo &info) {
-    // 1) imprimir solo una línea con sentinela fácil de detectar
-    std::string cmd =
-        "import os\n"
-        "try:\n"
-        "  s=os.stat(" + pyQuote(path) + ")\n"
-        "  print('@@FI', s[0], s[6])\n"
-        "except Exception as e:\n"
-        "  print('@@FIERR', repr(e))\n";
+ErrorCode PyBoardUART::renamePath(const std::string &from, const std::string &to) {
+    manifestForget(from, true);
+    manifestForget(to, true);
+    std::string out, why;
+    render<CALL_MV>(cmd, PyQuoted{from}, PyQuoted{to});
+    ErrorCode err = agentCall(cmd, out);
+    if (err != ErrorCode::OK) return err;
+    err = agentOk(out, "rename", why);
+    if (err != ErrorCode::OK) setError(why);
+    return err;
+}
 
-    std::string output;
-    ErrorCode err = exec(cmd, output);
+// Todo el lote es una sola línea "_e.bt([(op,args...),...],stop)". La placa
+// responde "@@B i" antes de cada operación, su salida y @@K/@@S/@@E, y "@@Z"
+// al terminar el lote.
+ErrorCode PyBoardUART::runBatch(const std::vector<BatchOp> &ops, bool stopOnError,
+                                std::vector<BatchResult> &results, uint32_t timeoutMs) {
+    results.assign(ops.size(), BatchResult());
+    if (ops.empty()) return ErrorCode::OK;
+    manifest.clear(); // un snippet puede tocar cualquier archivo
+
+    std::string items, part;
+    for (const BatchOp &op : ops) {
+        switch (op.kind) {
+        case BatchOp::Kind::STAT:   render<BT_OP1>(part, "st", PyQuoted{op.path}); break;
+        case BatchOp::Kind::MKDIR:  render<BT_OP1>(part, "md", PyQuoted{op.path}); break;
+        case BatchOp::Kind::DELETE: render<BT_OP1>(part, "dl", PyQuoted{op.path}); break;
+        case BatchOp::Kind::EXEC:   render<BT_OP1>(part, "x", PyQuoted{op.arg}); break;
+        case BatchOp::Kind::WRITE:  render<BT_OP2>(part, "wr", PyQuoted{op.path}, PyQuoted{op.arg}); break;
+        case BatchOp::Kind::RENAME: render<BT_OP2>(part, "mv", PyQuoted{op.path}, PyQuoted{op.arg}); break;
+        }
+        items += part;
+    }
+    render<CALL_BT>(cmd, items, stopOnError ? 1 : 0);
+
+    [[maybe_unused]] const uint64_t t0 = nowUs(); // solo lo usa ESP_LOGD
+    std::string out;
+    ErrorCode err = agentCall(cmd, out, timeoutMs);
     if (err != ErrorCode::OK) return err;
 
-    // 2) buscar la línea que empiece con @@FI
-    int mode = 0;
-    unsigned long long size = 0ULL;
-    {
-        std::istringstream is(output);
-        std::string line;
-        bool got = false;
-        while (std::getline(is, line)) {
-            // quita \r residuales
-            if (!line.empty() && line.back() == '\r') line.pop_back();
+    long cur = -1;
+    bool end = false;
+    std::string line;
+    for (size_t pos = 0; pos < out.size() && !end;) {
+        size_t nl = out.find('\n', pos);
+        if (nl == std::string::npos) nl = out.size();
+        line.assign(out, pos, nl - pos);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        pos = nl + 1;
 
-            if (line.rfind("@@FIERR", 0) == 0) {
-                setError("os.stat failed: " + line);
-                return ErrorCode::EXEC_ERROR;
-            }
-            if (line.rfind("@@FI", 0) == 0) {
-                // formato: @@FI <mode> <size>
-                // ojo: %d %llu para 32/64 bits; en ESP-IDF unsigned long long es seguro
-                if (std::sscanf(line.c_str(), "@@FI %d %llu", &mode, &size) == 2) {
-                    got = true;
-                    break;
-                }
-            }
-        }
-        if (!got) {
-            // Como fallback, intenta detectar una línea con "solo números"
-            is.clear(); is.seekg(0);
-            while (std::getline(is, line)) {
-                if (!line.empty() && line.back() == '\r') line.pop_back();
-                // ej: "33261 1024"
-                int m=0; unsigned long long sz=0;
-                if (std::sscanf(line.c_str(), "%d %llu", &m, &sz) == 2) {
-                    mode = m; size = sz; got = true; break;
-                }
-            }
+        if (line.rfind("@@B ", 0) == 0) {
+            cur = std::strtol(line.c_str() + 4, nullptr, 10);
+            if (cur < 0 || (size_t)cur >= results.size()) cur = -1;
+            else results[cur].ran = true;
+            continue;
         }
-        if (!got) {
-            setError("Failed to parse file info (echo/noise in output): " + output);
-            return ErrorCode::EXEC_ERROR;
+        if (line == "@@Z") { end = true; continue; }
+        if (cur < 0) continue;
+
+        BatchResult &r = results[cur];
+        int mode = 0;
+        unsigned long long size = 0ULL;
+        if (line == "@@K") {
+            r.ok = true;
+        } else if (line.rfind("@@S ", 0) == 0 && std::sscanf(line.c_str() + 4, "%d %llu", &mode, &size) == 2) {
+            r.ok = true;
+            r.info = FileInfo(ops[cur].path, static_cast<size_t>(size), (mode & 0x4000) != 0);
+        } else if (line.rfind("@@E", 0) == 0) {
+            r.error = line.size() > 4 ? line.substr(4) : std::string("error");
+        } else {
+            r.output += line;
+            r.output += '\n';
         }
     }
+    if (!end) {
+        stripPasteArtifacts(out);
+        setError("batch failed: " + out);
+        return ErrorCode::EXEC_ERROR;
+    }
+    ESP_LOGD(TAG, "batch: %u operaciones en %u ms", (unsigned)ops.size(),
+             (unsigned)((nowUs() - t0) / 1000ULL));
+    return ErrorCode::OK;
+}
+
+ErrorCode PyBoardUART::exists(const std::string &path, bool &result) {
+    std::string output, rest;
+    render<CALL_EX>(cmd, PyQuoted{path});
+    ErrorCode err = agentCall(cmd, output);
+    if (err != ErrorCode::OK) return err;
+
+    if (!agentReply(output, "@@X", rest)) {
+        setError("exists: unexpected output: " + rest);
+        return ErrorCode::EXEC_ERROR;
+    }
+    result = (!rest.empty() && rest[0] == '1');
+    return ErrorCode::OK;
+}
+
+ErrorCode PyBoardUART::getFileInfo(const std::string &path, FileInfo &info) {
+    std::string output, rest;
+    render<CALL_ST>(cmd, PyQuoted{path});
+    ErrorCode err = agentCall(cmd, output);
+    if (err != ErrorCode::OK) return err;
+
+    // formato: @@S <mode> <size>  |  @@E <repr(error)>
+    int mode = 0;
+    unsigned long long size = 0ULL;
+    if (!agentReply(output, "@@S", rest)) {
+        setError("os.stat failed: " + rest);
+        return ErrorCode::EXEC_ERROR;
+    }
+    if (std::sscanf(rest.c_str(), "%d %llu", &mode, &size) != 2) {
+        setError("Failed to parse file info: " + output);
+        return ErrorCode::EXEC_ERROR;
+    }
 
     info.name = path;
     info.isDirectory = (mode & 0x4000) != 0;
@@ -1060,7 +2874,7 @@ ErrorCode PyBoardUART::uploadFile(const std::string &localPath, const std::strin
 // ============================================================================
 ErrorCode PyBoardUART::rawPasteWrite(const std::string &data) {
     uint8_t windowBuf[2];
-    int readLen = uart_read_bytes(uartNum, windowBuf, 2, 100 / portTICK_PERIOD_MS);
+    int readLen = readExact(*transport, windowBuf, 2, 100);
     if (readLen != 2) {
         setError("Failed to read paste mode window size");
         return ErrorCode::UART_ERROR;
@@ -1071,32 +2885,29 @@ ErrorCode PyBoardUART::rawPasteWrite(const std::string &data) {
 
     size_t i = 0;
     while (i < data.length()) {
-        size_t available = 0;
-        uart_get_buffered_data_len(uartNum, &available);
+        size_t available = transport->available();
 
         while (windowRemain == 0 || available > 0) {
             uint8_t byte;
-            int len = uart_read_bytes(uartNum, &byte, 1, 10 / portTICK_PERIOD_MS);
+            size_t len = transport->read(&byte, 1, 10);
 
             if (len > 0) {
                 if (byte == 0x01) {
                     windowRemain += windowSize;
                 } else if (byte == 0x04) {
                     const uint8_t ack = 0x04;
-                    uart_write_bytes(uartNum, &ack, 1);
+                    transport->write(&ack, 1);
                     return ErrorCode::OK;
                 } else {
                     setError("Unexpected byte in paste mode");
                     return ErrorCode::UART_ERROR;
                 }
             }
-            uart_get_buffered_data_len(uartNum, &available);
+            available = transport->available();
         }
 
         size_t toSend = std::min(static_cast<size_t>(windowRemain), data.length() - i);
-        int written = uart_write_bytes(uartNum,
-                                       reinterpret_cast<const uint8_t *>(data.c_str() + i),
-                                       toSend);
+        int written = transport->write(data.c_str() + i, toSend);
         if (written < 0) {
             setError("Failed to write data in paste mode");
             return ErrorCode::UART_ERROR;
@@ -1107,22 +2918,32 @@ ErrorCode PyBoardUART::rawPasteWrite(const std::string &data) {
     }
 
     const uint8_t endMarker = 0x04;
-    uart_write_bytes(uartNum, &endMarker, 1);
+    transport->write(&endMarker, 1);
 
-    uint8_t ack;
-    int ackLen = uart_read_bytes(uartNum, &ack, 1, 1000 / portTICK_PERIOD_MS);
-    if (ackLen != 1 || ack != 0x04) {
-        setError("Failed to receive paste mode acknowledgment");
-        return ErrorCode::UART_ERROR;
+    // Antes del ^D de confirmación pueden llegar créditos 0x01 que la placa
+    // concedió tras el último bloque: se descartan (pyboard: read_until(1, b"\x04"))
+    const uint64_t deadline = nowUs() + 1000ULL * 1000ULL;
+    for (;;) {
+        const uint64_t now = nowUs();
+        uint8_t ack;
+        if (now >= deadline ||
+            readExact(*transport, &ack, 1, (uint32_t)((deadline - now + 999) / 1000ULL)) != 1) {
+            setError("Failed to receive paste mode acknowledgment");
+            return ErrorCode::UART_ERROR;
+        }
+        if (ack == 0x04) return ErrorCode::OK;
+        if (ack != 0x01) {
+            setError("Unexpected byte in paste mode acknowledgment");
+            return ErrorCode::UART_ERROR;
+        }
     }
-    return ErrorCode::OK;
 }
 
 // ============================================================================
 // Control
 // ============================================================================
-ErrorCode PyBoardUART::softReset()   { return writeData(&CTRL_D, 1); }
-ErrorCode PyBoardUART::interrupt()   { return writeData(&CTRL_C, 1); }
+ErrorCode PyBoardUART::softReset()   { agentReady = false; replState = ReplState::UNKNOWN; return writeData(&CTRL_D, 1); }
+ErrorCode PyBoardUART::interrupt()   { replState = ReplState::UNKNOWN; return writeData(&CTRL_C, 1); }
 
 // ============================================================================
 std::string PyBoardUART::errorToString(ErrorCode error) {
@@ -2,12 +2,16 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <memory>
 #include <functional>
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/queue.h"
+#include <unordered_map>
+#include <cstdint>
+#include "Transport.hpp"
+#include "Deflate.hpp"
+#ifdef ESP_PLATFORM
 #include "driver/uart.h"
+#endif
 
 namespace PyBoard
 {
@@ -56,6 +60,73 @@ namespace PyBoard
         NOT_IN_RAW_REPL
     };
 
+    // Estado del REPL según lo último visto en el flujo de bytes
+    enum class ReplState : uint8_t
+    {
+        UNKNOWN = 0, // tras un error, tecleo del terminal o salida inesperada
+        PROMPT,      // '>>>' visto y nada recibido desde entonces
+        PASTE,       // dentro de paste mode (^E aceptado)
+        RAW,         // raw REPL
+        RUNNING      // programa o línea enviado, aún sin volver al prompt
+    };
+
+    // Cómo se ejecuta el código en la placa. FRIENDLY: paste mode (eco de cada
+    // carácter, pacing); RAW: raw REPL / raw-paste, sin eco. AUTO usa RAW si
+    // la placa lo acepta y si no vuelve a FRIENDLY.
+    enum class ExecEngine : uint8_t
+    {
+        AUTO = 0,
+        FRIENDLY,
+        RAW
+    };
+
+    // Codificación del contenido de archivos en la UART (tramas de _e.ws/_e.rs).
+    // RAW: bytes tal cual (sys.stdin.buffer con kbd_intr(-1); stdout.buffer
+    // al leer); ESCAPE: ASCII imprimible tal cual y el resto como \x7f + 2
+    // dígitos hex (solo subidas, y por trama gana el más corto contra base64);
+    // BASE64: lo de siempre. La placa informa qué pudo usar y se baja de nivel
+    // sola: RAW -> ESCAPE -> BASE64.
+    enum class WireCodec : uint8_t
+    {
+        BASE64 = 0,
+        ESCAPE,
+        RAW
+    };
+
+    // Capacidades de la placa según probeBoard(). serialize()/parse() usan el
+    // formato "clave=valor|..." de la respuesta del sondeo, para guardarlo y
+    // aplicarlo en la próxima conexión sin volver a sondear.
+    struct BoardProfile
+    {
+        bool valid = false;     // sondeo completo
+        std::string dialect;    // sys.implementation.name
+        std::string version;    // "1.22.0"
+        std::string uid;        // id único en hex (vacío si la placa no lo expone)
+        std::string machine;    // sys.implementation._machine
+        bool rawRepl = false;
+        bool rawPaste = false;
+        std::string binascii;   // "ubinascii", "binascii" o vacío
+        bool crc32 = false;     // binascii.crc32
+        bool deflate = false;   // módulo deflate (MicroPython >= 1.21)
+        std::string zlib;       // "zlib", "uzlib" o vacío
+        std::string hashlib;    // "hashlib", "uhashlib" o vacío
+        bool ilistdir = false;  // os.ilistdir
+        uint32_t memFree = 0;   // gc.mem_free() tras gc.collect()
+        uint16_t pasteWindow = 0; // ventana de paste mode aprendida (0 = sin dato)
+
+        bool isCircuitPython() const { return dialect == "circuitpython"; }
+        std::string serialize() const;
+        bool parse(const std::string &s);
+    };
+
+    // Hasta dónde tuvo que llegar ensureIdle() para ver el prompt
+    enum class IdleLevel : uint8_t
+    {
+        NONE = 0,   // ya estaba en '>>>': solo un CR
+        INTERRUPT,  // ^C (code.py corriendo, paste/raw a medias)
+        RESET       // ^D: soft reboot, se pierde el estado del REPL
+    };
+
     // File information structure
     struct FileInfo
     {
@@ -67,18 +138,57 @@ namespace PyBoard
             : name(n), size(s), isDirectory(dir) {}
     };
 
+    // Resultado de la última transferencia por ventana (getLastTransfer)
+    struct TransferStats
+    {
+        size_t chunk = 0;   // bytes por trama que se usaron
+        size_t bytes = 0;
+        uint32_t ms = 0;
+        size_t resent = 0;  // tramas reenviadas
+        uint32_t bytesPerSec() const { return ms ? (uint32_t)(bytes * 1000ULL / ms) : 0; }
+    };
+
+    // Operación de runBatch()
+    struct BatchOp
+    {
+        enum class Kind : uint8_t
+        {
+            STAT,
+            MKDIR,
+            DELETE, // archivo, o directorio con todo su contenido
+            WRITE,  // archivo chico completo
+            RENAME,
+            EXEC    // snippet Python (en los globals del REPL)
+        };
+        Kind kind = Kind::STAT;
+        std::string path; // EXEC: sin uso
+        std::string arg;  // RENAME: destino; WRITE: contenido en Base64; EXEC: código
+    };
+
+    // Resultado de una operación del lote
+    struct BatchResult
+    {
+        bool ran = false;   // false: no se llegó a correr (lote cortado en un error)
+        bool ok = false;
+        std::string error;  // repr() de la excepción en la placa
+        std::string output; // lo que imprimió (EXEC)
+        FileInfo info;      // STAT
+    };
+
     // Callback types
     using DataCallback = std::function<void(const std::string &data)>;
     using ProgressCallback = std::function<void(size_t current, size_t total)>;
     using MonitorCallback = std::function<void(char c)>;
+    // Trozo recibido en una lectura por streaming; devolver false la cancela
+    using ChunkCallback = std::function<bool(const uint8_t *data, size_t len)>;
+    // Entrada de walkTree() (name = ruta relativa a la raíz); false corta el recorrido
+    using TreeCallback = std::function<bool(const FileInfo &entry)>;
 
     class PyBoardUART
     {
     private:
-        // UART configuration
-        uart_port_t uartNum;
-        int txPin;
-        int rxPin;
+        // Transporte (UART en el ESP32; pty/TCP en Linux)
+        std::unique_ptr<Transport> transport;
         BaudRate baudRate;
         Timeout defaultTimeout;
         ChunkSize chunkSize;
@@ -87,15 +197,24 @@ namespace PyBoard
         bool inRawRepl;
         bool useRawPaste;
         bool monitorEnabled;
+        bool agentReady;     // '_e' instalado en la sesión actual del intérprete
+        std::string cmd;     // comando armado con render() (conserva la capacidad)
+        // Si es PROMPT, exec/execLine se saltean el CR + espera de '>>>'
+        ReplState replState = ReplState::UNKNOWN;
+        ExecEngine engine = ExecEngine::AUTO;
+        enum class Support : uint8_t { UNKNOWN, YES, NO };
+        Support rawSupport = Support::UNKNOWN; // se prueba una vez (^A)
+        BoardProfile profile;                  // applyProfile()
+        uint16_t pasteWindow = PASTE_WINDOW_INIT; // aprendida por placa
+        bool pasteSlowStart = true;
+        uint16_t pasteCeiling = 0;             // ventana que desbordó (0 = ninguna)
+        uint64_t echoLagUs = 0;                // media del eco de una línea
 
         // Buffers
         std::unique_ptr<uint8_t[]> rxBuffer;
         std::unique_ptr<uint8_t[]> txBuffer;
         static constexpr size_t BUFFER_SIZE = 2048;
 
-        // FreeRTOS handles
-        QueueHandle_t eventQueue;
-        TaskHandle_t monitorTask;
         MonitorCallback monitorCallback;
 
         // REPL control characters
@@ -105,6 +224,21 @@ namespace PyBoard
         static constexpr uint8_t CTRL_D = 0x04; // Soft reset / EOF
         static constexpr uint8_t CTRL_E = 0x05; // Paste mode
 
+        // Silencio tras el cual syncRepl()/waitForReplPrompt() vuelven a tocar la placa
+        static constexpr uint32_t SYNC_NUDGE_MS = 250;
+        // Pegado en paste mode (pasteBlock): ventana de bytes sin eco
+        static constexpr uint16_t PASTE_WINDOW_INIT = 64;
+        static constexpr uint16_t PASTE_WINDOW_MIN = 16;
+        static constexpr uint16_t PASTE_WINDOW_MAX = 1024;
+        static constexpr uint16_t PASTE_WINDOW_STEP = 32;
+        static constexpr uint32_t PASTE_STALL_MS = 400;  // sin eco: se perdió un CR
+        static constexpr int PASTE_ATTEMPTS = 4;
+        // Sondeo de ensureIdle(): cuánto esperar el eco del CR y el plazo del ^C
+        static constexpr uint32_t IDLE_PROBE_MS = 150;
+        static constexpr uint32_t IDLE_INTERRUPT_MS = 1500;
+        // Plazo para el banner del raw REPL tras ^A (y para volver con ^B)
+        static constexpr uint32_t RAW_ENTER_MS = 1000;
+
         // Private helper methods
         ErrorCode writeData(const uint8_t *data, size_t len);
         ErrorCode writeData(const std::string &data);
@@ -114,14 +248,162 @@ namespace PyBoard
         ErrorCode follow(std::string &output, std::string &error, uint32_t timeoutMs);
         ErrorCode rawPasteWrite(const std::string &data);
 
+        // Transferencia por ventana: un programa corto en la placa consume
+        // tramas desde stdin y concede crédito (0x01) por cada trama procesada,
+        // igual que la ventana de raw-paste. Evita un exec() por chunk.
+        // Cada trama lleva número de secuencia (mod 256) y CRC-32 de su
+        // contenido; el que recibe una trama dañada descarta la entrada hasta
+        // que la línea queda quieta y pide reenvío desde esa secuencia (NAK),
+        // así que un error cuesta a lo sumo STREAM_WINDOW tramas.
+        static constexpr size_t STREAM_WINDOW = 2;   // tramas en vuelo
+        static constexpr size_t FRAME_HDR = 14;      // "Klll" + seq (2 hex) + crc (8 hex)
+        static constexpr unsigned STREAM_RETRIES = 8;    // NAK seguidos antes de abandonar
+        static constexpr uint32_t STREAM_QUIET_MS = 50;  // silencio que cierra el descarte
+        static constexpr uint32_t STREAM_RESYNC_MS = 1000; // sin respuesta: se rellena
+        // Trozo de las transferencias (transferChunk): arranca del ChunkSize
+        // configurado con techo según gc.mem_free() del perfil; se duplica
+        // tras una transferencia de al menos CHUNK_GROW_FRAMES tramas casi sin
+        // reenvíos y se parte a la mitad con muchos reenvíos, timeouts o
+        // MemoryError (que además baja el techo).
+        static constexpr size_t CHUNK_MIN = 64;
+        static constexpr size_t CHUNK_MAX = 2048;       // en base64 entra en FRAME_MAX
+        static constexpr size_t CHUNK_UNKNOWN_MAX = 1024; // techo sin perfil
+        static constexpr uint32_t CHUNK_HEAP_DIV = 16;  // heap libre por byte de trozo
+        static constexpr size_t CHUNK_GROW_FRAMES = 4;
+        // writeFileDelta(): bloque inicial de los hashes; la placa lo duplica
+        // hasta que el archivo entre en DELTA_BLOCKS bloques
+        static constexpr size_t DELTA_BLOCK = 256;
+        static constexpr size_t DELTA_BLOCKS = 64;
+        // Lo que cambia viaja en base64 dentro de la línea de _e.pw/_e.pc, que
+        // la placa compila entera: por encima de esto se escribe completo por
+        // tramas (writeWhole), que no necesita el literal en el heap
+        static constexpr size_t DELTA_INLINE_MAX = 4096;
+        // Subida comprimida: bloques de 2^ZIP_WBITS bytes, cada uno un stream
+        // DEFLATE en una trama "Zlll" (o "Plll" sin base64). Un bloque que no
+        // baja al menos 1/8 (o no entra en la trama) viaja como tramas normales.
+        static constexpr unsigned ZIP_WBITS = 12;
+        static constexpr size_t ZIP_BLOCK = size_t(1) << ZIP_WBITS;
+        static constexpr size_t FRAME_MAX = 0xFFF;              // largo en 3 dígitos hex
+        static constexpr size_t ZIP_FRAME_MAX = FRAME_MAX / 4 * 3; // con base64
+        ErrorCode startProgram(const std::string &code);
+        ErrorCode finishProgram(uint32_t timeoutMs);
+        ErrorCode readByte(uint8_t &b, uint32_t timeoutMs);
+        ErrorCode readLine(std::string &line, uint32_t timeoutMs);
+        ErrorCode waitForLine(const char *prefix, std::string &line, uint32_t timeoutMs);
+        ErrorCode writeStream(const std::string &path, const uint8_t *data, size_t len, bool append);
+        ErrorCode takeUploadCredit();
+        ErrorCode uploadFrames(const uint8_t *data, size_t len);
+        ErrorCode uploadBlock(const uint8_t *data, size_t len);
+        ErrorCode uploadFrame(char kind, const uint8_t *data, size_t len, uint32_t crc);
+        ErrorCode resendFrom(uint8_t seq);
+        ErrorCode readStream(const std::string &path, const ChunkCallback &onChunk, size_t chunk,
+                             size_t &total, size_t &resent, bool &binary);
+        ErrorCode uploadClose();
+        size_t transferChunk();
+        void chunkFeedback(ErrorCode err, size_t frames);
+        uint32_t resyncMs() const;
+        std::string drainQuiet();
+
+        // Handshakes según replState: readyAtPrompt() solo hace la ida y
+        // vuelta CR/'>>>' si el estado no está confirmado; pasteAndRun() entra
+        // a paste mode (reintenta con handshake completo si el estado mintió),
+        // pega el código y lo arranca.
+        bool promptCached();
+        ErrorCode readyAtPrompt(uint32_t timeoutMs);
+        ErrorCode pasteAndRun(const std::string &code);
+        ErrorCode pasteBlock(const std::string &norm, bool &overrun);
+
+        // Motor RAW: entra al raw REPL antes de ejecutar si corresponde (la
+        // sesión queda en raw hasta exitRawRepl()); expectRawPrompt() consume
+        // el '>' que sigue a cada respuesta; recoverAfterInterrupt() vuelve al
+        // prompt del modo actual tras un ^C.
+        ErrorCode prepareEngine();
+        ErrorCode checkRxOverflow(ErrorCode rc);
+        void expectRawPrompt();
+        bool recoverAfterInterrupt(uint32_t timeoutMs);
+        std::string agentSource() const;
+
+        // Sesión de subida abierta (_e.ws corriendo en la placa)
+        struct UploadState
+        {
+            bool open = false;
+            std::string path;
+            std::deque<std::string> sent; // tramas sin crédito, para reenviar
+            uint8_t seq = 0;      // secuencia de la próxima trama
+            unsigned retries = 0; // NAK desde el último crédito
+            size_t resent = 0;    // tramas reenviadas en la sesión
+            bool padded = false;  // se mandó relleno y falta el NAK que lo descarta
+            size_t chunk = 0;     // trozo de las tramas sin comprimir
+            size_t frames = 0;    // tramas de 'chunk' enviadas (sin reenvíos)
+            size_t bytes = 0;     // bytes enviados
+            uint32_t crc = 0;     // CRC-32 de lo enviado
+            uint64_t t0 = 0;
+            uint32_t mtime = 0;   // st_mtime del archivo al cerrar (0 = sin dato)
+            bool verified = false; // la placa informó CRC y coincidió
+            bool zip = false;     // la placa descomprime tramas "Z"/"P"
+            WireCodec codec = WireCodec::BASE64; // el que aceptó la placa
+            std::vector<uint8_t> pending; // bloque a medio juntar (zip)
+            size_t wire = 0;      // bytes de contenido en la línea (antes del base64)
+        } upload;
+
+        // Compresión de subidas: compression la pide, boardInflate recuerda
+        // si la placa pudo descomprimir (se vuelve a preguntar si cambia el uid)
+        bool compression = true;
+        Support boardInflate = Support::UNKNOWN;
+        Deflater deflater;
+        std::vector<uint8_t> zbuf;
+        bool zipWanted() const;
+        WireCodec wireCodec = WireCodec::RAW;
+        std::string frame; // trama armada (se recicla al recibir crédito)
+        bool chunkAuto = true;
+        size_t chunkNow = 0;      // trozo en uso (0 = se fija en la próxima transferencia)
+        size_t chunkCeiling = 0;
+        TransferStats lastTransfer;
+
+        // Manifiesto de lo escrito en esta placa (se vacía si cambia el uid):
+        // tamaño, st_mtime y hash del contenido. Si lo que se va a escribir
+        // tiene el mismo hash y la placa informa el mismo tamaño y mtime, la
+        // escritura se saltea. Sin entrada, la placa hashea su copia
+        // (hashlib.sha256, o CRC-32 si no hay hashlib).
+        struct ManifestEntry
+        {
+            size_t size = 0;
+            uint32_t mtime = 0;
+            std::string digest;
+        };
+        enum class DigestKind : uint8_t { UNKNOWN, SHA256, CRC32 };
+        std::unordered_map<std::string, ManifestEntry> manifest;
+        DigestKind digestKind = DigestKind::UNKNOWN; // el de _e.hs en esta placa
+        static constexpr size_t MANIFEST_MAX = 256;
+        std::string contentDigest(const uint8_t *data, size_t size) const;
+        bool unchangedOnBoard(const std::string &path, const uint8_t *data, size_t size, bool hashOnBoard);
+        void manifestRecord(const std::string &path, const uint8_t *data, size_t size, uint32_t mtime);
+        void manifestForget(const std::string &path, bool subtree = false);
+        ErrorCode writeWhole(const std::string &path, const uint8_t *data, size_t size);
+
+        // Agente residente ('_e'): se instala una vez por sesión del intérprete
+        // y las operaciones FS pasan a ser llamadas de una línea.
+        ErrorCode ensureAgent();
+        ErrorCode execLine(const std::string &line, std::string &output, uint32_t timeoutMs = 0);
+        ErrorCode agentCall(const std::string &call, std::string &output, uint32_t timeoutMs = 0);
+        // Llamadas más largas van por exec() (pegado con pacing) y no por el prompt
+        static constexpr size_t AGENT_LINE_MAX = 512;
+        ErrorCode startCall(const std::string &call);
+
     public:
         // Constructor and destructor
+#ifdef ESP_PLATFORM
         PyBoardUART(uart_port_t uart = UART_NUM_2,
                     int tx = 21,
                     int rx = 22,
                     BaudRate baud = BaudRate::BAUD_115200,
                     Timeout timeout = Timeout::MEDIUM,
                     ChunkSize chunk = ChunkSize::MEDIUM);
+#endif
+        // Cualquier transporte (PtyTransport/TcpTransport en builds de host)
+        explicit PyBoardUART(std::unique_ptr<Transport> transport,
+                             Timeout timeout = Timeout::MEDIUM,
+                             ChunkSize chunk = ChunkSize::MEDIUM);
         ~PyBoardUART();
 
         // Disable copy constructor and assignment
@@ -135,7 +417,18 @@ namespace PyBoard
         // Configuration setters
         void setBaudRate(BaudRate baud) { baudRate = baud; }
         void setTimeout(Timeout timeout) { defaultTimeout = timeout; }
-        void setChunkSize(ChunkSize chunk) { chunkSize = chunk; }
+        void setChunkSize(ChunkSize chunk) { chunkSize = chunk; chunkNow = 0; }
+        // Trozo adaptativo (por defecto): ChunkSize es solo el punto de
+        // partida de las transferencias (ver transferChunk)
+        void setAdaptiveChunk(bool on) { chunkAuto = on; chunkNow = 0; }
+        size_t getChunkBytes() const { return chunkNow ? chunkNow : static_cast<size_t>(chunkSize); }
+        const TransferStats &getLastTransfer() const { return lastTransfer; }
+        // Subidas comprimidas (DEFLATE) si la placa puede descomprimir; si no,
+        // o si falla a mitad de camino, se sube sin comprimir
+        void setCompression(bool on) { compression = on; }
+        // Máximo a usar; la placa puede bajarlo por sesión (ver WireCodec)
+        void setWireCodec(WireCodec c) { wireCodec = c; }
+        WireCodec getWireCodec() const { return wireCodec; }
 
         // REPL control
         ErrorCode enterRawRepl(bool softReset = true);
@@ -143,8 +436,27 @@ namespace PyBoard
         ErrorCode softReset();
         ErrorCode interrupt();
 
+        // Sondeo al conectar (un exec). full=false solo lee dialecto, versión e
+        // id para buscar un perfil guardado; full=true además lo aplica.
+        ErrorCode probeBoard(BoardProfile &out, bool full = true);
+        // Perfil guardado de esta placa: motor, raw-paste y agente sin pruebas
+        void applyProfile(const BoardProfile &p);
+        const BoardProfile &getProfile() const { return profile; }
+        uint16_t getPasteWindow() const { return pasteWindow; }
+
         bool isInRawRepl() const { return inRawRepl; }
-        ErrorCode syncReplCircuitPython(uint32_t timeoutMs);
+        // FRIENDLY sale del raw REPL si la sesión estaba en él; AUTO/RAW
+        // vuelven a probar el raw REPL en la próxima ejecución
+        void setEngine(ExecEngine e);
+        ExecEngine getEngine() const { return engine; }
+        ReplState getReplState() const { return replState; }
+        // Vuelve al prompt '>>>' detectándolo en el flujo (ver .cpp); con
+        // softReset además espera el fin del reinicio (^D)
+        ErrorCode syncRepl(uint32_t timeoutMs, bool softReset);
+        ErrorCode syncReplCircuitPython(uint32_t timeoutMs); // syncRepl(t, true)
+        // Escalado mínimo hasta el prompt: sondeo con CR, luego ^C y solo si
+        // hace falta (y allowReset) ^D. 'level' dice qué se usó.
+        ErrorCode ensureIdle(uint32_t timeoutMs, bool allowReset = true, IdleLevel *level = nullptr);
         ErrorCode waitForReplPrompt(uint32_t timeoutMs);
 
         // --- Escritura cruda por UART (API pública) ---
@@ -154,6 +466,8 @@ namespace PyBoard
         ErrorCode write(const std::string &data);
         /** Conveniencia para buffers C. Equivalente a write(void*, len). */
         ErrorCode write(const char *data, size_t len);
+        /** Lee lo que haya recibido el transporte; bloquea hasta timeoutMs si no hay nada. */
+        size_t read(void *data, size_t len, uint32_t timeoutMs);
 
         // Code execution
         ErrorCode execRaw(const std::string &command, std::string &output, std::string &error, uint32_t timeoutMs = 0);
@@ -162,6 +476,9 @@ namespace PyBoard
         ErrorCode eval(const std::string &expression, std::string &result, uint32_t timeoutMs = 0);
         ErrorCode execPaste(const std::string &code, std::string &output, uint32_t timeoutMs = 0);
         ErrorCode execFriendly(const std::string& command, std::string& output, uint32_t timeoutMs = 0);
+        // Como exec(), pero la salida llega por trozos a onOutput mientras corre el programa.
+        // Sin salida se llama igual con len=0 cada ~50 ms, para poder cancelar en silencio.
+        ErrorCode execStream(const std::string &command, const ChunkCallback &onOutput, uint32_t timeoutMs = 0);
 
         // File system operations with Base64 encoding
         ErrorCode listDir(const std::string &path, std::vector<FileInfo> &files);
@@ -173,11 +490,43 @@ ErrorCode writeFileChunk(const std::string& path,
                          const uint8_t* data, size_t len,
                          bool append);
 
+        // Sesión de subida: el archivo queda abierto en la placa entre trozos.
+        // uploadEnd() cierra y compara bytes/CRC-32 con lo que escribió la placa.
+        // Mientras la sesión está abierta no se puede usar otra operación.
+        ErrorCode uploadBegin(const std::string &path, bool append);
+        ErrorCode uploadWrite(const uint8_t *data, size_t len);
+        ErrorCode uploadEnd();
+        void uploadAbort();
+        bool uploadOpen() const { return upload.open; }
+
         ErrorCode readFileRaw(const std::string &path, std::vector<uint8_t> &content);
+        // Lectura sin acumular el archivo: onChunk recibe cada trozo (<= ChunkSize)
+        ErrorCode readFileStream(const std::string &path, const ChunkCallback &onChunk);
+        // No envía nada si la placa ya tiene el mismo contenido (ver manifest)
         ErrorCode writeFileRaw(const std::string &path, const std::vector<uint8_t> &content);
+        // Como writeFileRaw(), pero si el archivo ya existe solo viajan los
+        // bloques que cambiaron (ver .cpp). 'sent': bytes de contenido enviados.
+        ErrorCode writeFileDelta(const std::string &path, const uint8_t *data, size_t size,
+                                 size_t *sent = nullptr);
         ErrorCode deleteFile(const std::string &path);
         ErrorCode createDir(const std::string &path);
         ErrorCode deleteDir(const std::string &path);
+        // Borra el directorio y todo su contenido en una sola llamada al agente
+        ErrorCode deleteTree(const std::string &path);
+        // Recorrido en anchura hecho en la placa (una sola llamada): hasta
+        // maxDepth niveles y 'limit' entradas; 'glob' (* y ?) filtra archivos
+        // por nombre. Cada entrada llega a onEntry a medida que se lee.
+        // completeDepth: los directorios de nivel < completeDepth (raíz = 0)
+        // quedaron listados enteros (menos que maxDepth si se llegó a limit).
+        ErrorCode walkTree(const std::string &root, int maxDepth, const std::string &glob, size_t limit,
+                           const TreeCallback &onEntry, int *completeDepth = nullptr);
+        ErrorCode renamePath(const std::string &from, const std::string &to);
+        // Corre las operaciones en orden con una sola llamada al agente. Con
+        // stopOnError el lote se corta en la primera que falla (las demás
+        // quedan con ran=false). Devuelve OK si el lote llegó al final aunque
+        // alguna operación haya fallado: ver 'results'.
+        ErrorCode runBatch(const std::vector<BatchOp> &ops, bool stopOnError,
+                           std::vector<BatchResult> &results, uint32_t timeoutMs = 0);
         ErrorCode exists(const std::string &path, bool &result);
         ErrorCode getFileInfo(const std::string &path, FileInfo &info);
 
@@ -191,6 +540,7 @@ ErrorCode writeFileChunk(const std::string& path,
 
         // Base64 utilities (public for external use if needed)
         static std::string base64Encode(const std::vector<uint8_t> &data);
+        static void base64Append(const uint8_t *data, size_t len, std::string &out);
         static std::vector<uint8_t> base64Decode(const std::string &encoded);
 
     private:
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace PyBoard
+{
+
+    // Plantilla de un snippet Python que viaja por la UART: texto minificado
+    // con huecos {0}..{7}. Los huecos se ubican al compilar (constexpr) y
+    // render() arma el comando con una sola reserva, sin stringstream ni
+    // concatenaciones intermedias.
+    //
+    //   static constexpr PyTemplate LS{"_e.ls({0})"};
+    //   render<LS>(cmd, PyQuoted{path});
+    class PyTemplate
+    {
+    public:
+        static constexpr size_t MAX_SLOTS = 8;
+
+        template <size_t N>
+        constexpr PyTemplate(const char (&s)[N]) : text(s), len(N - 1)
+        {
+            for (size_t i = 0; i + 2 < N; ++i) {
+                if (s[i] == '{' && s[i + 1] >= '0' && s[i + 1] <= '7' && s[i + 2] == '}') {
+                    // Más de MAX_SLOTS huecos no compila (índice fuera de rango)
+                    pos[slots] = (uint16_t)i;
+                    arg[slots] = (uint8_t)(s[i + 1] - '0');
+                    if (arg[slots] + 1 > arity) arity = (uint8_t)(arg[slots] + 1);
+                    ++slots;
+                    i += 2;
+                }
+            }
+        }
+
+        const char *text;
+        size_t len;
+        uint8_t slots = 0;
+        uint8_t arity = 0;          // argumentos que pide render()
+        uint16_t pos[MAX_SLOTS] = {};
+        uint8_t arg[MAX_SLOTS] = {};
+    };
+
+    // Literal Python entre comillas simples (' y \ escapados, \n y \r como
+    // \\n y \\r, demás controles como \\xNN: un ^C o un CR no llegan crudos
+    // al prompt)
+    struct PyQuoted
+    {
+        const std::string &s;
+    };
+
+    // Argumento ya resuelto: texto tal cual, entero formateado o literal
+    class PyArg
+    {
+    public:
+        PyArg() = default;
+        PyArg(const std::string &s) : p(s.data()), n(s.size()) {}
+        PyArg(const char *s) : p(s), n(std::char_traits<char>::length(s)) {}
+        PyArg(PyQuoted q) : p(q.s.data()), n(q.s.size()), quoted(true) {}
+        PyArg(long long v) { format(v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v, v < 0); }
+        PyArg(unsigned long long v) { format(v, false); }
+        PyArg(int v) : PyArg((long long)v) {}
+        PyArg(unsigned v) : PyArg((unsigned long long)v) {}
+        PyArg(unsigned long v) : PyArg((unsigned long long)v) {}
+        PyArg(const PyArg &o) : n(o.n), quoted(o.quoted)
+        {
+            std::char_traits<char>::copy(num, o.num, sizeof(num));
+            const bool own = o.p >= o.num && o.p < o.num + sizeof(num);
+            p = own ? num + (o.p - o.num) : o.p;
+        }
+        PyArg &operator=(const PyArg &) = delete;
+
+        size_t size() const
+        {
+            if (!quoted) return n;
+            size_t extra = 2;
+            for (size_t i = 0; i < n; ++i) {
+                const char c = p[i];
+                if (c == '\'' || c == '\\' || c == '\n' || c == '\r') ++extra;
+                else if (isControl(c)) extra += 3;
+            }
+            return n + extra;
+        }
+
+        void appendTo(std::string &out) const
+        {
+            if (!quoted) { out.append(p, n); return; }
+            out.push_back('\'');
+            for (size_t i = 0; i < n; ++i) {
+                const char c = p[i];
+                if (c == '\'') out += "\\'";
+                else if (c == '\\') out += "\\\\";
+                else if (c == '\n') out += "\\n";
+                else if (c == '\r') out += "\\r";
+                else if (isControl(c)) {
+                    static const char hex[] = "0123456789abcdef";
+                    const char e[4] = {'\\', 'x', hex[(uint8_t)c >> 4], hex[c & 0xf]};
+                    out.append(e, 4);
+                }
+                else out.push_back(c);
+            }
+            out.push_back('\'');
+        }
+
+    private:
+        static bool isControl(char c) { return ((uint8_t)c < 0x20 && c != '\t') || c == 0x7f; }
+
+        // Decimal sin snprintf: es la mayor parte del costo de armar una llamada
+        void format(unsigned long long v, bool neg)
+        {
+            char *e = num + sizeof(num), *q = e;
+            do { *--q = (char)('0' + v % 10); v /= 10; } while (v);
+            if (neg) *--q = '-';
+            p = q;
+            n = (size_t)(e - q);
+        }
+
+        char num[24] = {};
+        const char *p = "";
+        size_t n = 0;
+        bool quoted = false;
+    };
+
+    inline void renderInto(std::string &out, const PyTemplate &t, const PyArg *args)
+    {
+        size_t total = t.len - 3u * t.slots;
+        for (uint8_t i = 0; i < t.slots; ++i) total += args[t.arg[i]].size();
+        out.clear();
+        out.reserve(total);
+
+        size_t from = 0;
+        for (uint8_t i = 0; i < t.slots; ++i) {
+            out.append(t.text + from, t.pos[i] - from);
+            args[t.arg[i]].appendTo(out);
+            from = t.pos[i] + 3u;
+        }
+        out.append(t.text + from, t.len - from);
+    }
+
+    // Deja en 'out' (reutilizable: conserva su capacidad) la plantilla T con
+    // los argumentos. La cantidad de argumentos se verifica al compilar.
+    template <const PyTemplate &T, typename... A>
+    void render(std::string &out, const A &...a)
+    {
+        static_assert(sizeof...(A) == T.arity, "PyTemplate: cantidad de argumentos");
+        const PyArg args[sizeof...(A) + 1] = {PyArg(a)..., PyArg()};
+        renderInto(out, T, args);
+    }
+
+} // namespace PyBoard
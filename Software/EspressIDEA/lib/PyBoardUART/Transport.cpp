@@ -0,0 +1,102 @@
+#include "Transport.hpp"
+#include "Platform.hpp"
+#include <cstring>
+#include <algorithm>
+
+namespace PyBoard {
+
+// ============================================================================
+// NeedleMatcher
+// ============================================================================
+uint32_t NeedleMatcher::add(const char *needle) {
+    size_t len = needle ? std::strlen(needle) : 0;
+    if (count >= MAX_NEEDLES || len == 0 || len > MAX_LEN) return 0;
+
+    Needle &n = needles[count];
+    std::memcpy(n.s, needle, len);
+    n.len = static_cast<uint8_t>(len);
+    n.state = 0;
+
+    // Tabla de fallos KMP
+    n.fail[0] = 0;
+    for (size_t i = 1, k = 0; i < len; ++i) {
+        while (k > 0 && n.s[i] != n.s[k]) k = n.fail[k - 1];
+        if (n.s[i] == n.s[k]) ++k;
+        n.fail[i] = static_cast<uint8_t>(k);
+    }
+    return 1u << count++;
+}
+
+void NeedleMatcher::reset() {
+    for (size_t i = 0; i < count; ++i) needles[i].state = 0;
+}
+
+uint32_t NeedleMatcher::feed(char c) {
+    uint32_t hit = 0;
+    for (size_t i = 0; i < count; ++i) {
+        Needle &n = needles[i];
+        size_t k = n.state;
+        while (k > 0 && c != n.s[k]) k = n.fail[k - 1];
+        if (c == n.s[k]) ++k;
+        if (k == n.len) {
+            hit |= 1u << i;
+            k = n.fail[k - 1];
+        }
+        n.state = static_cast<uint8_t>(k);
+    }
+    return hit;
+}
+
+// ============================================================================
+// Transport
+// ============================================================================
+size_t Transport::read(uint8_t *buf, size_t max, uint32_t timeoutMs) {
+    if (!buf || max == 0) return 0;
+    if (!pending.empty()) {
+        size_t n = std::min(max, pending.size());
+        std::memcpy(buf, pending.data(), n);
+        pending.erase(0, n);
+        return n;
+    }
+    return readRaw(buf, max, timeoutMs);
+}
+
+uint32_t Transport::readUntil(NeedleMatcher &m, std::string &out, uint32_t timeoutMs, size_t maxKeep) {
+    const uint64_t deadline = nowUs() + (uint64_t)timeoutMs * 1000ULL;
+    uint8_t buf[256];
+    for (;;) {
+        uint64_t now = nowUs();
+        if (now >= deadline) return 0;
+
+        size_t n = read(buf, sizeof(buf), (uint32_t)((deadline - now + 999) / 1000ULL));
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t hit = m.feed(static_cast<char>(buf[i]));
+            if (hit) {
+                out.append(reinterpret_cast<const char *>(buf), i + 1);
+                unread(reinterpret_cast<const char *>(buf) + i + 1, n - i - 1);
+                return hit;
+            }
+        }
+        out.append(reinterpret_cast<const char *>(buf), n);
+        if (maxKeep && out.size() > maxKeep * 2) out.erase(0, out.size() - maxKeep);
+    }
+}
+
+void Transport::unread(const char *data, size_t len) {
+    if (len) pending.insert(0, data, len);
+}
+
+void Transport::flush() {
+    pending.clear();
+    flushRaw();
+    overflowsSeen = overflowCountRaw();
+}
+
+bool Transport::takeOverflow() {
+    const uint32_t n = overflowCountRaw();
+    if (n == overflowsSeen) return false;
+    overflowsSeen = n;
+    return true;
+}
+
+} // namespace PyBoard
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace PyBoard
+{
+
+    // Buscador incremental de varias agujas (KMP por aguja). Se alimenta byte a
+    // byte y no necesita reescanear lo ya visto, a diferencia de acc.find().
+    class NeedleMatcher
+    {
+    public:
+        static constexpr size_t MAX_NEEDLES = 8;
+        static constexpr size_t MAX_LEN = 32;
+
+        NeedleMatcher() = default;
+        explicit NeedleMatcher(const char *needle) { add(needle); }
+
+        // Devuelve el bit de la aguja (1 << índice) o 0 si no hay lugar
+        uint32_t add(const char *needle);
+        void reset();
+
+        // Máscara de agujas que terminan exactamente en este byte
+        uint32_t feed(char c);
+
+    private:
+        struct Needle
+        {
+            char s[MAX_LEN];
+            uint8_t fail[MAX_LEN];
+            uint8_t len;
+            uint8_t state;
+        };
+        Needle needles[MAX_NEEDLES];
+        size_t count = 0;
+    };
+
+    // Transporte de bytes hacia la placa. PyBoardUART solo habla con esta
+    // interfaz: UART en el ESP32 (UartTransport), pty o TCP en Linux
+    // (PosixTransport) para correr el protocolo sin hardware.
+    class Transport
+    {
+    public:
+        virtual ~Transport() = default;
+
+        virtual bool open() = 0;
+        virtual void close() = 0;
+        virtual bool isOpen() const = 0;
+        virtual const char *name() const = 0;
+
+        // Bytes escritos o -1 si falla
+        virtual int write(const void *data, size_t len) = 0;
+
+        // Lee hasta 'max' bytes; bloquea hasta timeoutMs solo si no hay nada
+        size_t read(uint8_t *buf, size_t max, uint32_t timeoutMs);
+        // Lee hasta que 'm' coincida. Deja en 'out' todo lo leído (incluida la
+        // aguja) y devuelve la máscara que coincidió, o 0 si venció el plazo.
+        uint32_t readUntil(NeedleMatcher &m, std::string &out, uint32_t timeoutMs, size_t maxKeep = 0);
+        // Devuelve bytes al frente de la cola (lo leído de más)
+        void unread(const char *data, size_t len);
+        size_t available() const { return pending.size() + availableRaw(); }
+        void flush();
+        // true si se perdieron bytes de RX (buffer lleno) desde la última
+        // llamada o desde flush(): lo leído en el medio está incompleto
+        bool takeOverflow();
+
+        const std::string &error() const { return lastError; }
+
+    protected:
+        virtual size_t readRaw(uint8_t *buf, size_t max, uint32_t timeoutMs) = 0;
+        virtual size_t availableRaw() const = 0;
+        virtual void flushRaw() = 0;
+        // Pérdidas de RX acumuladas por el backend (0 si no puede perder bytes)
+        virtual uint32_t overflowCountRaw() const { return 0; }
+
+        std::string lastError;
+
+    private:
+        std::string pending; // devuelto con unread(), se consume primero
+        uint32_t overflowsSeen = 0;
+    };
+
+} // namespace PyBoard
@@ -0,0 +1,147 @@
+#ifdef ESP_PLATFORM
+
+#include "UartTransport.hpp"
+#include "Platform.hpp"
+#include <cstdio>
+#include <algorithm>
+
+static const char *TAG = "UartTransport";
+
+namespace PyBoard {
+
+UartTransport::UartTransport(uart_port_t uart, int tx, int rx, int baud, size_t bufSize)
+    : uartNum(uart), txPin(tx), rxPin(rx), baudRate(baud), bufferSize(bufSize) {
+    std::snprintf(label, sizeof(label), "UART%d", (int)uart);
+}
+
+bool UartTransport::open() {
+    if (task) return true;
+
+    uart_config_t uart_config = {
+        .baud_rate = baudRate,
+        .data_bits = UART_DATA_8_BITS,
+        .parity    = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .rx_flow_ctrl_thresh = 0,
+        .source_clk = UART_SCLK_APB,
+    };
+
+    esp_err_t err = uart_driver_install(uartNum, bufferSize, bufferSize, 20, &eventQueue, 0);
+    if (err != ESP_OK) {
+        lastError = "Failed to install UART driver";
+        return false;
+    }
+    err = uart_param_config(uartNum, &uart_config);
+    if (err != ESP_OK) {
+        close();
+        lastError = "Failed to configure UART parameters";
+        return false;
+    }
+    err = uart_set_pin(uartNum, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    if (err != ESP_OK) {
+        close();
+        lastError = "Failed to set UART pins";
+        return false;
+    }
+
+    // '>>>' genera UART_PATTERN_DET: el prompt despierta al lector sin esperar
+    // el timeout de RX del driver
+    uart_enable_pattern_det_baud_intr(uartNum, '>', 3, 9, 0, 0);
+    uart_pattern_queue_reset(uartNum, 20);
+
+    ring = xStreamBufferCreate(bufferSize, 1);
+    if (!ring) {
+        close();
+        lastError = "No memory for RX ring";
+        return false;
+    }
+
+    if (xTaskCreate(rxTask, "pyb_uart_rx", 3072, this, 12, &task) != pdPASS) {
+        task = nullptr;
+        close();
+        lastError = "Failed to start RX task";
+        return false;
+    }
+
+    ESP_LOGI(TAG, "UART%d abierto (TX:%d, RX:%d, Baud:%d)", (int)uartNum, txPin, rxPin, baudRate);
+    return true;
+}
+
+void UartTransport::close() {
+    if (task) { vTaskDelete(task); task = nullptr; }
+    if (eventQueue) { uart_driver_delete(uartNum); eventQueue = nullptr; }
+    if (ring) { vStreamBufferDelete(ring); ring = nullptr; }
+}
+
+int UartTransport::write(const void *data, size_t len) {
+    return uart_write_bytes(uartNum, data, len);
+}
+
+void UartTransport::rxTask(void *arg) {
+    auto *self = static_cast<UartTransport *>(arg);
+    uart_event_t ev;
+    for (;;) {
+        if (xQueueReceive(self->eventQueue, &ev, portMAX_DELAY) != pdTRUE) continue;
+
+        switch (ev.type) {
+        case UART_PATTERN_DET:
+            // La posición no interesa (los lectores ubican '>>>'); solo evita
+            // que la cola de patrones del driver se llene.
+            (void)uart_pattern_pop_pos(self->uartNum);
+            self->pump();
+            break;
+        case UART_DATA:
+            self->pump();
+            break;
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            // Se perdieron bytes: lo que queda en el driver ya no es coherente
+            ++self->overflows;
+            ESP_LOGW(TAG, "RX overflow (%d), flushing", (int)ev.type);
+            uart_flush_input(self->uartNum);
+            xQueueReset(self->eventQueue);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Mueve todo lo que haya en el driver al ring
+void UartTransport::pump() {
+    uint8_t buf[256];
+    for (;;) {
+        size_t avail = 0;
+        uart_get_buffered_data_len(uartNum, &avail);
+        if (avail == 0) break;
+
+        int n = uart_read_bytes(uartNum, buf, std::min(avail, sizeof(buf)), 0);
+        if (n <= 0) break;
+
+        // Si el consumidor no lee (nadie atiende la placa) se descarta el
+        // exceso; el próximo lector lo ve en takeOverflow()
+        size_t sent = xStreamBufferSend(ring, buf, n, msToTicks(20));
+        if (sent < static_cast<size_t>(n)) ++overflows;
+    }
+}
+
+size_t UartTransport::readRaw(uint8_t *buf, size_t max, uint32_t timeoutMs) {
+    if (!ring) return 0;
+    return xStreamBufferReceive(ring, buf, max, msToTicks(timeoutMs));
+}
+
+size_t UartTransport::availableRaw() const {
+    return ring ? xStreamBufferBytesAvailable(ring) : 0;
+}
+
+void UartTransport::flushRaw() {
+    uart_flush_input(uartNum);
+    if (!ring) return;
+    uint8_t buf[128];
+    while (xStreamBufferReceive(ring, buf, sizeof(buf), 0) > 0) {}
+}
+
+} // namespace PyBoard
+
+#endif // ESP_PLATFORM
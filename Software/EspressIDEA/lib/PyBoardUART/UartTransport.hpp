@@ -0,0 +1,62 @@
+#pragma once
+
+#ifdef ESP_PLATFORM
+
+#include "Transport.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/stream_buffer.h"
+#include "driver/uart.h"
+
+namespace PyBoard
+{
+
+    // Transporte UART con motor de recepción: una tarea consume los eventos
+    // UART_DATA / UART_PATTERN_DET del driver y vuelca los bytes en un
+    // StreamBuffer. Los lectores bloquean en el StreamBuffer (notificación de
+    // tarea) en vez de hacer polling con timeouts cortos. Si el ring o el
+    // driver se llenan los bytes se pierden y takeOverflow() lo informa.
+    class UartTransport : public Transport
+    {
+    public:
+        UartTransport(uart_port_t uart, int tx, int rx, int baud, size_t bufferSize = 4096);
+        ~UartTransport() override { close(); }
+
+        UartTransport(const UartTransport &) = delete;
+        UartTransport &operator=(const UartTransport &) = delete;
+
+        bool open() override;
+        void close() override;
+        bool isOpen() const override { return task != nullptr; }
+        const char *name() const override { return label; }
+        int write(const void *data, size_t len) override;
+
+        uart_port_t port() const { return uartNum; }
+
+    protected:
+        size_t readRaw(uint8_t *buf, size_t max, uint32_t timeoutMs) override;
+        size_t availableRaw() const override;
+        void flushRaw() override;
+        uint32_t overflowCountRaw() const override { return overflows; }
+
+    private:
+        uart_port_t uartNum;
+        int txPin;
+        int rxPin;
+        int baudRate;
+        size_t bufferSize;
+        char label[8];
+
+        QueueHandle_t eventQueue = nullptr;
+        StreamBufferHandle_t ring = nullptr;
+        TaskHandle_t task = nullptr;
+        volatile uint32_t overflows = 0;
+
+        static void rxTask(void *arg);
+        void pump();
+    };
+
+} // namespace PyBoard
+
+#endif // ESP_PLATFORM
@@ -11,6 +11,7 @@
 #include <string.h>
 #include <vector>
 #include "esp_http_server.h"
+#include "freertos/task.h"
 
 #define WIFI_CONNECTED_BIT BIT0
 static EventGroupHandle_t wifi_event_group;
@@ -121,7 +122,11 @@ void ServerManager::initMdns() {
 void ServerManager::initHttp() {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.max_uri_handlers = 40;
+    // Las peticiones async retienen su socket mientras corren en el pool
+    config.max_open_sockets = 7;
+    config.lru_purge_enable = true;
     ESP_ERROR_CHECK(httpd_start(&http_server, &config));
+    initAsyncWorkers();
 
     // Index fallback
     httpd_uri_t index = {};
@@ -192,6 +197,100 @@ void ServerManager::registerHttpHandler(const httpd_uri_t& handler) {
     httpd_register_uri_handler(http_server, &handler);
 }
 
+// ---------------- Handlers async (pool de workers) ----------------
+
+// Un worker bloqueado en ReplControl::run() espera a que termine lo que esté
+// corriendo en la placa; con todos así, STOP no tendría dónde correr. Por eso
+// las rutas 'urgent' tienen su propio pool.
+void ServerManager::initAsyncWorkers() {
+    if (!initAsyncPool(asyncPool, kAsyncWorkers, "httpd_async")) return;
+    (void)initAsyncPool(asyncUrgent, kAsyncUrgentWorkers, "httpd_urgent");
+}
+
+bool ServerManager::initAsyncPool(AsyncPool& pool, int workers, const char* prefix) {
+    pool.queue = xQueueCreate(workers, sizeof(AsyncJob));
+    pool.idle  = xSemaphoreCreateCounting(workers, 0);
+    if (!pool.queue || !pool.idle) {
+        ESP_LOGE(TAG, "No memory for async workers (%s)", prefix);
+        if (pool.queue) { vQueueDelete(pool.queue); pool.queue = nullptr; }
+        if (pool.idle)  { vSemaphoreDelete(pool.idle); pool.idle = nullptr; }
+        return false;
+    }
+    for (int i = 0; i < workers; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "%s%d", prefix, i);
+        if (xTaskCreate(asyncWorkerTask, name, kAsyncWorkerStack, &pool, 5, nullptr) == pdPASS)
+            xSemaphoreGive(pool.idle);
+    }
+    return true;
+}
+
+void ServerManager::registerAsyncHandler(const httpd_uri_t& handler, uint8_t maxInflight, bool urgent) {
+    AsyncPool* pool = (urgent && asyncUrgent.queue) ? &asyncUrgent : &asyncPool;
+    if (!pool->queue) { registerHttpHandler(handler); return; } // sin pool: síncrono
+
+    auto* route = new AsyncRoute();
+    route->pool = pool;
+    route->handler = handler.handler;
+    route->userCtx = handler.user_ctx;
+    route->maxInflight = maxInflight ? maxInflight : 1;
+
+    httpd_uri_t h = handler;
+    h.handler  = asyncTrampoline;
+    h.user_ctx = route;
+    httpd_register_uri_handler(http_server, &h);
+}
+
+void ServerManager::sendBusy(httpd_req_t* req) {
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, "{\"ok\":false,\"error\":\"busy\"}");
+}
+
+// Corre en la tarea del httpd: reserva cupo de ruta y worker, copia la
+// petición y la pasa al pool. Nunca bloquea.
+esp_err_t ServerManager::asyncTrampoline(httpd_req_t* req) {
+    auto* route = static_cast<AsyncRoute*>(req->user_ctx);
+    AsyncPool* pool = route->pool;
+
+    uint8_t cur = route->inflight.load();
+    do {
+        if (cur >= route->maxInflight) { sendBusy(req); return ESP_OK; }
+    } while (!route->inflight.compare_exchange_weak(cur, cur + 1));
+
+    if (xSemaphoreTake(pool->idle, 0) != pdTRUE) {
+        --route->inflight;
+        sendBusy(req);
+        return ESP_OK;
+    }
+
+    AsyncJob job = {nullptr, route};
+    if (httpd_req_async_handler_begin(req, &job.req) != ESP_OK) {
+        xSemaphoreGive(pool->idle);
+        --route->inflight;
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "async begin failed");
+        return ESP_OK;
+    }
+    job.req->user_ctx = route->userCtx;   // el handler ve su user_ctx original
+
+    // Hay un worker libre reservado: la cola tiene lugar
+    xQueueSend(pool->queue, &job, portMAX_DELAY);
+    return ESP_OK;
+}
+
+void ServerManager::asyncWorkerTask(void* arg) {
+    auto* pool = static_cast<AsyncPool*>(arg);
+    AsyncJob job;
+    for (;;) {
+        if (xQueueReceive(pool->queue, &job, portMAX_DELAY) != pdTRUE) continue;
+        job.route->handler(job.req);
+        httpd_req_async_handler_complete(job.req);
+        --job.route->inflight;
+        xSemaphoreGive(pool->idle);
+    }
+}
+
 void ServerManager::broadcastWS(const std::string& data) {
     if (!http_server || data.empty()) return;
 
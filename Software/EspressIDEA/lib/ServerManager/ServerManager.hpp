@@ -1,7 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <string>
 #include "esp_http_server.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 class ServerManager {
 public:
@@ -9,6 +13,12 @@ public:
     void begin();
 
     void registerHttpHandler(const httpd_uri_t& handler);
+    // Handler lento (UART, LLM): corre en el pool de workers y no bloquea la
+    // tarea del httpd. Con maxInflight peticiones en curso, o sin worker
+    // libre, responde 503 con Retry-After. 'urgent' (STOP / ensure_idle) usa
+    // un worker propio que las rutas comunes no pueden ocupar.
+    void registerAsyncHandler(const httpd_uri_t& handler, uint8_t maxInflight = 1,
+                              bool urgent = false);
     void registerWebSocketHandler(const httpd_uri_t& handler);
     void broadcastWS(const std::string& data);
 
@@ -26,8 +36,36 @@ private:
     void initMdns();
     void initHttp();
     void registerAllFiles(const char* base);
+    void initAsyncWorkers();
+
+    struct AsyncPool {
+        QueueHandle_t queue = nullptr;
+        SemaphoreHandle_t idle = nullptr;   // workers libres
+    };
+    struct AsyncRoute {
+        AsyncPool* pool;
+        esp_err_t (*handler)(httpd_req_t*);
+        void* userCtx;
+        uint8_t maxInflight;
+        std::atomic<uint8_t> inflight{0};
+    };
+    struct AsyncJob {
+        httpd_req_t* req;
+        AsyncRoute* route;
+    };
+    static esp_err_t asyncTrampoline(httpd_req_t* req);
+    static void asyncWorkerTask(void* arg);
+    static void sendBusy(httpd_req_t* req);
+
+    static bool initAsyncPool(AsyncPool& pool, int workers, const char* prefix);
+
+    static constexpr int    kAsyncWorkers       = 3;
+    static constexpr int    kAsyncUrgentWorkers = 1;
+    static constexpr size_t kAsyncWorkerStack   = 8192;
 
     httpd_handle_t http_server = nullptr;
+    AsyncPool asyncPool;        // rutas comunes
+    AsyncPool asyncUrgent;      // solo rutas 'urgent'
 
     std::string wifi_ssid;
     std::string wifi_pass;
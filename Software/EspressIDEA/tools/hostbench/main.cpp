@@ -0,0 +1,363 @@
+// hostbench: corre el protocolo REPL de PyBoardUART en Linux, sin hardware.
+//
+//   pio run -e native
+//   .pio/build/native/program --pty micropython
+//   .pio/build/native/program --tcp 127.0.0.1:2323 --baud 115200 --size 32768
+//
+// Mide latencia de exec() y throughput de writeFileRaw/readFileRaw para cada
+// ChunkSize. Con --baud se simula el tiempo de línea de la UART (10 bits por
+// byte) para que los números sean comparables con los del ESP32. --wire
+// fija la codificación del contenido en la UART (raw por defecto).
+//
+// Con --paste mide en cambio el pegado del paste mode (motor amigable) para
+// cada BaudRate: bytes/s del script y la ventana que aprendió PyBoardUART.
+//
+// Con --codec sube archivos .py/.json representativos (o los de --file) con y
+// sin compresión DEFLATE: B/s de contenido y bytes que cruzaron la línea.
+
+#include "PyBoardUART.hpp"
+#include "PosixTransport.hpp"
+#include "Platform.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace PyBoard;
+
+namespace {
+
+// Decora un transporte agregando el tiempo que tardarían los bytes en la línea
+class PacedTransport : public Transport {
+public:
+    PacedTransport(std::unique_ptr<Transport> inner, uint32_t baud)
+        : inner(std::move(inner)), usPerByte(baud ? 10000000.0 / baud : 0.0) {}
+
+    bool open() override { return inner->open(); }
+    void close() override { inner->close(); }
+    bool isOpen() const override { return inner->isOpen(); }
+    const char *name() const override { return inner->name(); }
+
+    uint64_t txBytes = 0; // enviados a la placa (comandos + datos)
+
+    void setBaud(uint32_t baud) { usPerByte = baud ? 10000000.0 / baud : 0.0; }
+
+    int write(const void *data, size_t len) override {
+        int n = inner->write(data, len);
+        if (n > 0) { pace(static_cast<size_t>(n)); txBytes += static_cast<size_t>(n); }
+        return n;
+    }
+
+protected:
+    size_t readRaw(uint8_t *buf, size_t max, uint32_t timeoutMs) override {
+        size_t n = inner->read(buf, max, timeoutMs);
+        pace(n);
+        return n;
+    }
+    size_t availableRaw() const override { return inner->available(); }
+    void flushRaw() override { inner->flush(); }
+
+private:
+    void pace(size_t n) {
+        if (usPerByte > 0 && n) delayUs(static_cast<uint32_t>(n * usPerByte));
+    }
+
+    std::unique_ptr<Transport> inner;
+    double usPerByte;
+};
+
+void usage() {
+    std::fprintf(stderr,
+        "uso: hostbench (--pty CMD [ARGS...] | --tcp HOST:PORT)\n"
+        "                [--baud N] [--size BYTES] [--iters N] [--path REMOTE]\n"
+        "                [--engine auto|raw|friendly] [--wire raw|escape|base64] [--paste]\n"
+        "                [--codec [--file LOCAL]...]\n");
+}
+
+// Script de ~2 KB con líneas de largo variado, como los que manda el editor
+std::string pasteScript() {
+    std::string s = "def _hb(n):\n    t = 0\n";
+    for (int i = 0; i < 48; ++i) {
+        s += "    t += n * " + std::to_string(i) + "  # " + std::string(8 + (i * 7) % 40, 'x') + "\n";
+    }
+    s += "    return t\nprint(_hb(3))\n";
+    return s;
+}
+
+// Pegado a cada velocidad de BaudRate (el estado de la ventana se arrastra:
+// es lo que pasa en la placa real al cambiar la velocidad)
+int benchPaste(PyBoardUART &board, PacedTransport &paced, int iters) {
+    const BaudRate rates[] = {BaudRate::BAUD_9600, BaudRate::BAUD_19200, BaudRate::BAUD_38400,
+                              BaudRate::BAUD_57600, BaudRate::BAUD_115200, BaudRate::BAUD_230400,
+                              BaudRate::BAUD_460800, BaudRate::BAUD_921600};
+    const std::string script = pasteScript();
+    std::string out;
+    int rc = 0;
+    for (BaudRate b : rates) {
+        paced.setBaud((uint32_t)b);
+        bool ok = true;
+        uint64_t t0 = nowUs();
+        for (int i = 0; i < iters && ok; ++i) {
+            ok = board.exec(script, out) == ErrorCode::OK && out.find("3384") != std::string::npos;
+        }
+        uint64_t us = nowUs() - t0;
+        std::printf("baud=%6d paste=%8.0f B/s window=%4u %s\n", (int)b,
+                    (ok && us) ? script.size() * (double)iters * 1e6 / us : 0.0,
+                    (unsigned)board.getPasteWindow(), ok ? "ok" : board.getLastError().c_str());
+        if (!ok) rc = 1;
+    }
+    return rc;
+}
+
+struct Sample {
+    std::string name;
+    std::vector<uint8_t> data;
+};
+
+// Módulo .py y config .json de ~16 KB, parecidos a los de un proyecto real;
+// el .bin aleatorio muestra que lo incompresible no pierde y el .py con CRLF
+// (guardado en Windows) que los CR llegan intactos con cualquier codificación
+std::vector<Sample> codecSamples() {
+    std::mt19937 rng(1234);
+    static const char *const words[] = {"valor", "pin", "muestra", "ventana", "umbral", "servo",
+                                        "motor", "sensor", "lectura", "estado", "pulso", "canal"};
+    auto word = [&]() { return std::string(words[rng() % 12]); };
+    auto num = [&](unsigned m) { return std::to_string(rng() % m); };
+
+    std::string py = "import time\nfrom machine import Pin, PWM, ADC\n\n";
+    for (int i = 0; py.size() < 16384; ++i) {
+        const std::string w = word(), v = word() + "_" + word();
+        py += "def " + w + "_" + word() + num(100) + "(" + v + ", " + word() + "=" + num(4096) + "):\n"
+              "    # " + word() + " " + word() + " " + word() + " " + num(1000) + "\n"
+              "    " + w + " = ADC(Pin(" + num(40) + ")).read_u16() >> " + num(8) + "\n"
+              "    if " + w + " > " + v + " * " + num(50) + ":\n"
+              "        print('" + word() + "', " + w + ", " + num(100000) + ")\n"
+              "        time.sleep_ms(" + num(500) + ")\n"
+              "    return " + w + " - " + v + "\n\n";
+    }
+    std::string json = "{\n  \"devices\": [\n";
+    for (int i = 0; json.size() < 16384; ++i) {
+        if (i) json += ",\n";
+        json += "    {\"id\": " + std::to_string(i) + ", \"name\": \"" + word() + "_" + num(1000) +
+                "\", \"pin\": " + num(40) + ", \"enabled\": " + (rng() % 2 ? "true" : "false") +
+                ", \"limits\": {\"min\": " + num(90) + ", \"max\": " + num(4096) +
+                "}, \"gain\": " + num(100) + "." + num(1000) + "}";
+    }
+    json += "\n  ]\n}\n";
+
+    std::vector<uint8_t> bin(16384);
+    for (auto &b : bin) b = static_cast<uint8_t>(rng());
+
+    std::string crlf;
+    for (char c : py) {
+        if (c == '\n') crlf.push_back('\r');
+        crlf.push_back(c);
+    }
+
+    return {{"sample.py", {py.begin(), py.end()}},
+            {"sample.json", {json.begin(), json.end()}},
+            {"crlf.py", {crlf.begin(), crlf.end()}},
+            {"random.bin", bin}};
+}
+
+// Cada archivo se sube sin y con compresión (se borra antes: si no, el
+// manifiesto saltearía la segunda escritura) y se relee para comparar
+int benchCodec(PyBoardUART &board, PacedTransport &paced, const std::vector<Sample> &files,
+               const std::string &path, int iters) {
+    int rc = 0;
+    for (const Sample &f : files) {
+        double bps[2] = {0, 0};
+        uint64_t tx[2] = {0, 0};
+        bool ok = true;
+        for (int z = 0; z < 2 && ok; ++z) {
+            board.setCompression(z == 1);
+            uint64_t us = 0;
+            const uint64_t tx0 = paced.txBytes;
+            for (int i = 0; i < iters && ok; ++i) {
+                board.deleteFile(path);
+                const uint64_t t0 = nowUs();
+                ok = board.writeFileRaw(path, f.data) == ErrorCode::OK;
+                us += nowUs() - t0;
+            }
+            std::vector<uint8_t> back;
+            ok = ok && board.readFileRaw(path, back) == ErrorCode::OK && back == f.data;
+            bps[z] = us ? f.data.size() * (double)iters * 1e6 / us : 0.0;
+            tx[z] = (paced.txBytes - tx0) / (iters > 0 ? iters : 1);
+        }
+        std::printf("file=%-12s size=%6u plain=%8.0f B/s (%6u B tx) deflate=%8.0f B/s (%6u B tx) x%.2f %s\n",
+                    f.name.c_str(), (unsigned)f.data.size(), bps[0], (unsigned)tx[0], bps[1],
+                    (unsigned)tx[1], bps[0] > 0 ? bps[1] / bps[0] : 0.0,
+                    ok ? "ok" : board.getLastError().c_str());
+        if (!ok) rc = 1;
+    }
+    board.setCompression(true);
+    board.deleteFile(path);
+    return rc;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::vector<std::string> ptyCmd;
+    std::string tcp;
+    uint32_t baud = 0;
+    size_t size = 16384;
+    int iters = 20;
+    std::string path = "_hostbench.bin";
+    ExecEngine engine = ExecEngine::AUTO;
+    bool paste = false;
+    bool codec = false;
+    WireCodec wire = WireCodec::RAW;
+    std::vector<std::string> codecFiles;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--tcp" && i + 1 < argc) tcp = argv[++i];
+        else if (a == "--baud" && i + 1 < argc) baud = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        else if (a == "--size" && i + 1 < argc) size = std::strtoul(argv[++i], nullptr, 10);
+        else if (a == "--iters" && i + 1 < argc) iters = std::atoi(argv[++i]);
+        else if (a == "--path" && i + 1 < argc) path = argv[++i];
+        else if (a == "--engine" && i + 1 < argc) {
+            std::string e = argv[++i];
+            if (e == "raw") engine = ExecEngine::RAW;
+            else if (e == "friendly") engine = ExecEngine::FRIENDLY;
+            else if (e != "auto") { usage(); return 2; }
+        }
+        else if (a == "--wire" && i + 1 < argc) {
+            std::string w = argv[++i];
+            if (w == "escape") wire = WireCodec::ESCAPE;
+            else if (w == "base64") wire = WireCodec::BASE64;
+            else if (w != "raw") { usage(); return 2; }
+        }
+        else if (a == "--paste") paste = true;
+        else if (a == "--codec") codec = true;
+        else if (a == "--file" && i + 1 < argc) codecFiles.push_back(argv[++i]);
+        else if (a == "--pty") { while (i + 1 < argc) ptyCmd.push_back(argv[++i]); }
+        else { usage(); return 2; }
+    }
+
+    std::unique_ptr<Transport> link;
+    if (!ptyCmd.empty()) {
+        link = std::make_unique<PtyTransport>(ptyCmd);
+    } else if (!tcp.empty()) {
+        size_t colon = tcp.rfind(':');
+        if (colon == std::string::npos) { usage(); return 2; }
+        link = std::make_unique<TcpTransport>(tcp.substr(0, colon),
+                                              (uint16_t)std::atoi(tcp.c_str() + colon + 1));
+    } else {
+        usage();
+        return 2;
+    }
+    auto pacedLink = std::make_unique<PacedTransport>(std::move(link), baud);
+    PacedTransport &paced = *pacedLink;
+    link = std::move(pacedLink);
+
+    PyBoardUART board(std::move(link), Timeout::LONG, ChunkSize::MEDIUM);
+    if (board.init() != ErrorCode::OK) {
+        std::fprintf(stderr, "init: %s\n", board.getLastError().c_str());
+        return 1;
+    }
+    board.setEngine(paste ? ExecEngine::FRIENDLY : engine);
+    board.setWireCodec(wire);
+    if (paste) {
+        int rc = benchPaste(board, paced, iters);
+        board.deinit();
+        return rc;
+    }
+    if (codec) {
+        std::vector<Sample> files;
+        for (const std::string &f : codecFiles) {
+            std::ifstream in(f, std::ios::binary);
+            if (!in) { std::fprintf(stderr, "no se puede leer %s\n", f.c_str()); return 2; }
+            files.push_back({f.substr(f.find_last_of('/') + 1),
+                             {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()}});
+        }
+        if (files.empty()) files = codecSamples();
+        int rc = benchCodec(board, paced, files, path, iters);
+        board.deinit();
+        return rc;
+    }
+
+    // Latencia de exec() (raw REPL, o paste mode completo: prompt, ^E,
+    // pegado, ^D, '>>>')
+    std::string out;
+    if (board.exec("print(1)", out) != ErrorCode::OK) {
+        std::fprintf(stderr, "exec: %s\n", board.getLastError().c_str());
+        return 1;
+    }
+    uint64_t t0 = nowUs();
+    for (int i = 0; i < iters; ++i) board.exec("print(1)", out);
+    double execMs = (nowUs() - t0) / 1000.0 / (iters > 0 ? iters : 1);
+
+    // Latencia de una llamada del agente (ya instalado tras la primera)
+    bool ex = false;
+    board.exists(path, ex);
+    const uint64_t tx0 = paced.txBytes;
+    t0 = nowUs();
+    for (int i = 0; i < iters; ++i) board.exists(path, ex);
+    double agentMs = (nowUs() - t0) / 1000.0 / (iters > 0 ? iters : 1);
+    double agentTx = (double)(paced.txBytes - tx0) / (iters > 0 ? iters : 1);
+
+    std::printf("transport=%s baud=%u engine=%s exec=%.1f ms agent=%.1f ms (%.0f B tx)\n",
+                ptyCmd.empty() ? "tcp" : "pty", baud, board.isInRawRepl() ? "raw" : "friendly",
+                execMs, agentMs, agentTx);
+
+    std::vector<uint8_t> data(size);
+    std::mt19937 rng(1234);
+    for (auto &b : data) b = static_cast<uint8_t>(rng());
+
+    const ChunkSize chunks[] = {ChunkSize::SMALL, ChunkSize::MEDIUM, ChunkSize::LARGE, ChunkSize::VERY_LARGE};
+    int rc = 0;
+    board.setAdaptiveChunk(false);
+    for (ChunkSize c : chunks) {
+        board.setChunkSize(c);
+        board.deleteFile(path); // si no, el manifiesto saltea la escritura
+
+        t0 = nowUs();
+        ErrorCode w = board.writeFileRaw(path, data);
+        uint64_t wUs = nowUs() - t0;
+
+        std::vector<uint8_t> back;
+        t0 = nowUs();
+        ErrorCode r = (w == ErrorCode::OK) ? board.readFileRaw(path, back) : w;
+        uint64_t rUs = nowUs() - t0;
+
+        bool same = (r == ErrorCode::OK && back == data);
+        std::printf("chunk=%4u write=%8.0f B/s read=%8.0f B/s %s\n",
+                    (unsigned)c,
+                    wUs ? size * 1e6 / wUs : 0.0,
+                    rUs ? size * 1e6 / rUs : 0.0,
+                    same ? "ok" : board.getLastError().c_str());
+        if (!same) rc = 1;
+    }
+
+    // Trozo adaptativo: parte de MEDIUM con el techo del mem_free sondeado
+    BoardProfile prof;
+    (void)board.probeBoard(prof);
+    board.setChunkSize(ChunkSize::MEDIUM);
+    board.setAdaptiveChunk(true);
+    for (int i = 0; i < std::max(iters, 4); ++i) {
+        board.deleteFile(path);
+        ErrorCode w = board.writeFileRaw(path, data);
+        const TransferStats ws = board.getLastTransfer();
+        std::vector<uint8_t> back;
+        ErrorCode r = (w == ErrorCode::OK) ? board.readFileRaw(path, back) : w;
+        const TransferStats rs = board.getLastTransfer();
+
+        bool same = (r == ErrorCode::OK && back == data);
+        std::printf("auto  %u/%u write=%8u B/s read=%8u B/s %s\n", (unsigned)ws.chunk,
+                    (unsigned)rs.chunk, ws.bytesPerSec(), rs.bytesPerSec(),
+                    same ? "ok" : board.getLastError().c_str());
+        if (!same) rc = 1;
+    }
+
+    board.deleteFile(path);
+    board.deinit();
+    return rc;
+}